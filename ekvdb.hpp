@@ -0,0 +1,201 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#ifndef EKVDB_HPP_QWERTY
+#define EKVDB_HPP_QWERTY
+
+/*
+ * Header-only C++17 binding. Devices and stores are RAII handles, keys
+ * are std::string_view. get() with a buffer fills it and returns a view
+ * into it, the buffer grows only for a larger value than seen before,
+ * so steady-state reads make no heap calls. get() without a buffer
+ * returns move-only value owning the C heap copy.
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/* hwcost_t has field named virtual, it is virtual_ in C++ */
+#define virtual virtual_
+extern "C" {
+#include <hwmemory.h>
+#include <hwstore.h>
+}
+#undef virtual
+
+namespace ekvdb {
+
+#if __cplusplus >= 202002L
+using bytes = std::span<const char>;
+#else
+using bytes = std::string_view;
+#endif
+
+class device {
+public:
+    /* RAM device */
+    explicit device(int size) {
+        hwmemory_init(&hwmemory_, size);
+    }
+
+    /* File device, extended to size bytes */
+    device(const std::string& path, int size) {
+        if (hwmemory_open(&hwmemory_, const_cast<char*>(path.c_str()), size) < 0) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+    }
+
+    ~device() {
+        hwmemory_destroy(&hwmemory_);
+    }
+
+    device(const device&) = delete;
+    device& operator=(const device&) = delete;
+
+    void setcost(const hwcost_t& cost) {
+        hwmemory_setcost(&hwmemory_, const_cast<hwcost_t*>(&cost));
+    }
+
+    hwmemory_t* get() noexcept { return &hwmemory_; }
+
+private:
+    hwmemory_t hwmemory_;
+};
+
+/* Owns value copy made by store, released with free() */
+class value {
+public:
+    value() noexcept = default;
+    value(char* data, int size) noexcept : data_(data), size_(size) {}
+    ~value() { std::free(data_); }
+
+    value(value&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+
+    value& operator=(value&& other) noexcept {
+        if (this != &other) {
+            std::free(data_);
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    value(const value&) = delete;
+    value& operator=(const value&) = delete;
+
+    explicit operator bool() const noexcept { return data_ != nullptr; }
+    const char* data() const noexcept { return data_; }
+    std::size_t size() const noexcept { return static_cast<std::size_t>(size_); }
+    std::string_view view() const noexcept { return std::string_view(data_, size()); }
+    bytes span() const noexcept { return bytes(data_, size()); }
+
+private:
+    char* data_ = nullptr;
+    int size_ = 0;
+};
+
+/* Reusable read buffer, keeps its largest size */
+class buffer {
+public:
+    explicit buffer(std::size_t size = 256) : data_(size) {}
+
+    char* data() noexcept { return data_.data(); }
+    int capacity() const noexcept { return static_cast<int>(data_.size()); }
+    void reserve(int size) {
+        if (size > capacity()) data_.resize(static_cast<std::size_t>(size));
+    }
+
+private:
+    std::vector<char> data_;
+};
+
+class store {
+public:
+    explicit store(device& dev) {
+        hwstore_init(&hwstore_, dev.get());
+    }
+
+    ~store() {
+        hwstore_destroy(&hwstore_);
+    }
+
+    store(const store&) = delete;
+    store& operator=(const store&) = delete;
+
+    bool set(std::string_view key, std::string_view val) {
+        return hwstore_set(&hwstore_, ckey(key), size(key), const_cast<char*>(val.data()), size(val)) > 0;
+    }
+
+    bool del(std::string_view key) {
+        return hwstore_del(&hwstore_, ckey(key), size(key)) > 0;
+    }
+
+    bool append(std::string_view key, std::string_view val) {
+        return hwstore_append(&hwstore_, ckey(key), size(key), const_cast<char*>(val.data()), size(val)) > 0;
+    }
+
+    std::optional<long> incr(std::string_view key, long delta = 1) {
+        long result = 0;
+        if (hwstore_incr(&hwstore_, ckey(key), size(key), delta, &result) < 0) return std::nullopt;
+        return result;
+    }
+
+    bool expire(std::string_view key, int ttl) {
+        return hwstore_set_ttl(&hwstore_, ckey(key), size(key), ttl) > 0;
+    }
+
+    /* View into buf, valid until next read into same buffer */
+    std::optional<bytes> get(std::string_view key, buffer& buf) {
+        for (;;) {
+            int valsize = 0;
+            if (hwstore_getbuf(&hwstore_, ckey(key), size(key), buf.data(), buf.capacity(), &valsize) < 0) {
+                return std::nullopt;
+            }
+            if (valsize <= buf.capacity()) return bytes(buf.data(), static_cast<std::size_t>(valsize));
+            /* Value grew past buffer, read again into larger one */
+            buf.reserve(valsize);
+        }
+    }
+
+    value get(std::string_view key) {
+        char* data = nullptr;
+        int valsize = 0;
+        if (hwstore_getval(&hwstore_, ckey(key), size(key), &data, &valsize) < 0) return value();
+        return value(data, valsize);
+    }
+
+    void setcache(hwcache_t* hwcache) { hwstore_setcache(&hwstore_, hwcache); }
+    void stats(hwstats_t& stats) { hwstore_stats(&hwstore_, &stats); }
+    hwstore_t* get() noexcept { return &hwstore_; }
+
+private:
+    /* C API takes char* but does not write keys or values */
+    static char* ckey(std::string_view key) noexcept { return const_cast<char*>(key.data()); }
+    static int size(std::string_view data) noexcept { return static_cast<int>(data.size()); }
+
+    hwstore_t hwstore_;
+};
+
+} // namespace ekvdb
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#include <cstdio>
+#include <new>
+#include <string>
+
+#include <ekvdb.hpp>
+
+static long allocs = 0;
+
+void* operator new(std::size_t size) {
+    allocs++;
+    void* ptr = std::malloc(size);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+int main(int argc, char **argv) {
+    ekvdb::device dev(1024 * 16);
+    hwcost_t cost = {};
+    cost.block = 1;
+    cost.virtual_ = 1;
+    dev.setcost(cost);
+    ekvdb::store db(dev);
+
+    int fails = 0;
+    std::string big(1000, 'x');
+    db.set("a", "1");
+    db.set("big", big);
+
+    ekvdb::buffer buf(16);
+    auto val = db.get("a", buf);
+    if (!val || std::string_view(val->data(), val->size()) != "1") fails++;
+    /* Buffer grows for chunked value */
+    val = db.get("big", buf);
+    if (!val || val->size() != big.size() || buf.capacity() < 1000) fails++;
+
+    long before = allocs;
+    for (int i = 0; i < 100; i++) {
+        val = db.get(i % 2 ? "a" : "big", buf);
+        if (!val) fails++;
+    }
+    long steady = allocs - before;
+    if (db.get("none", buf)) fails++;
+
+    ekvdb::value owned = db.get("a");
+    ekvdb::value moved = std::move(owned);
+    if (owned || !moved || moved.view() != "1") fails++;
+
+    auto counter = db.incr("hits", 3);
+    if (!counter || *counter != 3) fails++;
+    db.append("a", "23");
+    if (db.get("a").view() != "123") fails++;
+    if (!db.del("a") || db.get("a")) fails++;
+
+    std::printf("cxx steady allocs = %ld, fails = %d\n", steady, fails);
+    if (steady != 0 || fails != 0) {
+        std::printf("cxx mismatch\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,696 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <strings.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <hwmemory.h>
+#include <hwstore.h>
+
+/*
+ * Network server over one hwstore. Speaks a subset of Redis RESP:
+ * PING, ECHO, GET, SET [EX|PX], DEL, MGET, DBSIZE, QUIT, plus empty
+ * replies to COMMAND and CONFIG for stock clients. Every worker thread
+ * runs own epoll loop and accepts on shared listeners, connections stay
+ * on the worker that accepted them. Pipelined requests are answered in
+ * one write. Server either writes change log of its store or follows
+ * log of another server as read-only replica.
+ */
+
+#define DBUF_SIZE       (16 * 1024)
+#define DMAX_ARGS       1024
+#define DMAX_BULK       (64 * 1024 * 1024)
+#define DMAX_EVENTS     64
+#define DFOLLOW_BATCH   4096
+#define DFOLLOW_WAIT    10000   /* usec */
+#define DSCRUB_WAIT     100000  /* usec, scrub budget is spread over ticks */
+
+#define DCONN_LISTEN    0
+#define DCONN_CLIENT    1
+
+typedef struct {
+    char*   addr;
+    int     port;
+    char*   unixpath;
+    int     workers;
+    int     memsize;
+    hwcost_t    cost;
+    long    cachesize;
+    int     evict;
+    int     extsize;
+    int     index;
+    int     freemap;
+    int     align;
+    long    behind;
+    long    scrub;
+    char*   logpath;
+    char*   followpath;
+} dconf_t;
+
+typedef struct {
+    int     kind;
+    int     fd;
+    char*   inbuf;
+    int     inlen;
+    int     incapa;
+    char*   outbuf;
+    int     outlen;
+    int     outpos;
+    int     outcapa;
+    int     closing;    /* close after reply is written */
+    int     waitout;    /* EPOLLOUT is armed */
+} dconn_t;
+
+typedef struct {
+    int     id;
+    int     epfd;
+    hwstore_t*  hwstore;
+    dconn_t*    listeners[2];
+    int     nlisteners;
+    int     readonly;
+    hwfollow_t* hwfollow;   /* set for log follower thread */
+    long    scrub;      /* bytes per second for scrub thread */
+    long    commands;
+    long    conns;
+} dworker_t;
+
+static volatile sig_atomic_t dstop = 0;
+
+static void dsignal(int sig) {
+    dstop = 1;
+}
+
+static int dnonblock(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int dlisten_tcp(char* addr, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    if (inet_pton(AF_INET, addr, &sa.sin_addr) != 1
+        || bind(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0
+        || listen(fd, SOMAXCONN) < 0 || dnonblock(fd) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int dlisten_unix(char* path) {
+    struct sockaddr_un sa;
+    if (strlen(path) >= sizeof(sa.sun_path)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0
+        || listen(fd, SOMAXCONN) < 0 || dnonblock(fd) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static dconn_t* dconn_new(int kind, int fd) {
+    dconn_t* conn = calloc(1, sizeof(dconn_t));
+    conn->kind = kind;
+    conn->fd = fd;
+    if (kind == DCONN_CLIENT) {
+        conn->incapa = DBUF_SIZE;
+        conn->inbuf = malloc(conn->incapa);
+        conn->outcapa = DBUF_SIZE;
+        conn->outbuf = malloc(conn->outcapa);
+    }
+    return conn;
+}
+
+static void dconn_free(dconn_t* conn) {
+    close(conn->fd);
+    free(conn->inbuf);
+    free(conn->outbuf);
+    free(conn);
+}
+
+static void dout(dconn_t* conn, char* data, int size) {
+    if (conn->outlen + size > conn->outcapa) {
+        while (conn->outlen + size > conn->outcapa) conn->outcapa *= 2;
+        conn->outbuf = realloc(conn->outbuf, conn->outcapa);
+    }
+    memcpy(conn->outbuf + conn->outlen, data, size);
+    conn->outlen += size;
+}
+
+static void dout_str(dconn_t* conn, char* str) {
+    dout(conn, str, strlen(str));
+}
+
+static void dout_int(dconn_t* conn, char type, long value) {
+    char line[32];
+    int size = snprintf(line, sizeof(line), "%c%ld\r\n", type, value);
+    dout(conn, line, size);
+}
+
+static void dout_bulk(dconn_t* conn, char* data, int size) {
+    if (data == NULL) {
+        dout_str(conn, "$-1\r\n");
+        return;
+    }
+    dout_int(conn, '$', size);
+    dout(conn, data, size);
+    dout(conn, "\r\n", 2);
+}
+
+/* Returns position of CRLF at or after pos, -1 if line is incomplete */
+static int dline(dconn_t* conn, int pos) {
+    for (int i = pos; i + 1 < conn->inlen; i++) {
+        if (conn->inbuf[i] == '\r' && conn->inbuf[i + 1] == '\n') return i;
+    }
+    return -1;
+}
+
+/*
+ * Parse one request at pos into argument pointers into input buffer.
+ * Returns bytes consumed, 0 if request is incomplete, -1 on protocol
+ * error. Lines not starting with '*' are inline commands.
+ */
+static int dparse(dconn_t* conn, int pos, char** argv, int* argl, int* argc) {
+    int eol = dline(conn, pos);
+    if (eol < 0) return conn->inlen - pos > DMAX_BULK ? -1 : 0;
+
+    char* buf = conn->inbuf;
+    if (buf[pos] != '*') {
+        *argc = 0;
+        int i = pos;
+        while (i < eol && *argc < DMAX_ARGS) {
+            while (i < eol && buf[i] == ' ') i++;
+            if (i == eol) break;
+            argv[*argc] = buf + i;
+            while (i < eol && buf[i] != ' ') i++;
+            argl[*argc] = (int)(buf + i - argv[*argc]);
+            (*argc)++;
+        }
+        return eol + 2 - pos;
+    }
+
+    long count = strtol(buf + pos + 1, NULL, 10);
+    if (count < 0 || count > DMAX_ARGS) return -1;
+    int next = eol + 2;
+    for (int n = 0; n < count; n++) {
+        eol = dline(conn, next);
+        if (eol < 0) return 0;
+        if (buf[next] != '$') return -1;
+        long size = strtol(buf + next + 1, NULL, 10);
+        if (size < 0 || size > DMAX_BULK) return -1;
+        int data = eol + 2;
+        if (data + size + 2 > conn->inlen) return 0;
+        argv[n] = buf + data;
+        argl[n] = (int)size;
+        next = data + (int)size + 2;
+    }
+    *argc = (int)count;
+    return next - pos;
+}
+
+static int dis(char* arg, int argl, char* name) {
+    return argl == (int)strlen(name) && strncasecmp(arg, name, argl) == 0;
+}
+
+static void dexec(dworker_t* worker, dconn_t* conn, char** argv, int* argl, int argc) {
+    hwstore_t* hwstore = worker->hwstore;
+    worker->commands++;
+    if (argc == 0) return;
+
+    if (dis(argv[0], argl[0], "PING")) {
+        if (argc > 1) {
+            dout_bulk(conn, argv[1], argl[1]);
+        } else {
+            dout_str(conn, "+PONG\r\n");
+        }
+    } else if (dis(argv[0], argl[0], "ECHO") && argc == 2) {
+        dout_bulk(conn, argv[1], argl[1]);
+    } else if (dis(argv[0], argl[0], "GET") && argc == 2) {
+        char* val = NULL;
+        int valsize = 0;
+        if (hwstore_getval(hwstore, argv[1], argl[1], &val, &valsize) > 0) {
+            dout_bulk(conn, val, valsize);
+        } else {
+            dout_bulk(conn, NULL, 0);
+        }
+        free(val);
+    } else if (dis(argv[0], argl[0], "MGET") && argc > 1) {
+        dout_int(conn, '*', argc - 1);
+        for (int i = 1; i < argc; i++) {
+            char* val = NULL;
+            int valsize = 0;
+            if (hwstore_getval(hwstore, argv[i], argl[i], &val, &valsize) > 0) {
+                dout_bulk(conn, val, valsize);
+            } else {
+                dout_bulk(conn, NULL, 0);
+            }
+            free(val);
+        }
+    } else if (worker->readonly && (dis(argv[0], argl[0], "SET") || dis(argv[0], argl[0], "DEL"))) {
+        dout_str(conn, "-READONLY follower does not take writes\r\n");
+    } else if (dis(argv[0], argl[0], "SET") && (argc == 3 || argc == 5)) {
+        int ttl = 0;
+        if (argc == 5) {
+            long value = strtol(argv[4], NULL, 10);
+            if (dis(argv[3], argl[3], "EX") && value > 0) {
+                ttl = (int)value;
+            } else if (dis(argv[3], argl[3], "PX") && value > 0) {
+                /* Expiry has one second granularity */
+                ttl = (int)((value + 999) / 1000);
+            } else {
+                dout_str(conn, "-ERR syntax error\r\n");
+                return;
+            }
+        }
+        if (hwstore_set(hwstore, argv[1], argl[1], argv[2], argl[2]) < 0) {
+            dout_str(conn, "-ERR store is full\r\n");
+            return;
+        }
+        if (ttl > 0) {
+            hwstore_set_ttl(hwstore, argv[1], argl[1], ttl);
+        }
+        dout_str(conn, "+OK\r\n");
+    } else if (dis(argv[0], argl[0], "DEL") && argc > 1) {
+        long count = 0;
+        for (int i = 1; i < argc; i++) {
+            if (hwstore_del(hwstore, argv[i], argl[i]) > 0) count++;
+        }
+        dout_int(conn, ':', count);
+    } else if (dis(argv[0], argl[0], "DBSIZE")) {
+        hwstats_t stats;
+        hwstore_stats(hwstore, &stats);
+        dout_int(conn, ':', stats.usedchain - stats.retired);
+    } else if (dis(argv[0], argl[0], "COMMAND") || dis(argv[0], argl[0], "CONFIG")) {
+        dout_str(conn, "*0\r\n");
+    } else if (dis(argv[0], argl[0], "QUIT")) {
+        dout_str(conn, "+OK\r\n");
+        conn->closing = 1;
+    } else {
+        dout_str(conn, "-ERR unknown command or wrong number of arguments\r\n");
+    }
+}
+
+/* Returns -1 if connection is to be closed */
+static int dflush(dworker_t* worker, dconn_t* conn) {
+    while (conn->outpos < conn->outlen) {
+        ssize_t n = write(conn->fd, conn->outbuf + conn->outpos, conn->outlen - conn->outpos);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) return -1;
+        conn->outpos += n;
+    }
+    if (conn->outpos == conn->outlen) {
+        conn->outpos = 0;
+        conn->outlen = 0;
+        if (conn->closing) return -1;
+    }
+
+    int waitout = conn->outlen > 0;
+    if (waitout != conn->waitout) {
+        struct epoll_event ev;
+        ev.events = waitout ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        ev.data.ptr = conn;
+        epoll_ctl(worker->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->waitout = waitout;
+    }
+    return 0;
+}
+
+/* Read what is available, answer every complete request, write once */
+static int dserve(dworker_t* worker, dconn_t* conn) {
+    for (;;) {
+        if (conn->inlen == conn->incapa) {
+            conn->incapa *= 2;
+            conn->inbuf = realloc(conn->inbuf, conn->incapa);
+        }
+        ssize_t n = read(conn->fd, conn->inbuf + conn->inlen, conn->incapa - conn->inlen);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) return -1;
+        conn->inlen += n;
+        if (conn->inlen < conn->incapa) break;
+    }
+
+    char* argv[DMAX_ARGS];
+    int argl[DMAX_ARGS];
+    int pos = 0;
+    while (pos < conn->inlen && !conn->closing) {
+        int argc = 0;
+        int used = dparse(conn, pos, argv, argl, &argc);
+        if (used == 0) break;
+        if (used < 0) {
+            dout_str(conn, "-ERR protocol error\r\n");
+            conn->closing = 1;
+            break;
+        }
+        dexec(worker, conn, argv, argl, argc);
+        pos += used;
+    }
+    if (pos > 0) {
+        memmove(conn->inbuf, conn->inbuf + pos, conn->inlen - pos);
+        conn->inlen -= pos;
+    }
+    return dflush(worker, conn);
+}
+
+static void daccept(dworker_t* worker, dconn_t* listener) {
+    for (;;) {
+        int fd = accept(listener->fd, NULL, NULL);
+        if (fd < 0) return;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        dnonblock(fd);
+
+        dconn_t* conn = dconn_new(DCONN_CLIENT, fd);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            dconn_free(conn);
+            continue;
+        }
+        worker->conns++;
+    }
+}
+
+static void* dworker_run(void* arg) {
+    dworker_t* worker = (dworker_t*)arg;
+    struct epoll_event events[DMAX_EVENTS];
+
+    while (!dstop) {
+        int n = epoll_wait(worker->epfd, events, DMAX_EVENTS, 200);
+        for (int i = 0; i < n; i++) {
+            dconn_t* conn = (dconn_t*)events[i].data.ptr;
+            if (conn->kind == DCONN_LISTEN) {
+                daccept(worker, conn);
+                continue;
+            }
+            int res = 0;
+            if ((events[i].events & (EPOLLERR | EPOLLHUP)) != 0 && (events[i].events & EPOLLIN) == 0) {
+                res = -1;
+            } else if ((events[i].events & EPOLLIN) != 0) {
+                res = dserve(worker, conn);
+            } else if ((events[i].events & EPOLLOUT) != 0) {
+                res = dflush(worker, conn);
+            }
+            if (res < 0) {
+                epoll_ctl(worker->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+                dconn_free(conn);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Apply leader log in batches, sleep when there is nothing new */
+static void* dfollow_run(void* arg) {
+    dworker_t* worker = (dworker_t*)arg;
+    hwfollow_t* hwfollow = worker->hwfollow;
+    while (!dstop) {
+        int applied = hwstore_apply(worker->hwstore, hwfollow, DFOLLOW_BATCH);
+        if (applied < 0) {
+            fprintf(stderr, "ekvdbd: cannot apply log after sequence %ld\n", hwfollow->seq);
+        }
+        if (applied <= 0) {
+            usleep(DFOLLOW_WAIT);
+        }
+    }
+    return NULL;
+}
+
+/* Check cell checksums in background at given bytes per second */
+static void* dscrub_run(void* arg) {
+    dworker_t* worker = (dworker_t*)arg;
+    long budget = worker->scrub / (1000000 / DSCRUB_WAIT) + 1;
+    while (!dstop) {
+        int bad = hwstore_scrub(worker->hwstore, budget);
+        if (bad > 0) {
+            fprintf(stderr, "ekvdbd: scrub found %d bad cells\n", bad);
+        }
+        usleep(DSCRUB_WAIT);
+    }
+    return NULL;
+}
+
+static int dparse_cost(char* arg, hwcost_t* cost) {
+    long opnsec, rnsec, wnsec;
+    int block = 1;
+    int n = sscanf(arg, "%ld:%ld:%ld:%d", &opnsec, &rnsec, &wnsec, &block);
+    if (n < 3) return -1;
+    cost->opnsec = opnsec;
+    cost->rnsec = rnsec;
+    cost->wnsec = wnsec;
+    cost->block = block;
+    return 0;
+}
+
+static void dusage(char* name) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -a addr       TCP listen address (default 127.0.0.1)\n"
+        "  -p port       TCP port, 0 disables TCP (default 6380)\n"
+        "  -u path       also listen on unix socket\n"
+        "  -t workers    worker threads (default 4)\n"
+        "  -m bytes      device size (default 8388608)\n"
+        "  -c op:r:w[:block]  device cost, ns per op, per read and write byte\n"
+        "  -v            virtual device clock, no real sleeping\n"
+        "  -C bytes      value cache budget (default 0, no cache)\n"
+        "  -E            evict cold cells when device is full\n"
+        "  -G bytes      grow store by extents of this size (default 0, no growth)\n"
+        "  -I            keep RAM key index\n"
+        "  -A            keep RAM map of free cells\n"
+        "  -B bytes      align cells to bytes, power of two from 64 (default 1, none)\n"
+        "  -W bytes      write-behind buffer limit (default 0, write through)\n"
+        "  -S bytes      scrub cell checksums at bytes per second (default 0, off)\n"
+        "  -L path       write change log of store to file\n"
+        "  -F path       follow change log file of another server, read-only\n",
+        name);
+}
+
+int main(int argc, char **argv) {
+    dconf_t conf = {
+        .addr = "127.0.0.1",
+        .port = 6380,
+        .unixpath = NULL,
+        .workers = 4,
+        .memsize = 8 * 1024 * 1024,
+        .cachesize = 0,
+        .evict = HWEVICT_NONE,
+        .extsize = 0,
+        .index = 0,
+        .freemap = 0,
+        .align = 1,
+        .behind = 0,
+        .scrub = 0,
+        .logpath = NULL,
+        .followpath = NULL,
+    };
+    /* Device costs nothing unless asked, server should not sleep */
+    memset(&conf.cost, 0, sizeof(hwcost_t));
+    conf.cost.block = 1;
+    conf.cost.virtual = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:u:t:m:c:vC:EG:IAB:W:S:L:F:")) != -1) {
+        switch (opt) {
+            case 'a': conf.addr = optarg; break;
+            case 'p': conf.port = atoi(optarg); break;
+            case 'u': conf.unixpath = optarg; break;
+            case 't': conf.workers = atoi(optarg); break;
+            case 'm': conf.memsize = atoi(optarg); break;
+            case 'c':
+                if (dparse_cost(optarg, &conf.cost) < 0) {
+                    dusage(argv[0]);
+                    return 1;
+                }
+                conf.cost.virtual = 0;
+                break;
+            case 'v': conf.cost.virtual = 1; break;
+            case 'C': conf.cachesize = atol(optarg); break;
+            case 'E': conf.evict = HWEVICT_CLOCK; break;
+            case 'G': conf.extsize = atoi(optarg); break;
+            case 'I': conf.index = 1; break;
+            case 'A': conf.freemap = 1; break;
+            case 'B': conf.align = atoi(optarg); break;
+            case 'W': conf.behind = atol(optarg); break;
+            case 'S': conf.scrub = atol(optarg); break;
+            case 'L': conf.logpath = optarg; break;
+            case 'F': conf.followpath = optarg; break;
+            default:
+                dusage(argv[0]);
+                return 1;
+        }
+    }
+    if (conf.workers < 1 || (conf.port <= 0 && conf.unixpath == NULL)
+        || (conf.logpath != NULL && conf.followpath != NULL)) {
+        dusage(argv[0]);
+        return 1;
+    }
+
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, conf.memsize);
+    hwmemory_setcost(&hwmemory, &conf.cost);
+
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+    hwstore_setevict(&hwstore, conf.evict);
+    hwstore_setindex(&hwstore, conf.index);
+    hwstore_setfreemap(&hwstore, conf.freemap);
+    if (hwstore_setalign(&hwstore, conf.align) < 0) {
+        dusage(argv[0]);
+        return 1;
+    }
+    if (hwstore_setbehind(&hwstore, conf.behind) < 0) {
+        dusage(argv[0]);
+        return 1;
+    }
+    if (hwstore_setgrow(&hwstore, conf.extsize) < 0) {
+        dusage(argv[0]);
+        return 1;
+    }
+    hwcache_t hwcache;
+    hwcache_init(&hwcache, conf.cachesize);
+    if (conf.cachesize > 0) {
+        hwstore_setcache(&hwstore, &hwcache);
+    }
+    hwlog_t hwlog;
+    if (conf.logpath != NULL) {
+        if (hwlog_open(&hwlog, conf.logpath) < 0) {
+            fprintf(stderr, "cannot open log %s: %s\n", conf.logpath, strerror(errno));
+            return 1;
+        }
+        hwstore_setlog(&hwstore, &hwlog);
+    }
+    hwfollow_t hwfollow;
+    if (conf.followpath != NULL && hwfollow_open(&hwfollow, conf.followpath, 0) < 0) {
+        fprintf(stderr, "cannot open log %s: %s\n", conf.followpath, strerror(errno));
+        return 1;
+    }
+
+    dconn_t* listeners[2];
+    int nlisteners = 0;
+    if (conf.port > 0) {
+        int fd = dlisten_tcp(conf.addr, conf.port);
+        if (fd < 0) {
+            fprintf(stderr, "cannot listen on %s:%d: %s\n", conf.addr, conf.port, strerror(errno));
+            return 1;
+        }
+        listeners[nlisteners++] = dconn_new(DCONN_LISTEN, fd);
+    }
+    if (conf.unixpath != NULL) {
+        int fd = dlisten_unix(conf.unixpath);
+        if (fd < 0) {
+            fprintf(stderr, "cannot listen on %s: %s\n", conf.unixpath, strerror(errno));
+            return 1;
+        }
+        listeners[nlisteners++] = dconn_new(DCONN_LISTEN, fd);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, dsignal);
+    signal(SIGTERM, dsignal);
+
+    /* Each listener wakes one worker per connection */
+    dworker_t* workers = calloc(conf.workers, sizeof(dworker_t));
+    pthread_t* tids = calloc(conf.workers, sizeof(pthread_t));
+    for (int i = 0; i < conf.workers; i++) {
+        workers[i].id = i;
+        workers[i].hwstore = &hwstore;
+        workers[i].readonly = conf.followpath != NULL;
+        workers[i].epfd = epoll_create1(0);
+        for (int j = 0; j < nlisteners; j++) {
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+            ev.data.ptr = listeners[j];
+            epoll_ctl(workers[i].epfd, EPOLL_CTL_ADD, listeners[j]->fd, &ev);
+        }
+        pthread_create(&tids[i], NULL, dworker_run, &workers[i]);
+    }
+    dworker_t follower;
+    pthread_t followtid;
+    if (conf.followpath != NULL) {
+        memset(&follower, 0, sizeof(dworker_t));
+        follower.hwstore = &hwstore;
+        follower.hwfollow = &hwfollow;
+        pthread_create(&followtid, NULL, dfollow_run, &follower);
+    }
+    dworker_t scrubber;
+    pthread_t scrubtid;
+    if (conf.scrub > 0) {
+        memset(&scrubber, 0, sizeof(dworker_t));
+        scrubber.hwstore = &hwstore;
+        scrubber.scrub = conf.scrub;
+        pthread_create(&scrubtid, NULL, dscrub_run, &scrubber);
+    }
+    fprintf(stderr, "ekvdbd: %d workers, tcp %s:%d, unix %s\n", conf.workers,
+                conf.addr, conf.port, conf.unixpath != NULL ? conf.unixpath : "-");
+
+    long commands = 0;
+    long conns = 0;
+    for (int i = 0; i < conf.workers; i++) {
+        pthread_join(tids[i], NULL);
+        close(workers[i].epfd);
+        commands += workers[i].commands;
+        conns += workers[i].conns;
+    }
+    for (int i = 0; i < nlisteners; i++) {
+        dconn_free(listeners[i]);
+    }
+    if (conf.unixpath != NULL) {
+        unlink(conf.unixpath);
+    }
+    if (conf.followpath != NULL) {
+        pthread_join(followtid, NULL);
+        fprintf(stderr, "ekvdbd: followed log to sequence %ld\n", hwfollow.seq);
+        hwfollow_close(&hwfollow);
+    }
+    if (conf.scrub > 0) {
+        pthread_join(scrubtid, NULL);
+    }
+    if (conf.logpath != NULL) {
+        hwstore_setlog(&hwstore, NULL);
+        hwlog_close(&hwlog);
+    }
+
+    hwstats_t stats;
+    hwstore_stats(&hwstore, &stats);
+    fprintf(stderr, "ekvdbd: %ld connections, %ld commands, %ld live cells, %ld bad cells\n",
+                conns, commands, stats.livecells, stats.corrupt);
+
+    free(workers);
+    free(tids);
+    hwstore_destroy(&hwstore);
+    hwcache_destroy(&hwcache);
+    hwmemory_destroy(&hwmemory);
+    return 0;
+}
@@ -0,0 +1,313 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <hwcache.h>
+
+static unsigned long hwcache_hash(char* key, int keysize);
+static long hwcache_esize(hwcentry_t* entry);
+static hwcentry_t** hwcache_link(hwcache_t* hwcache, unsigned long hash, char* key, int keysize);
+static void hwcache_grow(hwcache_t* hwcache);
+static void hwcache_qpush(hwcqueue_t* queue, hwcentry_t* entry);
+static void hwcache_qunlink(hwcqueue_t* queue, hwcentry_t* entry);
+static hwcqueue_t* hwcache_queue(hwcache_t* hwcache, hwcentry_t* entry);
+static void hwcache_drop(hwcache_t* hwcache, hwcentry_t* entry);
+static void hwcache_evict(hwcache_t* hwcache);
+static void hwcache_store(hwcache_t* hwcache, char* key, int keysize, char* val, int valsize,
+                                int addr, long expire, int admit);
+
+void hwcache_init(hwcache_t* hwcache, long budget) {
+    memset(hwcache, 0, sizeof(hwcache_t));
+    pthread_mutex_init(&(hwcache->lock), NULL);
+    hwcache->budget = budget;
+    hwcache->tablesize = 64;
+    hwcache->table = calloc(hwcache->tablesize, sizeof(hwcentry_t*));
+    hwcache->ghostsize = HWCACHE_GHOST;
+    hwcache->ghost = calloc(hwcache->ghostsize, sizeof(unsigned long));
+}
+
+void hwcache_destroy(hwcache_t* hwcache) {
+    for (int i = 0; i < hwcache->tablesize; i++) {
+        hwcentry_t* entry = hwcache->table[i];
+        while (entry != NULL) {
+            hwcentry_t* next = entry->hnext;
+            free(entry);
+            entry = next;
+        }
+    }
+    free(hwcache->table);
+    free(hwcache->ghost);
+    hwcache->table = NULL;
+    hwcache->ghost = NULL;
+    pthread_mutex_destroy(&(hwcache->lock));
+}
+
+static unsigned long hwcache_hash(char* key, int keysize) {
+    /* FNV-1a */
+    unsigned long hash = 0xCBF29CE484222325UL;
+    for (int i = 0; i < keysize; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 0x100000001B3UL;
+    }
+    return hash;
+}
+
+static long hwcache_esize(hwcentry_t* entry) {
+    return (long)sizeof(hwcentry_t) + entry->keysize + entry->valsize;
+}
+
+/* Returns link which points to entry with the key or to end of chain */
+static hwcentry_t** hwcache_link(hwcache_t* hwcache, unsigned long hash, char* key, int keysize) {
+    hwcentry_t** link = &(hwcache->table[hash & (hwcache->tablesize - 1)]);
+    while (*link != NULL) {
+        hwcentry_t* entry = *link;
+        if (entry->hash == hash && entry->keysize == keysize
+            && memcmp(entry->data, key, keysize) == 0) {
+            break;
+        }
+        link = &(entry->hnext);
+    }
+    return link;
+}
+
+static void hwcache_grow(hwcache_t* hwcache) {
+    int tablesize = hwcache->tablesize * 2;
+    hwcentry_t** table = calloc(tablesize, sizeof(hwcentry_t*));
+    for (int i = 0; i < hwcache->tablesize; i++) {
+        hwcentry_t* entry = hwcache->table[i];
+        while (entry != NULL) {
+            hwcentry_t* next = entry->hnext;
+            int slot = entry->hash & (tablesize - 1);
+            entry->hnext = table[slot];
+            table[slot] = entry;
+            entry = next;
+        }
+    }
+    free(hwcache->table);
+    hwcache->table = table;
+    hwcache->tablesize = tablesize;
+}
+
+static void hwcache_qpush(hwcqueue_t* queue, hwcentry_t* entry) {
+    entry->qprev = NULL;
+    entry->qnext = queue->head;
+    if (queue->head != NULL) {
+        queue->head->qprev = entry;
+    } else {
+        queue->tail = entry;
+    }
+    queue->head = entry;
+    queue->bytes += hwcache_esize(entry);
+}
+
+static void hwcache_qunlink(hwcqueue_t* queue, hwcentry_t* entry) {
+    if (entry->qprev != NULL) {
+        entry->qprev->qnext = entry->qnext;
+    } else {
+        queue->head = entry->qnext;
+    }
+    if (entry->qnext != NULL) {
+        entry->qnext->qprev = entry->qprev;
+    } else {
+        queue->tail = entry->qprev;
+    }
+    queue->bytes -= hwcache_esize(entry);
+}
+
+static hwcqueue_t* hwcache_queue(hwcache_t* hwcache, hwcentry_t* entry) {
+    return entry->queue == HWCACHE_MAINQ ? &(hwcache->main) : &(hwcache->small);
+}
+
+/* Removes entry from queue and table and frees it */
+static void hwcache_drop(hwcache_t* hwcache, hwcentry_t* entry) {
+    hwcache_qunlink(hwcache_queue(hwcache, entry), entry);
+    hwcentry_t** link = hwcache_link(hwcache, entry->hash, entry->data, entry->keysize);
+    *link = entry->hnext;
+    hwcache->count--;
+    free(entry);
+}
+
+/*
+ * Evict until cache fits budget. Small queue tail either goes to main
+ * queue if it was hit after admission, or leaves its hash in ghost
+ * queue. Main queue tail is reinserted while it has hits left.
+ */
+static void hwcache_evict(hwcache_t* hwcache) {
+    long smallmax = hwcache->budget * HWCACHE_SMALL / 100;
+
+    while (hwcache->small.bytes + hwcache->main.bytes > hwcache->budget) {
+        if (hwcache->small.tail != NULL
+            && (hwcache->small.bytes > smallmax || hwcache->main.tail == NULL)) {
+            hwcentry_t* entry = hwcache->small.tail;
+            if (entry->freq > 0) {
+                hwcache_qunlink(&(hwcache->small), entry);
+                entry->freq = 0;
+                entry->queue = HWCACHE_MAINQ;
+                hwcache_qpush(&(hwcache->main), entry);
+                hwcache->stats.promotes++;
+                continue;
+            }
+            hwcache->ghost[entry->hash % hwcache->ghostsize] = entry->hash | 1;
+            hwcache_drop(hwcache, entry);
+            hwcache->stats.evicts++;
+            continue;
+        }
+        hwcentry_t* entry = hwcache->main.tail;
+        if (entry->freq > 0) {
+            hwcache_qunlink(&(hwcache->main), entry);
+            entry->freq--;
+            hwcache_qpush(&(hwcache->main), entry);
+            continue;
+        }
+        hwcache_drop(hwcache, entry);
+        hwcache->stats.evicts++;
+    }
+}
+
+static void hwcache_store(hwcache_t* hwcache, char* key, int keysize, char* val, int valsize,
+                                int addr, long expire, int admit) {
+    unsigned long hash = hwcache_hash(key, keysize);
+    long esize = (long)sizeof(hwcentry_t) + keysize + valsize;
+
+    pthread_mutex_lock(&(hwcache->lock));
+    hwcentry_t** link = hwcache_link(hwcache, hash, key, keysize);
+    hwcentry_t* entry = *link;
+
+    /* Big objects would flush the cache, old copy must go anyway */
+    if (esize > hwcache->budget / HWCACHE_MAXOBJECT || (entry == NULL && !admit)) {
+        if (entry != NULL) hwcache_drop(hwcache, entry);
+        pthread_mutex_unlock(&(hwcache->lock));
+        return;
+    }
+
+    int freq = 0;
+    int queue = HWCACHE_SMALLQ;
+    if (entry != NULL) {
+        /* Replaced value keeps queue and frequency of old one */
+        freq = entry->freq;
+        queue = entry->queue;
+        hwcache_drop(hwcache, entry);
+    } else {
+        unsigned long* ghost = &(hwcache->ghost[hash % hwcache->ghostsize]);
+        if (*ghost == (hash | 1)) {
+            queue = HWCACHE_MAINQ;
+            *ghost = 0;
+        }
+        hwcache->stats.admits++;
+    }
+
+    entry = malloc(esize);
+    entry->hash = hash;
+    entry->expire = expire;
+    entry->addr = addr;
+    entry->keysize = keysize;
+    entry->valsize = valsize;
+    entry->freq = freq;
+    entry->queue = queue;
+    memcpy(entry->data, key, keysize);
+    memcpy(entry->data + keysize, val, valsize);
+
+    if (hwcache->count >= hwcache->tablesize) {
+        hwcache_grow(hwcache);
+    }
+    link = &(hwcache->table[hash & (hwcache->tablesize - 1)]);
+    entry->hnext = *link;
+    *link = entry;
+    hwcache->count++;
+    hwcache_qpush(hwcache_queue(hwcache, entry), entry);
+
+    hwcache_evict(hwcache);
+    pthread_mutex_unlock(&(hwcache->lock));
+}
+
+/* Returns store address of cached value and its copy, -1 for miss */
+int hwcache_get(hwcache_t* hwcache, char* key, int keysize, char** val, int* valsize, long now) {
+    unsigned long hash = hwcache_hash(key, keysize);
+    int addr = -1;
+
+    pthread_mutex_lock(&(hwcache->lock));
+    hwcentry_t* entry = *hwcache_link(hwcache, hash, key, keysize);
+    if (entry != NULL && entry->expire != 0 && entry->expire <= now) {
+        hwcache_drop(hwcache, entry);
+        entry = NULL;
+    }
+    if (entry != NULL) {
+        if (entry->freq < HWCACHE_MAXFREQ) entry->freq++;
+        *val = malloc(entry->valsize);
+        memcpy(*val, entry->data + entry->keysize, entry->valsize);
+        *valsize = entry->valsize;
+        addr = entry->addr;
+        hwcache->stats.hits++;
+    } else {
+        hwcache->stats.misses++;
+    }
+    pthread_mutex_unlock(&(hwcache->lock));
+    return addr;
+}
+
+/* Copy cached value to buffer if it fits, valsize is set anyway */
+int hwcache_getbuf(hwcache_t* hwcache, char* key, int keysize, char* buf, int bufsize, int* valsize, long now) {
+    unsigned long hash = hwcache_hash(key, keysize);
+    int addr = -1;
+
+    pthread_mutex_lock(&(hwcache->lock));
+    hwcentry_t* entry = *hwcache_link(hwcache, hash, key, keysize);
+    if (entry != NULL && entry->expire != 0 && entry->expire <= now) {
+        hwcache_drop(hwcache, entry);
+        entry = NULL;
+    }
+    if (entry != NULL) {
+        if (entry->freq < HWCACHE_MAXFREQ) entry->freq++;
+        if (entry->valsize <= bufsize) {
+            memcpy(buf, entry->data + entry->keysize, entry->valsize);
+        }
+        *valsize = entry->valsize;
+        addr = entry->addr;
+        hwcache->stats.hits++;
+    } else {
+        hwcache->stats.misses++;
+    }
+    pthread_mutex_unlock(&(hwcache->lock));
+    return addr;
+}
+
+/* Admit value read from store */
+void hwcache_put(hwcache_t* hwcache, char* key, int keysize, char* val, int valsize, int addr, long expire) {
+    hwcache_store(hwcache, key, keysize, val, valsize, addr, expire, 1);
+}
+
+/* Replace value of cached key, keys not in cache stay out */
+void hwcache_update(hwcache_t* hwcache, char* key, int keysize, char* val, int valsize, int addr, long expire) {
+    hwcache_store(hwcache, key, keysize, val, valsize, addr, expire, 0);
+}
+
+void hwcache_del(hwcache_t* hwcache, char* key, int keysize) {
+    unsigned long hash = hwcache_hash(key, keysize);
+    pthread_mutex_lock(&(hwcache->lock));
+    hwcentry_t* entry = *hwcache_link(hwcache, hash, key, keysize);
+    if (entry != NULL) {
+        hwcache_drop(hwcache, entry);
+    }
+    pthread_mutex_unlock(&(hwcache->lock));
+}
+
+int hwcache_has(hwcache_t* hwcache, char* key, int keysize) {
+    unsigned long hash = hwcache_hash(key, keysize);
+    pthread_mutex_lock(&(hwcache->lock));
+    int found = *hwcache_link(hwcache, hash, key, keysize) != NULL;
+    pthread_mutex_unlock(&(hwcache->lock));
+    return found;
+}
+
+void hwcache_stats(hwcache_t* hwcache, hwcstats_t* stats) {
+    pthread_mutex_lock(&(hwcache->lock));
+    *stats = hwcache->stats;
+    stats->count = hwcache->count;
+    stats->bytes = hwcache->small.bytes + hwcache->main.bytes;
+    stats->budget = hwcache->budget;
+    pthread_mutex_unlock(&(hwcache->lock));
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#ifndef HWCACHE_H_QWERTY
+#define HWCACHE_H_QWERTY
+
+#include <pthread.h>
+
+/*
+ * Size-aware RAM value cache with S3-FIFO admission: new keys enter
+ * small FIFO queue, keys hit again there or remembered by ghost queue
+ * go to main FIFO queue, main queue gives hit keys another turn.
+ */
+
+#define HWCACHE_SMALL       10      /* percent of budget for small queue */
+#define HWCACHE_MAXFREQ     3
+#define HWCACHE_MAXOBJECT   8       /* objects over budget/8 bypass cache */
+#define HWCACHE_GHOST       4096    /* slots of ghost queue */
+
+#define HWCACHE_SMALLQ      0
+#define HWCACHE_MAINQ       1
+
+typedef struct hwcentry hwcentry_t;
+struct hwcentry {
+    hwcentry_t* hnext;
+    hwcentry_t* qnext;
+    hwcentry_t* qprev;
+    unsigned long hash;
+    long    expire;
+    int     addr;
+    int     keysize;
+    int     valsize;
+    int     freq;
+    int     queue;
+    char    data[];
+};
+
+typedef struct {
+    hwcentry_t* head;
+    hwcentry_t* tail;
+    long    bytes;
+} hwcqueue_t;
+
+typedef struct {
+    long    hits;
+    long    misses;
+    long    admits;
+    long    evicts;
+    long    promotes;
+    long    count;
+    long    bytes;
+    long    budget;
+} hwcstats_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    long    budget;
+    hwcentry_t**    table;
+    int     tablesize;
+    int     count;
+    hwcqueue_t  small;
+    hwcqueue_t  main;
+    unsigned long*  ghost;
+    int     ghostsize;
+    hwcstats_t  stats;
+} hwcache_t;
+
+void hwcache_init(hwcache_t* hwcache, long budget);
+void hwcache_destroy(hwcache_t* hwcache);
+
+int hwcache_get(hwcache_t* hwcache, char* key, int keysize, char** val, int* valsize, long now);
+int hwcache_getbuf(hwcache_t* hwcache, char* key, int keysize, char* buf, int bufsize, int* valsize, long now);
+void hwcache_put(hwcache_t* hwcache, char* key, int keysize, char* val, int valsize, int addr, long expire);
+void hwcache_update(hwcache_t* hwcache, char* key, int keysize, char* val, int valsize, int addr, long expire);
+void hwcache_del(hwcache_t* hwcache, char* key, int keysize);
+int hwcache_has(hwcache_t* hwcache, char* key, int keysize);
+void hwcache_stats(hwcache_t* hwcache, hwcstats_t* stats);
+
+#endif
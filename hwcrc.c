@@ -0,0 +1,93 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define HWCRC_SSE42 1
+#endif
+
+#include <hwcrc.h>
+
+#define HWCRC_POLY  0x82F63B78  /* Castagnoli, reflected */
+
+static unsigned int hwcrc_table[8][256];
+static int hwcrc_sse42 = 0;
+static pthread_once_t hwcrc_once = PTHREAD_ONCE_INIT;
+
+static void hwcrc_setup(void) {
+    for (int i = 0; i < 256; i++) {
+        unsigned int crc = i;
+        for (int j = 0; j < 8; j++) {
+            crc = (crc >> 1) ^ ((crc & 1) != 0 ? HWCRC_POLY : 0);
+        }
+        hwcrc_table[0][i] = crc;
+    }
+    /* Tables for slicing by 8, entry k moves byte k positions further */
+    for (int i = 0; i < 256; i++) {
+        unsigned int crc = hwcrc_table[0][i];
+        for (int k = 1; k < 8; k++) {
+            crc = (crc >> 8) ^ hwcrc_table[0][crc & 0xFF];
+            hwcrc_table[k][i] = crc;
+        }
+    }
+#ifdef HWCRC_SSE42
+    hwcrc_sse42 = __builtin_cpu_supports("sse4.2") != 0;
+#endif
+}
+
+static unsigned int hwcrc_soft(unsigned int crc, unsigned char* data, long size) {
+    while (size >= 8) {
+        unsigned int lo, hi;
+        memcpy(&lo, data, 4);
+        memcpy(&hi, data + 4, 4);
+        lo ^= crc;
+        crc = hwcrc_table[7][lo & 0xFF] ^ hwcrc_table[6][(lo >> 8) & 0xFF]
+            ^ hwcrc_table[5][(lo >> 16) & 0xFF] ^ hwcrc_table[4][lo >> 24]
+            ^ hwcrc_table[3][hi & 0xFF] ^ hwcrc_table[2][(hi >> 8) & 0xFF]
+            ^ hwcrc_table[1][(hi >> 16) & 0xFF] ^ hwcrc_table[0][hi >> 24];
+        data += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        crc = (crc >> 8) ^ hwcrc_table[0][(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef HWCRC_SSE42
+/* Built for SSE4.2 only, called after CPU check */
+__attribute__((target("sse4.2")))
+static unsigned int hwcrc_sse(unsigned int crc, unsigned char* data, long size) {
+    unsigned long crc64 = crc;
+    while (size >= 8) {
+        unsigned long word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        size -= 8;
+    }
+    crc = (unsigned int)crc64;
+    while (size-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+unsigned int hwcrc32c(unsigned int crc, void* data, long size) {
+    pthread_once(&hwcrc_once, hwcrc_setup);
+    crc = ~crc;
+#ifdef HWCRC_SSE42
+    if (hwcrc_sse42) return ~hwcrc_sse(crc, (unsigned char*)data, size);
+#endif
+    return ~hwcrc_soft(crc, (unsigned char*)data, size);
+}
+
+/* Returns 1 if crc32 instruction is used */
+int hwcrc_hardware(void) {
+    pthread_once(&hwcrc_once, hwcrc_setup);
+    return hwcrc_sse42;
+}
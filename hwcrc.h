@@ -0,0 +1,18 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#ifndef HWCRC_H_QWERTY
+#define HWCRC_H_QWERTY
+
+/*
+ * CRC32C (Castagnoli), as in iSCSI and ext4. SSE4.2 crc32 instruction
+ * is used when CPU has it, table otherwise. Result of one call is
+ * passed as crc of next one to checksum data given in pieces, first
+ * call takes 0.
+ */
+
+unsigned int hwcrc32c(unsigned int crc, void* data, long size);
+int hwcrc_hardware(void);
+
+#endif
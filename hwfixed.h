@@ -0,0 +1,188 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#ifndef HWFIXED_H_QWERTY
+#define HWFIXED_H_QWERTY
+
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <hwmemory.h>
+
+/*
+ * Store for fixed-width keys and values, generated for given sizes:
+ *
+ *   HWFIXED_DEFINE(ids, 8, 16)
+ *
+ * defines ids_t with ids_init, ids_open, ids_set, ids_get, ids_del and
+ * ids_destroy. Device holds a hwfixhead_t and an array of slots, a slot
+ * is one state byte, key and value. Keys are placed by hash with linear
+ * probing, so a slot is found without chain walks and deleted slots are
+ * reused by later sets. Slot is read or written in one transfer, get
+ * copies value to caller buffer.
+ */
+
+#define HWFIXED_MAGIC   0x46495844
+
+#define HWSLOT_EMPTY    0
+#define HWSLOT_USED     1
+#define HWSLOT_DELETED  2
+
+typedef struct __attribute__((packed)) {
+    int     magic;
+    int     keysize;
+    int     valsize;
+    int     nslots;
+} hwfixhead_t;
+
+static inline unsigned long hwfixed_hash(const char* key, int keysize) {
+    /* FNV-1a */
+    unsigned long hash = 0xCBF29CE484222325UL;
+    for (int i = 0; i < keysize; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 0x100000001B3UL;
+    }
+    return hash;
+}
+
+#define HWFIXED_DEFINE(name, KEYSIZE, VALSIZE)                                  \
+                                                                                \
+typedef struct __attribute__((packed)) {                                        \
+    unsigned char   state;                                                      \
+    char    key[KEYSIZE];                                                       \
+    char    val[VALSIZE];                                                       \
+} name##_slot_t;                                                                \
+                                                                                \
+typedef struct {                                                                \
+    hwmemory_t*     hwmemory;                                                   \
+    pthread_mutex_t lock;                                                       \
+    int     nslots;                                                             \
+    int     count;                                                              \
+} name##_t;                                                                     \
+                                                                                \
+static inline int name##_slotpos(int slot) {                                    \
+    return (int)sizeof(hwfixhead_t) + slot * (int)sizeof(name##_slot_t);        \
+}                                                                               \
+                                                                                \
+/* Format device, returns number of slots or -1 if device is too small */       \
+static inline int name##_init(name##_t* store, hwmemory_t* hwmemory) {          \
+    int nslots = (hwmemory_size(hwmemory) - (int)sizeof(hwfixhead_t))           \
+                        / (int)sizeof(name##_slot_t);                           \
+    if (nslots < 1) return -1;                                                  \
+    store->hwmemory = hwmemory;                                                 \
+    store->nslots = nslots;                                                     \
+    store->count = 0;                                                           \
+    pthread_mutex_init(&(store->lock), NULL);                                   \
+                                                                                \
+    hwfixhead_t head = { HWFIXED_MAGIC, KEYSIZE, VALSIZE, nslots };             \
+    hwmemory_write(hwmemory, 0, &head, sizeof(head));                           \
+    char zero[4096];                                                            \
+    memset(zero, 0, sizeof(zero));                                              \
+    int pos = sizeof(head);                                                     \
+    int end = name##_slotpos(nslots);                                           \
+    while (pos < end) {                                                         \
+        int size = end - pos < (int)sizeof(zero) ? end - pos : (int)sizeof(zero); \
+        hwmemory_write(hwmemory, pos, zero, size);                              \
+        pos += size;                                                            \
+    }                                                                           \
+    return nslots;                                                              \
+}                                                                               \
+                                                                                \
+/* Attach formatted device, used slots are counted by one pass */               \
+static inline int name##_open(name##_t* store, hwmemory_t* hwmemory) {          \
+    hwfixhead_t head;                                                           \
+    if (hwmemory_read(hwmemory, 0, &head, sizeof(head)) != sizeof(head)         \
+        || head.magic != HWFIXED_MAGIC || head.keysize != KEYSIZE               \
+        || head.valsize != VALSIZE || head.nslots < 1                           \
+        || name##_slotpos(head.nslots) > hwmemory_size(hwmemory)) return -1;    \
+    store->hwmemory = hwmemory;                                                 \
+    store->nslots = head.nslots;                                                \
+    store->count = 0;                                                           \
+    pthread_mutex_init(&(store->lock), NULL);                                   \
+    for (int i = 0; i < store->nslots; i++) {                                   \
+        unsigned char state;                                                    \
+        hwmemory_read(hwmemory, name##_slotpos(i), &state, 1);                  \
+        if (state == HWSLOT_USED) store->count++;                               \
+    }                                                                           \
+    return store->nslots;                                                       \
+}                                                                               \
+                                                                                \
+static inline void name##_destroy(name##_t* store) {                            \
+    pthread_mutex_destroy(&(store->lock));                                      \
+}                                                                               \
+                                                                                \
+/*                                                                              \
+ * Probe from home slot of key. Returns slot holding key or -1, spare           \
+ * gets first reusable slot on the way or -1.                                   \
+ */                                                                             \
+static inline int name##_probe(name##_t* store, const char* key,                \
+                                name##_slot_t* slot, int* spare) {              \
+    int home = (int)(hwfixed_hash(key, KEYSIZE) % store->nslots);               \
+    *spare = -1;                                                                \
+    for (int i = 0; i < store->nslots; i++) {                                   \
+        int curr = (home + i) % store->nslots;                                  \
+        hwmemory_read(store->hwmemory, name##_slotpos(curr), slot,              \
+                                sizeof(name##_slot_t));                         \
+        if (slot->state == HWSLOT_EMPTY) {                                      \
+            if (*spare < 0) *spare = curr;                                      \
+            return -1;                                                          \
+        }                                                                       \
+        if (slot->state == HWSLOT_DELETED) {                                    \
+            if (*spare < 0) *spare = curr;                                      \
+            continue;                                                           \
+        }                                                                       \
+        if (memcmp(slot->key, key, KEYSIZE) == 0) return curr;                  \
+    }                                                                           \
+    return -1;                                                                  \
+}                                                                               \
+                                                                                \
+/* Returns slot number, -1 if every slot is taken */                            \
+static inline int name##_set(name##_t* store, const char* key, const char* val) { \
+    name##_slot_t slot;                                                         \
+    int spare;                                                                  \
+    pthread_mutex_lock(&(store->lock));                                         \
+    int curr = name##_probe(store, key, &slot, &spare);                         \
+    if (curr < 0 && spare >= 0) {                                               \
+        curr = spare;                                                           \
+        store->count++;                                                         \
+    }                                                                           \
+    if (curr >= 0) {                                                            \
+        slot.state = HWSLOT_USED;                                               \
+        memcpy(slot.key, key, KEYSIZE);                                         \
+        memcpy(slot.val, val, VALSIZE);                                         \
+        hwmemory_write(store->hwmemory, name##_slotpos(curr), &slot,            \
+                                sizeof(name##_slot_t));                         \
+    }                                                                           \
+    pthread_mutex_unlock(&(store->lock));                                       \
+    return curr;                                                                \
+}                                                                               \
+                                                                                \
+/* Copies value to val, returns slot number or -1 for miss */                   \
+static inline int name##_get(name##_t* store, const char* key, char* val) {     \
+    name##_slot_t slot;                                                         \
+    int spare;                                                                  \
+    pthread_mutex_lock(&(store->lock));                                         \
+    int curr = name##_probe(store, key, &slot, &spare);                         \
+    pthread_mutex_unlock(&(store->lock));                                       \
+    if (curr >= 0) memcpy(val, slot.val, VALSIZE);                              \
+    return curr;                                                                \
+}                                                                               \
+                                                                                \
+/* Slot is marked deleted, probe chains through it stay intact */               \
+static inline int name##_del(name##_t* store, const char* key) {                \
+    name##_slot_t slot;                                                         \
+    int spare;                                                                  \
+    pthread_mutex_lock(&(store->lock));                                         \
+    int curr = name##_probe(store, key, &slot, &spare);                         \
+    if (curr >= 0) {                                                            \
+        unsigned char state = HWSLOT_DELETED;                                   \
+        hwmemory_write(store->hwmemory, name##_slotpos(curr), &state, 1);       \
+        store->count--;                                                         \
+    }                                                                           \
+    pthread_mutex_unlock(&(store->lock));                                       \
+    return curr;                                                                \
+}
+
+#endif
@@ -0,0 +1,228 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <hwfree.h>
+
+static int hwfree_bucket(int capa);
+static int hwfree_low(int bucket);
+static long hwfree_home(hwfree_t* hwfree, int addr);
+static long hwfree_slot(hwfree_t* hwfree, int addr);
+static void hwfree_rehash(hwfree_t* hwfree, long nslots);
+static void hwfree_bpush(hwfree_t* hwfree, int index);
+static void hwfree_bunlink(hwfree_t* hwfree, int index);
+static void hwfree_unslot(hwfree_t* hwfree, long slot);
+static void hwfree_drop(hwfree_t* hwfree, int index, hwfentry_t* dropped);
+
+/* Address 0 is store header, no cell, so it ends free chain */
+
+static int hwfree_bucket(int capa) {
+    if (capa < (2 << HWFREE_SUBBITS)) return capa < 0 ? 0 : capa;
+    int top = 31 - __builtin_clz((unsigned int)capa);
+    int sub = (capa >> (top - HWFREE_SUBBITS)) - (1 << HWFREE_SUBBITS);
+    return ((top - HWFREE_SUBBITS + 1) << HWFREE_SUBBITS) + sub;
+}
+
+/* Smallest capacity of bucket */
+static int hwfree_low(int bucket) {
+    if (bucket < (2 << HWFREE_SUBBITS)) return bucket;
+    int top = (bucket >> HWFREE_SUBBITS) + HWFREE_SUBBITS - 1;
+    int sub = bucket & ((1 << HWFREE_SUBBITS) - 1);
+    return ((1 << HWFREE_SUBBITS) + sub) << (top - HWFREE_SUBBITS);
+}
+
+static long hwfree_home(hwfree_t* hwfree, int addr) {
+    unsigned int hash = (unsigned int)addr;
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6BU;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35U;
+    hash ^= hash >> 16;
+    return hash & (hwfree->nslots - 1);
+}
+
+/* Slot of address or empty slot where it would go */
+static long hwfree_slot(hwfree_t* hwfree, int addr) {
+    long slot = hwfree_home(hwfree, addr);
+    while (hwfree->slots[slot] >= 0 && hwfree->entries[hwfree->slots[slot]].addr != addr) {
+        slot = (slot + 1) & (hwfree->nslots - 1);
+    }
+    return slot;
+}
+
+static void hwfree_rehash(hwfree_t* hwfree, long nslots) {
+    free(hwfree->slots);
+    hwfree->nslots = nslots;
+    hwfree->slots = malloc(nslots * sizeof(int));
+    memset(hwfree->slots, 0xFF, nslots * sizeof(int));
+    for (int i = 0; i < hwfree->count; i++) {
+        hwfree->slots[hwfree_slot(hwfree, hwfree->entries[i].addr)] = i;
+    }
+}
+
+void hwfree_init(hwfree_t* hwfree) {
+    memset(hwfree, 0, sizeof(hwfree_t));
+    memset(hwfree->heads, 0xFF, sizeof(hwfree->heads));
+    hwfree_rehash(hwfree, 64);
+}
+
+void hwfree_destroy(hwfree_t* hwfree) {
+    free(hwfree->entries);
+    free(hwfree->slots);
+    memset(hwfree, 0, sizeof(hwfree_t));
+}
+
+static void hwfree_bpush(hwfree_t* hwfree, int index) {
+    hwfentry_t* entry = &(hwfree->entries[index]);
+    int bucket = hwfree_bucket(entry->capa);
+    entry->bprev = -1;
+    entry->bnext = hwfree->heads[bucket];
+    if (entry->bnext >= 0) hwfree->entries[entry->bnext].bprev = index;
+    hwfree->heads[bucket] = index;
+    hwfree->mask[bucket / 64] |= 1UL << (bucket % 64);
+}
+
+static void hwfree_bunlink(hwfree_t* hwfree, int index) {
+    hwfentry_t* entry = &(hwfree->entries[index]);
+    int bucket = hwfree_bucket(entry->capa);
+    if (entry->bprev >= 0) {
+        hwfree->entries[entry->bprev].bnext = entry->bnext;
+    } else {
+        hwfree->heads[bucket] = entry->bnext;
+    }
+    if (entry->bnext >= 0) hwfree->entries[entry->bnext].bprev = entry->bprev;
+    if (hwfree->heads[bucket] < 0) hwfree->mask[bucket / 64] &= ~(1UL << (bucket % 64));
+}
+
+/* Linear probing delete, later entries of the run shift back */
+static void hwfree_unslot(hwfree_t* hwfree, long slot) {
+    long mask = hwfree->nslots - 1;
+    long next = slot;
+    for (;;) {
+        next = (next + 1) & mask;
+        if (hwfree->slots[next] < 0) break;
+        long home = hwfree_home(hwfree, hwfree->entries[hwfree->slots[next]].addr);
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            hwfree->slots[slot] = hwfree->slots[next];
+            slot = next;
+        }
+    }
+    hwfree->slots[slot] = -1;
+}
+
+/*
+ * Add cell which links to next on device. Cells are pushed to chain
+ * head, so next gets it as previous. Map built in other order is set
+ * right by hwfree_link.
+ */
+void hwfree_put(hwfree_t* hwfree, int addr, int capa, int next) {
+    if ((hwfree->count + 1) * 2 > hwfree->nslots) hwfree_rehash(hwfree, hwfree->nslots * 2);
+    if (hwfree->count == hwfree->capa) {
+        hwfree->capa = hwfree->capa == 0 ? 64 : hwfree->capa * 2;
+        hwfree->entries = realloc(hwfree->entries, hwfree->capa * sizeof(hwfentry_t));
+    }
+    int index = hwfree->count++;
+    hwfentry_t* entry = &(hwfree->entries[index]);
+    entry->addr = addr;
+    entry->capa = capa;
+    entry->next = next;
+    entry->prev = 0;
+    hwfree->slots[hwfree_slot(hwfree, addr)] = index;
+    hwfree_bpush(hwfree, index);
+
+    hwfentry_t* nextentry = next != 0 ? hwfree_get(hwfree, next) : NULL;
+    if (nextentry != NULL) nextentry->prev = addr;
+}
+
+/* Set previous cell of every entry from next links */
+void hwfree_link(hwfree_t* hwfree) {
+    for (int i = 0; i < hwfree->count; i++) {
+        hwfree->entries[i].prev = 0;
+    }
+    for (int i = 0; i < hwfree->count; i++) {
+        hwfentry_t* nextentry = hwfree->entries[i].next != 0 ? hwfree_get(hwfree, hwfree->entries[i].next) : NULL;
+        if (nextentry != NULL) nextentry->prev = hwfree->entries[i].addr;
+    }
+}
+
+hwfentry_t* hwfree_get(hwfree_t* hwfree, int addr) {
+    int index = hwfree->slots[hwfree_slot(hwfree, addr)];
+    return index < 0 ? NULL : &(hwfree->entries[index]);
+}
+
+/*
+ * Unlink entry from its bucket, chain neighbours and address table,
+ * last entry takes its place in array.
+ */
+static void hwfree_drop(hwfree_t* hwfree, int index, hwfentry_t* dropped) {
+    hwfentry_t entry = hwfree->entries[index];
+    if (dropped != NULL) *dropped = entry;
+
+    hwfentry_t* preventry = entry.prev != 0 ? hwfree_get(hwfree, entry.prev) : NULL;
+    if (preventry != NULL) preventry->next = entry.next;
+    hwfentry_t* nextentry = entry.next != 0 ? hwfree_get(hwfree, entry.next) : NULL;
+    if (nextentry != NULL) nextentry->prev = entry.prev;
+
+    hwfree_bunlink(hwfree, index);
+    hwfree_unslot(hwfree, hwfree_slot(hwfree, entry.addr));
+
+    int last = --hwfree->count;
+    if (index == last) return;
+    hwfentry_t* moved = &(hwfree->entries[index]);
+    *moved = hwfree->entries[last];
+    if (moved->bprev >= 0) {
+        hwfree->entries[moved->bprev].bnext = index;
+    } else {
+        hwfree->heads[hwfree_bucket(moved->capa)] = index;
+    }
+    if (moved->bnext >= 0) hwfree->entries[moved->bnext].bprev = index;
+    hwfree->slots[hwfree_slot(hwfree, moved->addr)] = index;
+}
+
+/*
+ * Take cell of at least size bytes from first nonempty bucket whose
+ * cells all fit. Only when there is none, bucket of size itself is
+ * searched for a cell which fits. Returns address and copy of its
+ * entry, -1 if no cell fits.
+ */
+int hwfree_take(hwfree_t* hwfree, int size, hwfentry_t* taken) {
+    int own = hwfree_bucket(size);
+    int bucket = hwfree_low(own) < size ? own + 1 : own;
+    for (int word = bucket / 64; word < HWFREE_WORDS; word++) {
+        unsigned long bits = hwfree->mask[word];
+        if (word == bucket / 64) bits &= ~0UL << (bucket % 64);
+        if (bits == 0) continue;
+        int index = hwfree->heads[word * 64 + __builtin_ctzl(bits)];
+        int addr = hwfree->entries[index].addr;
+        hwfree_drop(hwfree, index, taken);
+        return addr;
+    }
+    for (int index = hwfree->heads[own]; index >= 0; index = hwfree->entries[index].bnext) {
+        if (hwfree->entries[index].capa >= size) {
+            int addr = hwfree->entries[index].addr;
+            hwfree_drop(hwfree, index, taken);
+            return addr;
+        }
+    }
+    return -1;
+}
+
+/* Returns 0 or -1 if addr is not in map */
+int hwfree_remove(hwfree_t* hwfree, int addr, hwfentry_t* removed) {
+    int index = hwfree->slots[hwfree_slot(hwfree, addr)];
+    if (index < 0) return -1;
+    hwfree_drop(hwfree, index, removed);
+    return 0;
+}
+
+/* Capacity of cell changed by merge, move it to its new bucket */
+void hwfree_resize(hwfree_t* hwfree, int addr, int capa) {
+    int index = hwfree->slots[hwfree_slot(hwfree, addr)];
+    if (index < 0) return;
+    hwfree_bunlink(hwfree, index);
+    hwfree->entries[index].capa = capa;
+    hwfree_bpush(hwfree, index);
+}
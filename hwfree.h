@@ -0,0 +1,53 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#ifndef HWFREE_H_QWERTY
+#define HWFREE_H_QWERTY
+
+/*
+ * Map of free cells, kept in RAM only, so allocation needs no walk of
+ * free chain on device. Free chain stays on device and the map mirrors
+ * its links, so a taken cell is unlinked without reading neighbours.
+ *
+ * Cells are kept in buckets by capacity: capacity below 16 has a bucket
+ * of its own, above that each power of two is split in 8 buckets. Bit
+ * of mask is set while its bucket has cells. Any cell of a bucket above
+ * the one of size fits, so allocation is a bit scan of a few words.
+ * Address table finds entry of a cell for removal and link updates.
+ */
+
+#define HWFREE_SUBBITS  3
+#define HWFREE_BUCKETS  232     /* capacity up to 2^31 - 1 */
+#define HWFREE_WORDS    ((HWFREE_BUCKETS + 63) / 64)
+
+/* Free cell, bucket list and free chain neighbours */
+typedef struct {
+    int     addr;
+    int     capa;
+    int     next;       /* next cell of free chain on device */
+    int     prev;       /* previous cell of free chain */
+    int     bnext;      /* entry indexes in bucket list, -1 ends it */
+    int     bprev;
+} hwfentry_t;
+
+typedef struct {
+    unsigned long   mask[HWFREE_WORDS];
+    int     heads[HWFREE_BUCKETS];
+    hwfentry_t* entries;
+    long    count;
+    long    capa;
+    int*    slots;      /* open addressing from address to entry index */
+    long    nslots;
+} hwfree_t;
+
+void hwfree_init(hwfree_t* hwfree);
+void hwfree_destroy(hwfree_t* hwfree);
+void hwfree_put(hwfree_t* hwfree, int addr, int capa, int next);
+void hwfree_link(hwfree_t* hwfree);
+int hwfree_take(hwfree_t* hwfree, int size, hwfentry_t* taken);
+int hwfree_remove(hwfree_t* hwfree, int addr, hwfentry_t* removed);
+hwfentry_t* hwfree_get(hwfree_t* hwfree, int addr);
+void hwfree_resize(hwfree_t* hwfree, int addr, int capa);
+
+#endif
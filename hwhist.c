@@ -0,0 +1,96 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <hwhist.h>
+
+static int hwhist_index(long value);
+static long hwhist_lower(int index);
+
+static int hwhist_index(long value) {
+    if (value < 0) value = 0;
+    if (value < HWHIST_SUBCOUNT) return (int)value;
+
+    int msb = 63 - __builtin_clzl((unsigned long)value);
+    int range = msb - HWHIST_SUBBITS + 1;
+    long sub = value >> (range - 1);
+    return range * HWHIST_SUBCOUNT + (int)(sub - HWHIST_SUBCOUNT);
+}
+
+static long hwhist_lower(int index) {
+    int range = index / HWHIST_SUBCOUNT;
+    if (range == 0) return index;
+
+    long sub = (index % HWHIST_SUBCOUNT) + HWHIST_SUBCOUNT;
+    return sub << (range - 1);
+}
+
+void hwhist_init(hwhist_t* hwhist) {
+    memset(hwhist, 0, sizeof(hwhist_t));
+}
+
+void hwhist_add(hwhist_t* hwhist, long value) {
+    hwhist->count[hwhist_index(value)]++;
+    if (hwhist->total == 0 || value < hwhist->min) hwhist->min = value;
+    if (value > hwhist->max) hwhist->max = value;
+    hwhist->total++;
+    hwhist->sum += value;
+}
+
+void hwhist_merge(hwhist_t* hwhist, hwhist_t* other) {
+    if (other->total == 0) return;
+    for (int i = 0; i < HWHIST_BUCKETS; i++) {
+        hwhist->count[i] += other->count[i];
+    }
+    if (hwhist->total == 0 || other->min < hwhist->min) hwhist->min = other->min;
+    if (other->max > hwhist->max) hwhist->max = other->max;
+    hwhist->total += other->total;
+    hwhist->sum += other->sum;
+}
+
+long hwhist_quantile(hwhist_t* hwhist, double quantile) {
+    if (hwhist->total == 0) return 0;
+
+    long rank = (long)(quantile * hwhist->total + 0.5);
+    if (rank < 1) rank = 1;
+
+    long seen = 0;
+    for (int i = 0; i < HWHIST_BUCKETS; i++) {
+        seen += hwhist->count[i];
+        if (seen >= rank) {
+            /* Report upper bound of bucket, but never above real maximum */
+            if (i + 1 == HWHIST_BUCKETS) return hwhist->max;
+            long upper = hwhist_lower(i + 1) - 1;
+            return upper < hwhist->max ? upper : hwhist->max;
+        }
+    }
+    return hwhist->max;
+}
+
+long hwhist_mean(hwhist_t* hwhist) {
+    if (hwhist->total == 0) return 0;
+    return hwhist->sum / hwhist->total;
+}
+
+void hwhist_json(hwhist_t* hwhist, FILE* out, int buckets) {
+    fprintf(out, "{\"count\":%ld,\"min\":%ld,\"mean\":%ld,\"p50\":%ld,\"p99\":%ld,\"p999\":%ld,\"max\":%ld",
+                hwhist->total, hwhist->min, hwhist_mean(hwhist),
+                hwhist_quantile(hwhist, 0.50), hwhist_quantile(hwhist, 0.99),
+                hwhist_quantile(hwhist, 0.999), hwhist->max);
+    if (buckets) {
+        /* Non-empty buckets as [lower bound, count] pairs */
+        fprintf(out, ",\"buckets\":[");
+        int first = 1;
+        for (int i = 0; i < HWHIST_BUCKETS; i++) {
+            if (hwhist->count[i] == 0) continue;
+            fprintf(out, "%s[%ld,%ld]", first ? "" : ",", hwhist_lower(i), hwhist->count[i]);
+            first = 0;
+        }
+        fprintf(out, "]");
+    }
+    fprintf(out, "}");
+}
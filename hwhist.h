@@ -0,0 +1,34 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#ifndef HWHIST_H_QWERTY
+#define HWHIST_H_QWERTY
+
+#include <stdio.h>
+
+/*
+ * Log-linear latency histogram: every power of two range is split
+ * into HWHIST_SUBCOUNT equal buckets, relative error is ~3%.
+ */
+#define HWHIST_SUBBITS      5
+#define HWHIST_SUBCOUNT     (1 << HWHIST_SUBBITS)
+#define HWHIST_BUCKETS      ((64 - HWHIST_SUBBITS) * HWHIST_SUBCOUNT)
+
+typedef struct {
+    long    count[HWHIST_BUCKETS];
+    long    total;
+    long    sum;
+    long    min;
+    long    max;
+} hwhist_t;
+
+void hwhist_init(hwhist_t* hwhist);
+void hwhist_add(hwhist_t* hwhist, long value);
+void hwhist_merge(hwhist_t* hwhist, hwhist_t* other);
+long hwhist_quantile(hwhist_t* hwhist, double quantile);
+long hwhist_mean(hwhist_t* hwhist);
+
+void hwhist_json(hwhist_t* hwhist, FILE* out, int buckets);
+
+#endif
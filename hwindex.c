@@ -0,0 +1,215 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <hwindex.h>
+
+static hwitable_t* hwindex_table(long ngroups);
+static unsigned int hwindex_match(unsigned char* ctrl, unsigned char byte);
+static void hwindex_place(hwitable_t* table, unsigned long hash, int addr);
+static inline long hwindex_group(hwitable_t* table, unsigned long hash);
+static void hwindex_rehash(hwindex_t* hwindex, long ngroups);
+
+static hwitable_t* hwindex_table(long ngroups) {
+    long capacity = ngroups * HWINDEX_GROUP;
+    hwitable_t* table = malloc(sizeof(hwitable_t) + capacity + capacity * sizeof(hwientry_t));
+    table->ngroups = ngroups;
+    table->capacity = capacity;
+    table->entries = (hwientry_t*)(table + 1);
+    table->ctrl = (unsigned char*)(table->entries + capacity);
+    memset(table->ctrl, HWINDEX_EMPTY, capacity);
+    memset(table->entries, 0, capacity * sizeof(hwientry_t));
+    return table;
+}
+
+void hwindex_init(hwindex_t* hwindex, long capacity) {
+    long ngroups = 1;
+    while (ngroups * HWINDEX_GROUP * 7 / 8 < capacity) ngroups *= 2;
+    hwindex->table = hwindex_table(ngroups);
+    hwindex->count = 0;
+    hwindex->deleted = 0;
+    hwindex->old = NULL;
+    hwindex->nold = 0;
+    hwindex->oldcapa = 0;
+}
+
+void hwindex_destroy(hwindex_t* hwindex) {
+    hwindex_reclaim(hwindex);
+    free(hwindex->old);
+    free(hwindex->table);
+    hwindex->old = NULL;
+    hwindex->table = NULL;
+}
+
+unsigned long hwindex_hash(char* key, int keysize) {
+    /* FNV-1a, then finalizer of MurmurHash3 to spread low bits */
+    unsigned long hash = 0xCBF29CE484222325UL;
+    for (int i = 0; i < keysize; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 0x100000001B3UL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDUL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53UL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/* Bit mask of group slots whose control byte equals byte */
+static unsigned int hwindex_match(unsigned char* ctrl, unsigned char byte) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((__m128i*)ctrl);
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < HWINDEX_GROUP; i++) {
+        if (ctrl[i] == byte) mask |= 1U << i;
+    }
+    return mask;
+#endif
+}
+
+/* Group is taken from tag bits, so rehash needs only what entries keep */
+static inline long hwindex_group(hwitable_t* table, unsigned long hash) {
+    return (long)(hash >> 32) & (table->ngroups - 1);
+}
+
+/* Entry is written before control byte, so a reader sees it complete */
+static void hwindex_place(hwitable_t* table, unsigned long hash, int addr) {
+    long group = hwindex_group(table, hash);
+    for (long step = 1; ; step++) {
+        unsigned char* ctrl = table->ctrl + group * HWINDEX_GROUP;
+        unsigned int mask = hwindex_match(ctrl, HWINDEX_EMPTY) | hwindex_match(ctrl, HWINDEX_DELETED);
+        if (mask != 0) {
+            long slot = group * HWINDEX_GROUP + __builtin_ctz(mask);
+            table->entries[slot].tag = (unsigned int)(hash >> 32);
+            table->entries[slot].addr = addr;
+            __atomic_store_n(&(table->ctrl[slot]), (unsigned char)(hash & 0x7F), __ATOMIC_RELEASE);
+            return;
+        }
+        group = (group + step) & (table->ngroups - 1);
+    }
+}
+
+/*
+ * Move entries to new table of ngroups. Old table is kept until
+ * hwindex_reclaim, as lock-free readers may still probe it.
+ */
+static void hwindex_rehash(hwindex_t* hwindex, long ngroups) {
+    hwitable_t* old = hwindex->table;
+    hwitable_t* table = hwindex_table(ngroups);
+    for (long i = 0; i < old->capacity; i++) {
+        if ((old->ctrl[i] & HWINDEX_EMPTY) != 0) continue;
+        unsigned long hash = ((unsigned long)old->entries[i].tag << 32) | old->ctrl[i];
+        hwindex_place(table, hash, old->entries[i].addr);
+    }
+    if (hwindex->nold == hwindex->oldcapa) {
+        hwindex->oldcapa = hwindex->oldcapa > 0 ? hwindex->oldcapa * 2 : 4;
+        hwindex->old = realloc(hwindex->old, hwindex->oldcapa * sizeof(hwitable_t*));
+    }
+    hwindex->old[hwindex->nold++] = old;
+    hwindex->deleted = 0;
+    __atomic_store_n(&(hwindex->table), table, __ATOMIC_RELEASE);
+}
+
+/* Returns 1 if table was replaced, 0 otherwise */
+int hwindex_insert(hwindex_t* hwindex, unsigned long hash, int addr) {
+    hwitable_t* table = hwindex->table;
+    int grown = 0;
+    if ((hwindex->count + hwindex->deleted + 1) * 8 > table->capacity * 7) {
+        /* Mostly deleted slots are cleaned at same size */
+        long ngroups = table->ngroups;
+        if ((hwindex->count + 1) * 16 > table->capacity * 7) ngroups *= 2;
+        hwindex_rehash(hwindex, ngroups);
+        table = hwindex->table;
+        grown = 1;
+    }
+    long group = hwindex_group(table, hash);
+    for (long step = 1; ; step++) {
+        unsigned char* ctrl = table->ctrl + group * HWINDEX_GROUP;
+        unsigned int mask = hwindex_match(ctrl, HWINDEX_EMPTY) | hwindex_match(ctrl, HWINDEX_DELETED);
+        if (mask != 0) {
+            if (ctrl[__builtin_ctz(mask)] == HWINDEX_DELETED) hwindex->deleted--;
+            break;
+        }
+        group = (group + step) & (table->ngroups - 1);
+    }
+    hwindex_place(table, hash, addr);
+    hwindex->count++;
+    return grown;
+}
+
+/* Returns 0 if entry was removed, -1 if not found */
+int hwindex_remove(hwindex_t* hwindex, unsigned long hash, int addr) {
+    hwiprobe_t probe;
+    hwindex_probe(hwindex, hash, &probe);
+    for (;;) {
+        while (probe.match != 0) {
+            long slot = probe.group * HWINDEX_GROUP + __builtin_ctz(probe.match);
+            probe.match &= probe.match - 1;
+            hwitable_t* table = probe.table;
+            if (table->entries[slot].tag != (unsigned int)(hash >> 32) || table->entries[slot].addr != addr) continue;
+            /* Group with empty slot never continued a probe, slot may be empty too */
+            unsigned char mark = HWINDEX_DELETED;
+            if (probe.last) {
+                mark = HWINDEX_EMPTY;
+            } else {
+                hwindex->deleted++;
+            }
+            __atomic_store_n(&(table->ctrl[slot]), mark, __ATOMIC_RELEASE);
+            table->entries[slot].addr = 0;
+            hwindex->count--;
+            return 0;
+        }
+        if (probe.last || ++probe.step >= probe.table->ngroups) return -1;
+        probe.group = (probe.group + probe.step) & (probe.table->ngroups - 1);
+        unsigned char* ctrl = probe.table->ctrl + probe.group * HWINDEX_GROUP;
+        probe.match = hwindex_match(ctrl, (unsigned char)(hash & 0x7F));
+        probe.last = hwindex_match(ctrl, HWINDEX_EMPTY) != 0;
+    }
+}
+
+/* May run without writer lock, table stays valid until reclaim */
+void hwindex_probe(hwindex_t* hwindex, unsigned long hash, hwiprobe_t* probe) {
+    probe->table = __atomic_load_n(&(hwindex->table), __ATOMIC_ACQUIRE);
+    probe->hash = hash;
+    probe->group = hwindex_group(probe->table, hash);
+    probe->step = 0;
+    unsigned char* ctrl = probe->table->ctrl + probe->group * HWINDEX_GROUP;
+    probe->match = hwindex_match(ctrl, (unsigned char)(hash & 0x7F));
+    probe->last = hwindex_match(ctrl, HWINDEX_EMPTY) != 0;
+}
+
+/* Returns next candidate address or -1 when probe ends */
+int hwindex_next(hwiprobe_t* probe) {
+    hwitable_t* table = probe->table;
+    for (;;) {
+        while (probe->match != 0) {
+            long slot = probe->group * HWINDEX_GROUP + __builtin_ctz(probe->match);
+            probe->match &= probe->match - 1;
+            hwientry_t entry = table->entries[slot];
+            if (entry.tag == (unsigned int)(probe->hash >> 32) && entry.addr > 0) return entry.addr;
+        }
+        if (probe->last || ++probe->step >= table->ngroups) return -1;
+        probe->group = (probe->group + probe->step) & (table->ngroups - 1);
+        unsigned char* ctrl = table->ctrl + probe->group * HWINDEX_GROUP;
+        probe->match = hwindex_match(ctrl, (unsigned char)(probe->hash & 0x7F));
+        probe->last = hwindex_match(ctrl, HWINDEX_EMPTY) != 0;
+    }
+}
+
+/* Frees replaced tables, caller makes sure no reader probes them */
+void hwindex_reclaim(hwindex_t* hwindex) {
+    for (int i = 0; i < hwindex->nold; i++) {
+        free(hwindex->old[i]);
+    }
+    hwindex->nold = 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#ifndef HWINDEX_H_QWERTY
+#define HWINDEX_H_QWERTY
+
+/*
+ * RAM hash index from key to cell address, open addressing in the style
+ * of Swiss tables. Slots are split into groups of HWINDEX_GROUP, each
+ * slot has a control byte holding 7 bits of key hash or empty/deleted
+ * mark. A probe compares a whole group of control bytes at once (SSE2,
+ * scalar fallback) and reads entries of matching slots only. Entry
+ * keeps 32 more hash bits and the address, key itself stays on device.
+ * Several entries may match a key, caller checks them on device.
+ */
+
+#define HWINDEX_GROUP   16
+#define HWINDEX_EMPTY   0x80
+#define HWINDEX_DELETED 0xFE
+
+typedef struct {
+    unsigned int    tag;
+    int     addr;
+} hwientry_t;
+
+/* Table is one allocation, so a reader sees consistent size and arrays */
+typedef struct {
+    long    ngroups;
+    long    capacity;
+    unsigned char*  ctrl;
+    hwientry_t*     entries;
+} hwitable_t;
+
+typedef struct {
+    hwitable_t* table;
+    long    count;
+    long    deleted;
+    hwitable_t**    old;    /* replaced tables, freed by hwindex_reclaim */
+    int     nold;
+    int     oldcapa;
+} hwindex_t;
+
+typedef struct {
+    hwitable_t* table;
+    unsigned long   hash;
+    long    group;
+    long    step;
+    unsigned int    match;
+    int     last;
+} hwiprobe_t;
+
+void hwindex_init(hwindex_t* hwindex, long capacity);
+void hwindex_destroy(hwindex_t* hwindex);
+unsigned long hwindex_hash(char* key, int keysize);
+int hwindex_insert(hwindex_t* hwindex, unsigned long hash, int addr);
+int hwindex_remove(hwindex_t* hwindex, unsigned long hash, int addr);
+void hwindex_probe(hwindex_t* hwindex, unsigned long hash, hwiprobe_t* probe);
+int hwindex_next(hwiprobe_t* probe);
+void hwindex_reclaim(hwindex_t* hwindex);
+
+#endif
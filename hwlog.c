@@ -0,0 +1,218 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <hwlog.h>
+
+static int hwlog_recsize(hwlogrec_t* rec);
+static int hwlog_recover(hwlog_t* hwlog);
+static void hwfollow_reserve(hwfollow_t* hwfollow, int size);
+
+static int hwlog_recsize(hwlogrec_t* rec) {
+    return (int)sizeof(hwlogrec_t) + rec->keysize + rec->valsize;
+}
+
+/* Find last complete record, drop torn tail of interrupted write */
+static int hwlog_recover(hwlog_t* hwlog) {
+    hwfollow_t hwfollow;
+    hwfollow_attach(&hwfollow, hwlog->fd, 0);
+
+    long size = 0;
+    long seq = 0;
+    hwlogrec_t rec;
+    char *key, *val;
+    int res;
+    for (;;) {
+        while ((res = hwfollow_next(&hwfollow, &rec, &key, &val)) > 0) {
+            size += hwlog_recsize(&rec);
+            seq = rec.seq;
+        }
+        if (res < 0 || hwfollow_fill(&hwfollow) <= 0) break;
+    }
+    hwfollow_close(&hwfollow);
+
+    if (ftruncate(hwlog->fd, size) < 0) return -1;
+    if (lseek(hwlog->fd, size, SEEK_SET) < 0) return -1;
+    hwlog->size = size;
+    hwlog->seq = seq;
+    return 0;
+}
+
+int hwlog_open(hwlog_t* hwlog, char* path) {
+    memset(hwlog, 0, sizeof(hwlog_t));
+    hwlog->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (hwlog->fd < 0) return -1;
+    if (hwlog_recover(hwlog) < 0) {
+        close(hwlog->fd);
+        hwlog->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void hwlog_close(hwlog_t* hwlog) {
+    if (hwlog->fd < 0) return;
+    hwlog_flush(hwlog);
+    close(hwlog->fd);
+    free(hwlog->buf);
+    hwlog->fd = -1;
+    hwlog->buf = NULL;
+}
+
+/* Buffer record, it is numbered now and written by hwlog_flush */
+void hwlog_add(hwlog_t* hwlog, int op, char* key, int keysize, char* val, int valsize, long expire) {
+    hwlogrec_t rec;
+    rec.magic = HWLOG_MAGIC;
+    rec.op = op;
+    rec.seq = ++(hwlog->seq);
+    rec.expire = expire;
+    rec.keysize = keysize;
+    rec.valsize = valsize;
+
+    int size = hwlog_recsize(&rec);
+    if (hwlog->buflen + size > hwlog->bufcapa) {
+        hwlog->bufcapa = hwlog->bufcapa == 0 ? 4096 : hwlog->bufcapa;
+        while (hwlog->buflen + size > hwlog->bufcapa) hwlog->bufcapa *= 2;
+        hwlog->buf = realloc(hwlog->buf, hwlog->bufcapa);
+    }
+    /* Previous buffered record is part of this batch */
+    if (hwlog->pending > 0) {
+        hwlogrec_t* prev = (hwlogrec_t*)(hwlog->buf + hwlog->pending - 1);
+        prev->op |= HWLOG_MORE;
+    }
+    char* dst = hwlog->buf + hwlog->buflen;
+    memcpy(dst, &rec, sizeof(hwlogrec_t));
+    memcpy(dst + sizeof(hwlogrec_t), key, keysize);
+    if (valsize > 0) {
+        memcpy(dst + sizeof(hwlogrec_t) + keysize, val, valsize);
+    }
+    hwlog->pending = hwlog->buflen + 1;
+    hwlog->buflen += size;
+    hwlog->records++;
+}
+
+/* Write buffered batch in one call, returns last written sequence or -1 */
+long hwlog_flush(hwlog_t* hwlog) {
+    int pos = 0;
+    while (pos < hwlog->buflen) {
+        ssize_t n = write(hwlog->fd, hwlog->buf + pos, hwlog->buflen - pos);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            /* Cut partial batch so followers never see it */
+            if (ftruncate(hwlog->fd, hwlog->size) == 0) {
+                lseek(hwlog->fd, hwlog->size, SEEK_SET);
+            }
+            hwlog->buflen = 0;
+            hwlog->pending = 0;
+            return -1;
+        }
+        pos += n;
+    }
+    hwlog->size += hwlog->buflen;
+    hwlog->bytes += hwlog->buflen;
+    hwlog->buflen = 0;
+    hwlog->pending = 0;
+    return hwlog->seq;
+}
+
+long hwlog_seq(hwlog_t* hwlog) {
+    return hwlog->seq;
+}
+
+/* Follow log file from start, records up to seq are skipped */
+int hwfollow_open(hwfollow_t* hwfollow, char* path, long seq) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    hwfollow_attach(hwfollow, fd, seq);
+    hwfollow->owned = 1;
+    return 0;
+}
+
+/* Follow already open file, pipe or socket, it is not closed by follower */
+void hwfollow_attach(hwfollow_t* hwfollow, int fd, long seq) {
+    memset(hwfollow, 0, sizeof(hwfollow_t));
+    hwfollow->fd = fd;
+    hwfollow->seq = seq;
+}
+
+void hwfollow_close(hwfollow_t* hwfollow) {
+    if (hwfollow->owned) {
+        close(hwfollow->fd);
+    }
+    free(hwfollow->buf);
+    hwfollow->buf = NULL;
+    hwfollow->fd = -1;
+}
+
+static void hwfollow_reserve(hwfollow_t* hwfollow, int size) {
+    if (hwfollow->bufpos > 0) {
+        memmove(hwfollow->buf, hwfollow->buf + hwfollow->bufpos, hwfollow->buflen - hwfollow->bufpos);
+        hwfollow->buflen -= hwfollow->bufpos;
+        hwfollow->bufpos = 0;
+    }
+    if (hwfollow->buflen + size > hwfollow->bufcapa) {
+        hwfollow->bufcapa = hwfollow->bufcapa == 0 ? HWLOG_READSIZE : hwfollow->bufcapa;
+        while (hwfollow->buflen + size > hwfollow->bufcapa) hwfollow->bufcapa *= 2;
+        hwfollow->buf = realloc(hwfollow->buf, hwfollow->bufcapa);
+    }
+}
+
+/*
+ * Read what stream has now after unread buffer tail. Returns bytes
+ * read, 0 if nothing is there yet, -1 on error.
+ */
+int hwfollow_fill(hwfollow_t* hwfollow) {
+    int want = HWLOG_READSIZE;
+    /* Record larger than read size needs whole of it in buffer */
+    int unread = hwfollow->buflen - hwfollow->bufpos;
+    if (unread >= (int)sizeof(hwlogrec_t)) {
+        hwlogrec_t* rec = (hwlogrec_t*)(hwfollow->buf + hwfollow->bufpos);
+        if (rec->magic == HWLOG_MAGIC && rec->keysize <= HWLOG_MAXDATA && rec->valsize <= HWLOG_MAXDATA
+            && hwlog_recsize(rec) - unread > want) {
+            want = hwlog_recsize(rec) - unread;
+        }
+    }
+    hwfollow_reserve(hwfollow, want);
+
+    int total = 0;
+    while (total < want) {
+        ssize_t n = read(hwfollow->fd, hwfollow->buf + hwfollow->buflen, want - total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        hwfollow->buflen += n;
+        total += n;
+    }
+    return total;
+}
+
+/*
+ * Take next buffered record, records up to follower sequence are
+ * skipped. Key and value point into buffer until next fill. Returns 1,
+ * 0 if record is not complete yet, -1 for broken log.
+ */
+int hwfollow_next(hwfollow_t* hwfollow, hwlogrec_t* rec, char** key, char** val) {
+    for (;;) {
+        int unread = hwfollow->buflen - hwfollow->bufpos;
+        if (unread < (int)sizeof(hwlogrec_t)) return 0;
+        char* src = hwfollow->buf + hwfollow->bufpos;
+        memcpy(rec, src, sizeof(hwlogrec_t));
+        if (rec->magic != HWLOG_MAGIC || rec->keysize < 0 || rec->valsize < 0
+            || rec->keysize > HWLOG_MAXDATA || rec->valsize > HWLOG_MAXDATA) return -1;
+        if (hwlog_recsize(rec) > unread) return 0;
+
+        hwfollow->bufpos += hwlog_recsize(rec);
+        if (rec->seq <= hwfollow->seq) continue;
+        *key = src + sizeof(hwlogrec_t);
+        *val = *key + rec->keysize;
+        return 1;
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#ifndef HWLOG_H_QWERTY
+#define HWLOG_H_QWERTY
+
+/*
+ * Change log is an append-only file of hwlogrec_t records, each followed
+ * by key and value. Records are numbered by sequence from 1. Records of
+ * one transaction are written at once, all but the last carry
+ * HWLOG_MORE. Followers read the log from a file or any stream.
+ */
+
+#define HWLOG_MAGIC     0x484C4F47
+#define HWLOG_SET       1
+#define HWLOG_DEL       2
+#define HWLOG_EXPIRE    3       /* expire is unix time, 0 removes expiry */
+#define HWLOG_APPEND    4
+#define HWLOG_INCR      5       /* value is 64-bit delta */
+#define HWLOG_MORE      0x100   /* next record belongs to same batch */
+#define HWLOG_OPMASK    0xFF
+
+#define HWLOG_READSIZE  (64 * 1024)
+#define HWLOG_MAXDATA   (256 * 1024 * 1024)  /* larger sizes mean broken record */
+
+typedef struct __attribute__((packed)) {
+    int     magic;
+    int     op;
+    long    seq;
+    long    expire;
+    int     keysize;
+    int     valsize;
+} hwlogrec_t;
+
+/* Appends are serialized by caller, store does it under writer lock */
+typedef struct {
+    int     fd;
+    long    seq;
+    long    size;
+    char*   buf;
+    int     buflen;
+    int     bufcapa;
+    int     pending;
+    long    records;
+    long    bytes;
+} hwlog_t;
+
+/* Follower keeps unread tail of stream in its buffer */
+typedef struct {
+    int     fd;
+    int     owned;
+    long    seq;
+    char*   buf;
+    int     buflen;
+    int     bufpos;
+    int     bufcapa;
+} hwfollow_t;
+
+int hwlog_open(hwlog_t* hwlog, char* path);
+void hwlog_close(hwlog_t* hwlog);
+void hwlog_add(hwlog_t* hwlog, int op, char* key, int keysize, char* val, int valsize, long expire);
+long hwlog_flush(hwlog_t* hwlog);
+long hwlog_seq(hwlog_t* hwlog);
+
+int hwfollow_open(hwfollow_t* hwfollow, char* path, long seq);
+void hwfollow_attach(hwfollow_t* hwfollow, int fd, long seq);
+void hwfollow_close(hwfollow_t* hwfollow);
+int hwfollow_fill(hwfollow_t* hwfollow);
+int hwfollow_next(hwfollow_t* hwfollow, hwlogrec_t* rec, char** key, char** val);
+
+#endif
@@ -7,42 +7,649 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
+#include <fcntl.h>
+#include <limits.h>
 
 #include <hwmemory.h>
 
-int msleep(int tms) {
-  return usleep(tms * 1000);
+#define BYTERATE (8 + 2)
+
+static long hwmemory_nanotime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L * 1000L * 1000L + ts.tv_nsec;
 }
 
-#define BYTERATE (8 + 2)
+static long hwmemory_cost(hwmemory_t* hwmemory, long rate, long bytes) {
+    return hwmemory->cost.opnsec + bytes * rate;
+}
+
+/* Bytes of whole blocks touched by transfer, a block crossed is paid twice */
+static long hwmemory_span(hwmemory_t* hwmemory, int pos, int size) {
+    int block = hwmemory->cost.block;
+    if (block <= 1 || size <= 0) return size;
+    long first = pos / block;
+    long last = (pos + size - 1) / block;
+    return (last - first + 1) * block;
+}
+
+/* Model time of calling thread, shared by all devices */
+static __thread long hwmemory_thclock = 0;
+
+long hwmemory_tclock(void) {
+    return hwmemory_thclock;
+}
+
+void hwmemory_tsync(long clock) {
+    if (clock > hwmemory_thclock) hwmemory_thclock = clock;
+}
+
+/* Moves thread clock back as well, to issue several transfers at once */
+void hwmemory_tset(long clock) {
+    hwmemory_thclock = clock;
+}
+
+/* Transfers of calling thread over all devices, and its counter shard */
+static __thread hwiostat_t hwmemory_thstat;
+static __thread int hwmemory_thshard = -1;
+
+/* Bank serves nsec from issue or from its busy end, returns end of service */
+static long hwmemory_book(hwbank_t* bank, long issue, long nsec) {
+    long busy = __atomic_load_n(&(bank->busy), __ATOMIC_RELAXED);
+    for (;;) {
+        long end = (busy > issue ? busy : issue) + nsec;
+        if (end == busy) return end;
+        if (__atomic_compare_exchange_n(&(bank->busy), &busy, end, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            if (nsec > 0) __atomic_fetch_add(&(bank->served), nsec, __ATOMIC_RELAXED);
+            return end;
+        }
+    }
+}
+
+/* End of latest transfer on model timeline */
+static long hwmemory_vnow(hwmemory_t* hwmemory) {
+    long now = hwmemory->vorigin;
+    for (int i = 0; i < hwmemory->nbanks; i++) {
+        long busy = __atomic_load_n(&(hwmemory->banks[i].busy), __ATOMIC_RELAXED);
+        if (busy > now) now = busy;
+    }
+    return now;
+}
+
+/*
+ * Split transfer over banks, every touched bank serves its part as one
+ * operation starting when both the caller and the bank are free. Parts
+ * on different banks overlap. Returns model latency seen by caller.
+ */
+static long hwmemory_delay(hwmemory_t* hwmemory, long rate, int pos, int size) {
+    int nbanks = hwmemory->nbanks;
+    long bytes[nbanks];
+    int touched[nbanks];
+    memset(bytes, 0, sizeof(bytes));
+    memset(touched, 0, sizeof(touched));
+
+    if (nbanks == 1) {
+        bytes[0] = hwmemory_span(hwmemory, pos, size);
+        touched[0] = 1;
+    } else {
+        int stripe = hwmemory->stripe;
+        touched[(pos / stripe) % nbanks] = 1;
+        while (size > 0) {
+            int len = stripe - pos % stripe;
+            if (len > size) len = size;
+            int bank = (pos / stripe) % nbanks;
+            bytes[bank] += hwmemory_span(hwmemory, pos, len);
+            touched[bank] = 1;
+            pos += len;
+            size -= len;
+        }
+    }
+
+    long issue = hwmemory_thclock;
+    long done = issue;
+    long longest = 0;
+    int locked = !hwmemory->cost.virtual;
+
+    /* Banks are locked in index order, so transfers can not deadlock */
+    for (int i = 0; i < nbanks; i++) {
+        if (!touched[i]) continue;
+        hwbank_t* bank = &(hwmemory->banks[i]);
+        if (locked) pthread_mutex_lock(&(bank->lock));
+
+        long nsec = hwmemory_cost(hwmemory, rate, bytes[i]);
+        long end = hwmemory_book(bank, issue, nsec);
+        if (end > done) done = end;
+        if (nsec > longest) longest = nsec;
+    }
+
+    /* In real mode banks stay locked, so busy while transfer sleeps */
+    if (locked && longest > 0) {
+        struct timespec ts;
+        ts.tv_sec = longest / (1000L * 1000L * 1000L);
+        ts.tv_nsec = longest % (1000L * 1000L * 1000L);
+        nanosleep(&ts, NULL);
+    }
+
+    for (int i = 0; locked && i < nbanks; i++) {
+        if (!touched[i]) continue;
+        pthread_mutex_unlock(&(hwmemory->banks[i].lock));
+    }
+
+    hwmemory_thclock = done;
+    return done - issue;
+}
+
+/* Count to shard of calling thread, so threads rarely share a counter line */
+static void hwmemory_count(hwmemory_t* hwmemory, int write, int size, long spent) {
+    static int nextshard = 0;
+    if (hwmemory_thshard < 0) {
+        hwmemory_thshard = __atomic_fetch_add(&nextshard, 1, __ATOMIC_RELAXED) % HWIOSTAT_SHARDS;
+    }
+    hwiostat_t* iostat = &(hwmemory->iostats[hwmemory_thshard].iostat);
+    if (write) {
+        __atomic_fetch_add(&(iostat->wcalls), 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&(iostat->wbytes), size, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&(iostat->wnsec), spent, __ATOMIC_RELAXED);
+        hwmemory_thstat.wcalls++;
+        hwmemory_thstat.wbytes += size;
+        hwmemory_thstat.wnsec += spent;
+    } else {
+        __atomic_fetch_add(&(iostat->rcalls), 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&(iostat->rbytes), size, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&(iostat->rnsec), spent, __ATOMIC_RELAXED);
+        hwmemory_thstat.rcalls++;
+        hwmemory_thstat.rbytes += size;
+        hwmemory_thstat.rnsec += spent;
+    }
+}
 
+static void hwmemory_setup(hwmemory_t* hwmemory, int size) {
+    hwmemory->size = size;
+    hwmemory->cost.opnsec = 0;
+    hwmemory->cost.rnsec = BYTERATE * 1000;
+    hwmemory->cost.wnsec = BYTERATE * 1000;
+    hwmemory->cost.block = 1;
+    hwmemory->cost.virtual = 0;
+    hwmemory->vorigin = hwmemory_thclock;
+    hwmemory->nbanks = 0;
+    hwmemory->banks = NULL;
+    hwmemory_setbanks(hwmemory, 1, size);
+    memset(hwmemory->iostats, 0, sizeof(hwmemory->iostats));
+    hwmemory->trace = NULL;
+    hwmemory->tracestart = 0;
+    hwmemory->behind = NULL;
+}
 
 void hwmemory_init(hwmemory_t* hwmemory, int size) {
     hwmemory->data = malloc(size);
     memset(hwmemory->data, 0, size);
-    hwmemory->size = size;
+    hwmemory->fd = -1;
+    hwmemory_setup(hwmemory, size);
 }
 
-int hwmemory_write(hwmemory_t* hwmemory, int pos, void* data, int size) {
-    if ((pos + size) > hwmemory->size) return -1;
-    memcpy(&(hwmemory->data[pos]), data, size);
-    usleep(BYTERATE * size);
+/* File backend, file is extended to size bytes if shorter */
+int hwmemory_open(hwmemory_t* hwmemory, char* path, int size) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return -1;
+    off_t fsize = lseek(fd, 0, SEEK_END);
+    if (fsize < size && ftruncate(fd, size) < 0) {
+        close(fd);
+        return -1;
+    }
+    hwmemory->data = NULL;
+    hwmemory->fd = fd;
+    hwmemory_setup(hwmemory, size);
+    return 0;
+}
+
+static int hwmemory_store(hwmemory_t* hwmemory, int pos, void* data, int size) {
+    if (hwmemory->fd < 0) {
+        memcpy(&(hwmemory->data[pos]), data, size);
+        return size;
+    }
+    return pwrite(hwmemory->fd, data, size, pos);
+}
+
+static int hwmemory_load(hwmemory_t* hwmemory, int pos, void* data, int size) {
+    if (hwmemory->fd < 0) {
+        memcpy(data, &(hwmemory->data[pos]), size);
+        return size;
+    }
+    return pread(hwmemory->fd, data, size, pos);
+}
+
+int hwmemory_trace_open(hwmemory_t* hwmemory, char* path) {
+    FILE* trace = fopen(path, "wb");
+    if (trace == NULL) return -1;
+
+    hwtracehead_t head;
+    memcpy(head.magic, HWTRACE_MAGIC, sizeof(head.magic));
+    head.size = hwmemory->size;
+    if (fwrite(&head, sizeof(head), 1, trace) != 1) {
+        fclose(trace);
+        return -1;
+    }
+    hwmemory->tracestart = hwmemory->cost.virtual ? hwmemory_thclock : hwmemory_nanotime();
+    hwmemory->trace = trace;
+    return 0;
+}
+
+void hwmemory_trace_close(hwmemory_t* hwmemory) {
+    if (hwmemory->trace == NULL) return;
+    fclose(hwmemory->trace);
+    hwmemory->trace = NULL;
+}
+
+static int hwmemory_iosize(struct iovec* iov, int iovcnt) {
+    long size = 0;
+    for (int i = 0; i < iovcnt; i++) size += iov[i].iov_len;
+    return size > INT_MAX ? -1 : (int)size;
+}
+
+static int hwmemory_storev(hwmemory_t* hwmemory, int pos, struct iovec* iov, int iovcnt) {
+    if (hwmemory->fd >= 0) return pwritev(hwmemory->fd, iov, iovcnt, pos);
+    int size = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(&(hwmemory->data[pos + size]), iov[i].iov_base, iov[i].iov_len);
+        size += iov[i].iov_len;
+    }
+    return size;
+}
+
+static int hwmemory_loadv(hwmemory_t* hwmemory, int pos, struct iovec* iov, int iovcnt) {
+    if (hwmemory->fd >= 0) return preadv(hwmemory->fd, iov, iovcnt, pos);
+    int size = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(iov[i].iov_base, &(hwmemory->data[pos + size]), iov[i].iov_len);
+        size += iov[i].iov_len;
+    }
     return size;
 }
 
+static void hwmemory_trace(hwmemory_t* hwmemory, char op, int pos, int size, long issue) {
+    hwtrace_t record;
+    record.op = op;
+    record.pos = pos;
+    record.size = size;
+    record.nsec = issue - hwmemory->tracestart;
+    fwrite(&record, sizeof(record), 1, hwmemory->trace);
+}
+
+int hwmemory_setbanks(hwmemory_t* hwmemory, int nbanks, int stripe) {
+    if (nbanks < 1 || (nbanks > 1 && stripe < 1)) return -1;
+
+    long now = hwmemory_vnow(hwmemory);
+    for (int i = 0; i < hwmemory->nbanks; i++) {
+        pthread_mutex_destroy(&(hwmemory->banks[i].lock));
+    }
+    free(hwmemory->banks);
+
+    hwmemory->banks = malloc(nbanks * sizeof(hwbank_t));
+    for (int i = 0; i < nbanks; i++) {
+        pthread_mutex_init(&(hwmemory->banks[i].lock), NULL);
+        hwmemory->banks[i].busy = now;
+        hwmemory->banks[i].served = 0;
+    }
+    hwmemory->nbanks = nbanks;
+    hwmemory->stripe = stripe;
+    return 0;
+}
+
+long hwmemory_served(hwmemory_t* hwmemory, int bank) {
+    if (bank < 0 || bank >= hwmemory->nbanks) return -1;
+    return __atomic_load_n(&(hwmemory->banks[bank].served), __ATOMIC_RELAXED);
+}
+
+void hwmemory_setcost(hwmemory_t* hwmemory, hwcost_t* cost) {
+    hwmemory->cost = *cost;
+    if (hwmemory->cost.block < 1) hwmemory->cost.block = 1;
+}
+
+void hwmemory_getcost(hwmemory_t* hwmemory, hwcost_t* cost) {
+    *cost = hwmemory->cost;
+}
+
+/* Model time spent on this device since it was created */
+long hwmemory_vclock(hwmemory_t* hwmemory) {
+    return hwmemory_vnow(hwmemory) - hwmemory->vorigin;
+}
+
+long hwmemory_vorigin(hwmemory_t* hwmemory) {
+    return hwmemory->vorigin;
+}
+
+/* Time counters hold wall time in real mode and model time in virtual mode */
+static int hwmemory_put(hwmemory_t* hwmemory, int pos, void* data, int size) {
+    long start = hwmemory_nanotime();
+    long issue = hwmemory->cost.virtual ? hwmemory_thclock : start;
+    if (hwmemory_store(hwmemory, pos, data, size) != size) return -1;
+    long spent = hwmemory_delay(hwmemory, hwmemory->cost.wnsec, pos, size);
+    if (!hwmemory->cost.virtual) spent = hwmemory_nanotime() - start;
+    hwmemory_count(hwmemory, 1, size, spent);
+    if (hwmemory->trace != NULL) hwmemory_trace(hwmemory, HWTRACE_WRITE, pos, size, issue);
+    return size;
+}
+
+static int hwmemory_get(hwmemory_t* hwmemory, int pos, void* data, int size) {
+    long start = hwmemory_nanotime();
+    long issue = hwmemory->cost.virtual ? hwmemory_thclock : start;
+    if (hwmemory_load(hwmemory, pos, data, size) != size) return -1;
+    long spent = hwmemory_delay(hwmemory, hwmemory->cost.rnsec, pos, size);
+    if (!hwmemory->cost.virtual) spent = hwmemory_nanotime() - start;
+    hwmemory_count(hwmemory, 0, size, spent);
+    if (hwmemory->trace != NULL) hwmemory_trace(hwmemory, HWTRACE_READ, pos, size, issue);
+    return size;
+}
+
+static int hwmemory_putv(hwmemory_t* hwmemory, int pos, struct iovec* iov, int iovcnt, int size) {
+    long start = hwmemory_nanotime();
+    long issue = hwmemory->cost.virtual ? hwmemory_thclock : start;
+    if (hwmemory_storev(hwmemory, pos, iov, iovcnt) != size) return -1;
+    long spent = hwmemory_delay(hwmemory, hwmemory->cost.wnsec, pos, size);
+    if (!hwmemory->cost.virtual) spent = hwmemory_nanotime() - start;
+    hwmemory_count(hwmemory, 1, size, spent);
+    if (hwmemory->trace != NULL) hwmemory_trace(hwmemory, HWTRACE_WRITE, pos, size, issue);
+    return size;
+}
+
+static int hwmemory_getv(hwmemory_t* hwmemory, int pos, struct iovec* iov, int iovcnt, int size) {
+    long start = hwmemory_nanotime();
+    long issue = hwmemory->cost.virtual ? hwmemory_thclock : start;
+    if (hwmemory_loadv(hwmemory, pos, iov, iovcnt) != size) return -1;
+    long spent = hwmemory_delay(hwmemory, hwmemory->cost.rnsec, pos, size);
+    if (!hwmemory->cost.virtual) spent = hwmemory_nanotime() - start;
+    hwmemory_count(hwmemory, 0, size, spent);
+    if (hwmemory->trace != NULL) hwmemory_trace(hwmemory, HWTRACE_READ, pos, size, issue);
+    return size;
+}
+
+/* First range which ends after pos */
+static int hwbehind_first(hwdirty_t* ranges, int count, long pos) {
+    int low = 0;
+    int high = count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (ranges[mid].pos + ranges[mid].size > pos) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return low;
+}
+
+/* Write goes over dirty ranges it overlaps or touches, they become one */
+static void hwbehind_add(hwbehind_t* behind, int pos, char* data, int size) {
+    int end = pos + size;
+    int first = hwbehind_first(behind->dirty, behind->ndirty, (long)pos - 1);
+    int last = first;
+    while (last < behind->ndirty && behind->dirty[last].pos <= end) last++;
+
+    if (last == first + 1 && behind->dirty[first].pos <= pos
+        && behind->dirty[first].pos + behind->dirty[first].size >= end) {
+        hwdirty_t* range = &(behind->dirty[first]);
+        memcpy(range->data + pos - range->pos, data, size);
+        return;
+    }
+
+    hwdirty_t merged;
+    merged.pos = pos;
+    int stop = end;
+    if (last > first) {
+        hwdirty_t* tail = &(behind->dirty[last - 1]);
+        if (behind->dirty[first].pos < merged.pos) merged.pos = behind->dirty[first].pos;
+        if (tail->pos + tail->size > stop) stop = tail->pos + tail->size;
+    }
+    merged.size = stop - merged.pos;
+    merged.data = malloc(merged.size);
+    for (int i = first; i < last; i++) {
+        hwdirty_t* range = &(behind->dirty[i]);
+        memcpy(merged.data + range->pos - merged.pos, range->data, range->size);
+        behind->bytes -= range->size;
+        free(range->data);
+    }
+    memcpy(merged.data + pos - merged.pos, data, size);
+    behind->bytes += merged.size;
+
+    if (last == first) {
+        if (behind->ndirty == behind->dirtycapa) {
+            behind->dirtycapa = behind->dirtycapa == 0 ? 64 : behind->dirtycapa * 2;
+            behind->dirty = realloc(behind->dirty, behind->dirtycapa * sizeof(hwdirty_t));
+        }
+        last = first + 1;
+        memmove(&(behind->dirty[last]), &(behind->dirty[first]), (behind->ndirty - first) * sizeof(hwdirty_t));
+        behind->ndirty++;
+    }
+    behind->dirty[first] = merged;
+    memmove(&(behind->dirty[first + 1]), &(behind->dirty[last]), (behind->ndirty - last) * sizeof(hwdirty_t));
+    behind->ndirty -= last - first - 1;
+}
+
+static int hwbehind_covers(hwdirty_t* ranges, int count, int pos, int size) {
+    int i = hwbehind_first(ranges, count, pos);
+    return i < count && ranges[i].pos <= pos && ranges[i].pos + ranges[i].size >= pos + size;
+}
+
+/* Copy buffered bytes of device range pos over buffers */
+static void hwbehind_overlay(hwdirty_t* ranges, int count, int pos, struct iovec* iov, int iovcnt) {
+    for (int k = 0; k < iovcnt; k++) {
+        int size = iov[k].iov_len;
+        char* data = iov[k].iov_base;
+        for (int i = hwbehind_first(ranges, count, pos); i < count && ranges[i].pos < pos + size; i++) {
+            int from = ranges[i].pos > pos ? ranges[i].pos : pos;
+            int to = ranges[i].pos + ranges[i].size < pos + size ? ranges[i].pos + ranges[i].size : pos + size;
+            memcpy(data + from - pos, ranges[i].data + from - ranges[i].pos, to - from);
+        }
+        pos += size;
+    }
+}
+
+/* Writer waits while buffer is over limit, write larger than limit goes alone */
+static int hwbehind_write(hwmemory_t* hwmemory, int pos, struct iovec* iov, int iovcnt, int size) {
+    hwbehind_t* behind = hwmemory->behind;
+    pthread_mutex_lock(&(behind->lock));
+    while (behind->bytes > 0 && behind->bytes + size > behind->limit) {
+        pthread_cond_wait(&(behind->done), &(behind->lock));
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) continue;
+        hwbehind_add(behind, pos, iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+    pthread_cond_signal(&(behind->work));
+    pthread_mutex_unlock(&(behind->lock));
+    return size;
+}
+
+/*
+ * Range held by buffer is read from RAM. Otherwise device is read and
+ * buffered bytes are copied over, read is repeated if a batch was
+ * flushed meanwhile, as its bytes may have missed both.
+ */
+static int hwbehind_read(hwmemory_t* hwmemory, int pos, struct iovec* iov, int iovcnt, int size) {
+    hwbehind_t* behind = hwmemory->behind;
+    pthread_mutex_lock(&(behind->lock));
+    for (;;) {
+        if (hwbehind_covers(behind->flushing, behind->nflushing, pos, size)
+            || hwbehind_covers(behind->dirty, behind->ndirty, pos, size)) {
+            break;
+        }
+        long batches = behind->batches;
+        pthread_mutex_unlock(&(behind->lock));
+        if (hwmemory_getv(hwmemory, pos, iov, iovcnt, size) != size) return -1;
+        pthread_mutex_lock(&(behind->lock));
+        if (behind->batches == batches) break;
+    }
+    hwbehind_overlay(behind->flushing, behind->nflushing, pos, iov, iovcnt);
+    hwbehind_overlay(behind->dirty, behind->ndirty, pos, iov, iovcnt);
+    pthread_mutex_unlock(&(behind->lock));
+    return size;
+}
+
+/* Flusher takes all dirty ranges at once and writes them in address order */
+static void* hwbehind_run(void* arg) {
+    hwmemory_t* hwmemory = (hwmemory_t*)arg;
+    hwbehind_t* behind = hwmemory->behind;
+    pthread_mutex_lock(&(behind->lock));
+    for (;;) {
+        while (behind->ndirty == 0 && !behind->stop) {
+            pthread_cond_wait(&(behind->work), &(behind->lock));
+        }
+        if (behind->ndirty == 0) break;
+
+        hwdirty_t* ranges = behind->flushing;
+        int capa = behind->flushcapa;
+        behind->flushing = behind->dirty;
+        behind->flushcapa = behind->dirtycapa;
+        behind->nflushing = behind->ndirty;
+        behind->dirty = ranges;
+        behind->dirtycapa = capa;
+        behind->ndirty = 0;
+        pthread_mutex_unlock(&(behind->lock));
+
+        /* Flusher transfers start at present of device timeline */
+        hwmemory_tsync(hwmemory_vnow(hwmemory));
+        for (int i = 0; i < behind->nflushing; i++) {
+            hwdirty_t* range = &(behind->flushing[i]);
+            hwmemory_put(hwmemory, range->pos, range->data, range->size);
+        }
+
+        pthread_mutex_lock(&(behind->lock));
+        for (int i = 0; i < behind->nflushing; i++) {
+            behind->bytes -= behind->flushing[i].size;
+            free(behind->flushing[i].data);
+        }
+        behind->nflushing = 0;
+        behind->batches++;
+        pthread_cond_broadcast(&(behind->done));
+    }
+    pthread_mutex_unlock(&(behind->lock));
+    return NULL;
+}
+
+/*
+ * Buffer writes up to limit bytes and flush them from background thread,
+ * 0 flushes buffer and writes through again. Device must be idle while
+ * write-behind is turned on or off.
+ */
+int hwmemory_setbehind(hwmemory_t* hwmemory, long limit) {
+    if (limit < 0) return -1;
+    hwbehind_t* behind = hwmemory->behind;
+    if (behind != NULL && limit > 0) {
+        pthread_mutex_lock(&(behind->lock));
+        behind->limit = limit;
+        pthread_cond_broadcast(&(behind->done));
+        pthread_mutex_unlock(&(behind->lock));
+        return 0;
+    }
+    if (behind == NULL && limit > 0) {
+        behind = calloc(1, sizeof(hwbehind_t));
+        pthread_mutex_init(&(behind->lock), NULL);
+        pthread_cond_init(&(behind->work), NULL);
+        pthread_cond_init(&(behind->done), NULL);
+        behind->limit = limit;
+        hwmemory->behind = behind;
+        if (pthread_create(&(behind->thread), NULL, hwbehind_run, hwmemory) != 0) {
+            hwmemory->behind = NULL;
+            free(behind);
+            return -1;
+        }
+        return 0;
+    }
+    if (behind != NULL) {
+        pthread_mutex_lock(&(behind->lock));
+        behind->stop = 1;
+        pthread_cond_signal(&(behind->work));
+        pthread_mutex_unlock(&(behind->lock));
+        pthread_join(behind->thread, NULL);
+        hwmemory->behind = NULL;
+        pthread_mutex_destroy(&(behind->lock));
+        pthread_cond_destroy(&(behind->work));
+        pthread_cond_destroy(&(behind->done));
+        free(behind->dirty);
+        free(behind->flushing);
+        free(behind);
+    }
+    return 0;
+}
+
+/* Wait until writes made before the call are on device */
+void hwmemory_sync(hwmemory_t* hwmemory) {
+    hwbehind_t* behind = hwmemory->behind;
+    if (behind == NULL) return;
+    pthread_mutex_lock(&(behind->lock));
+    while (behind->ndirty > 0 || behind->nflushing > 0) {
+        pthread_cond_wait(&(behind->done), &(behind->lock));
+    }
+    pthread_mutex_unlock(&(behind->lock));
+}
+
+int hwmemory_write(hwmemory_t* hwmemory, int pos, void* data, int size) {
+    if (pos < 0 || (pos + size) > hwmemory->size) return -1;
+    if (hwmemory->behind != NULL) {
+        struct iovec iov = { data, size };
+        return hwbehind_write(hwmemory, pos, &iov, 1, size);
+    }
+    return hwmemory_put(hwmemory, pos, data, size);
+}
+
 int hwmemory_read(hwmemory_t* hwmemory, int pos, void* data, int size) {
+    if (pos < 0 || pos > hwmemory->size) return -1;
     if ((pos + size) > hwmemory->size) {
         size = hwmemory->size - pos;
     }
-    memcpy(&(*data), &(hwmemory->data[pos]), size);
-    usleep(BYTERATE * size);
-    return size;
+    if (hwmemory->behind != NULL) {
+        struct iovec iov = { data, size };
+        return hwbehind_read(hwmemory, pos, &iov, 1, size);
+    }
+    return hwmemory_get(hwmemory, pos, data, size);
+}
+
+/* Gather buffers to contiguous device range, costs one operation */
+int hwmemory_writev(hwmemory_t* hwmemory, int pos, struct iovec* iov, int iovcnt) {
+    int size = hwmemory_iosize(iov, iovcnt);
+    if (pos < 0 || size < 0 || (pos + size) > hwmemory->size) return -1;
+    if (hwmemory->behind != NULL) return hwbehind_write(hwmemory, pos, iov, iovcnt, size);
+    return hwmemory_putv(hwmemory, pos, iov, iovcnt, size);
+}
+
+/* Scatter contiguous device range to buffers, range must be on device */
+int hwmemory_readv(hwmemory_t* hwmemory, int pos, struct iovec* iov, int iovcnt) {
+    int size = hwmemory_iosize(iov, iovcnt);
+    if (pos < 0 || size < 0 || (pos + size) > hwmemory->size) return -1;
+    if (hwmemory->behind != NULL) return hwbehind_read(hwmemory, pos, iov, iovcnt, size);
+    return hwmemory_getv(hwmemory, pos, iov, iovcnt, size);
 }
 
 int hwmemory_size(hwmemory_t* hwmemory) {
     return hwmemory->size;
 }
 
+void hwmemory_iostat(hwmemory_t* hwmemory, hwiostat_t* iostat) {
+    memset(iostat, 0, sizeof(hwiostat_t));
+    for (int i = 0; i < HWIOSTAT_SHARDS; i++) {
+        hwiostat_t* curr = &(hwmemory->iostats[i].iostat);
+        iostat->rcalls += __atomic_load_n(&(curr->rcalls), __ATOMIC_RELAXED);
+        iostat->rbytes += __atomic_load_n(&(curr->rbytes), __ATOMIC_RELAXED);
+        iostat->rnsec += __atomic_load_n(&(curr->rnsec), __ATOMIC_RELAXED);
+        iostat->wcalls += __atomic_load_n(&(curr->wcalls), __ATOMIC_RELAXED);
+        iostat->wbytes += __atomic_load_n(&(curr->wbytes), __ATOMIC_RELAXED);
+        iostat->wnsec += __atomic_load_n(&(curr->wnsec), __ATOMIC_RELAXED);
+    }
+}
+
+/* Transfers made by calling thread over all devices */
+void hwmemory_tiostat(hwiostat_t* iostat) {
+    *iostat = hwmemory_thstat;
+}
+
 void hwmemory_destroy(hwmemory_t* hwmemory) {
+    hwmemory_setbehind(hwmemory, 0);
+    for (int i = 0; i < hwmemory->nbanks; i++) {
+        pthread_mutex_destroy(&(hwmemory->banks[i].lock));
+    }
+    free(hwmemory->banks);
+    hwmemory_trace_close(hwmemory);
+    if (hwmemory->fd >= 0) close(hwmemory->fd);
     free(hwmemory->data);
 }
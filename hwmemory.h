@@ -10,16 +10,139 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
+/* Device I/O counters, per direction: calls, bytes and time spent */
 typedef struct {
+    long    rcalls;
+    long    rbytes;
+    long    rnsec;
+    long    wcalls;
+    long    wbytes;
+    long    wnsec;
+} hwiostat_t;
+
+#define HWIOSTAT_SHARDS 16      /* counter copies, threads spread over them */
+
+typedef struct {
+    hwiostat_t  iostat;
+} __attribute__((aligned(64))) hwioshard_t;
+
+/*
+ * Device latency model, times in nanoseconds. Every transfer costs
+ * opnsec plus per byte rate for each whole block it touches.
+ * In virtual mode time is only accounted on device clock, no sleep.
+ */
+typedef struct {
+    long    opnsec;
+    long    rnsec;
+    long    wnsec;
+    int     block;
+    int     virtual;
+} hwcost_t;
+
+/*
+ * Independent channel of device. Addresses are interleaved over banks
+ * by stripe bytes, busy holds end of last transfer on model timeline.
+ * Lock is taken in real mode only, virtual transfers book busy time
+ * with compare and swap.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    long    busy;
+    long    served;
+} hwbank_t;
+
+/*
+ * Trace file is a hwtracehead_t followed by one hwtrace_t per transfer.
+ * Time is nanoseconds since trace start, model time in virtual mode.
+ */
+#define HWTRACE_MAGIC   "HWTRACE1"
+#define HWTRACE_READ    'r'
+#define HWTRACE_WRITE   'w'
+
+typedef struct __attribute__((packed)) {
+    char    magic[8];
+    int     size;
+} hwtracehead_t;
+
+typedef struct __attribute__((packed)) {
+    char    op;
+    int     pos;
+    int     size;
+    long    nsec;
+} hwtrace_t;
+
+/* Buffered write not yet on device, ranges of a list never overlap */
+typedef struct {
+    int     pos;
+    int     size;
     char*   data;
+} hwdirty_t;
+
+/*
+ * Write-behind buffer. Writes go to dirty ranges sorted by address and
+ * merged with their neighbours. Flusher thread takes all dirty ranges
+ * as one batch and writes them in address order, reads see batch being
+ * flushed and newer dirty ranges over device data.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  work;   /* dirty ranges added or stop asked */
+    pthread_cond_t  done;   /* batch flushed */
+    pthread_t   thread;
+    long    limit;      /* writers wait while buffer holds more */
+    long    bytes;      /* dirty and flushing */
+    hwdirty_t*  dirty;
+    int     ndirty;
+    int     dirtycapa;
+    hwdirty_t*  flushing;
+    int     nflushing;
+    int     flushcapa;
+    long    batches;    /* flushed batches, reads check it */
+    int     stop;
+} hwbehind_t;
+
+typedef struct {
+    char*   data;
+    int     fd;
     int     size;
+    hwcost_t    cost;
+    int     nbanks;
+    int     stripe;
+    hwbank_t*   banks;
+    long    vorigin;    /* model time of creation, device timeline starts there */
+    hwioshard_t iostats[HWIOSTAT_SHARDS];
+    FILE*   trace;
+    long    tracestart;
+    hwbehind_t* behind;     /* write-behind buffer, NULL writes through */
 } hwmemory_t;
 
 void hwmemory_init(hwmemory_t* hwmemory, int size);
+int hwmemory_open(hwmemory_t* hwmemory, char* path, int size);
 int hwmemory_write(hwmemory_t* hwmemory, int pos, void* data, int size);
 int hwmemory_read(hwmemory_t* hwmemory, int pos, void* data, int size);
+int hwmemory_writev(hwmemory_t* hwmemory, int pos, struct iovec* iov, int iovcnt);
+int hwmemory_readv(hwmemory_t* hwmemory, int pos, struct iovec* iov, int iovcnt);
 int hwmemory_size(hwmemory_t* hwmemory);
+void hwmemory_setcost(hwmemory_t* hwmemory, hwcost_t* cost);
+void hwmemory_getcost(hwmemory_t* hwmemory, hwcost_t* cost);
+long hwmemory_vclock(hwmemory_t* hwmemory);
+long hwmemory_vorigin(hwmemory_t* hwmemory);
+int hwmemory_setbanks(hwmemory_t* hwmemory, int nbanks, int stripe);
+long hwmemory_served(hwmemory_t* hwmemory, int bank);
+int hwmemory_setbehind(hwmemory_t* hwmemory, long limit);
+void hwmemory_sync(hwmemory_t* hwmemory);
+
+int hwmemory_trace_open(hwmemory_t* hwmemory, char* path);
+void hwmemory_trace_close(hwmemory_t* hwmemory);
+
+long hwmemory_tclock(void);
+void hwmemory_tsync(long clock);
+void hwmemory_tset(long clock);
+void hwmemory_iostat(hwmemory_t* hwmemory, hwiostat_t* iostat);
+void hwmemory_tiostat(hwiostat_t* iostat);
 void hwmemory_destroy(hwmemory_t* hwmemory);
 
 #endif
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <hwmemory.h>
+#include <hwhist.h>
+
+/*
+ * Replay hwmemory trace against RAM or file backend with any cost
+ * model. By default transfers are issued at their recorded time and
+ * latency counts from that time, so queueing shows up; with -a they
+ * are issued back to back.
+ */
+
+typedef struct {
+    char*   path;
+    char*   file;
+    int     memsize;
+    int     nbanks;
+    int     stripe;
+    int     asap;
+    int     buckets;
+    hwcost_t    cost;
+} rconf_t;
+
+static long getnanotime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L * 1000L * 1000L + ts.tv_nsec;
+}
+
+static long rclock(rconf_t* conf) {
+    return conf->cost.virtual ? hwmemory_tclock() : getnanotime();
+}
+
+/* Wait for recorded issue time, returns it on replay clock */
+static long rwait(rconf_t* conf, long start, long nsec) {
+    long issue = start + nsec;
+    if (conf->cost.virtual) {
+        hwmemory_tsync(issue);
+        return issue;
+    }
+    long now = getnanotime();
+    if (issue > now) {
+        struct timespec ts;
+        ts.tv_sec = (issue - now) / (1000L * 1000L * 1000L);
+        ts.tv_nsec = (issue - now) % (1000L * 1000L * 1000L);
+        nanosleep(&ts, NULL);
+    }
+    return issue;
+}
+
+static int rparse_cost(char* arg, hwcost_t* cost) {
+    long opnsec, rnsec, wnsec;
+    int block = 1;
+    int n = sscanf(arg, "%ld:%ld:%ld:%d", &opnsec, &rnsec, &wnsec, &block);
+    if (n < 3) return -1;
+    cost->opnsec = opnsec;
+    cost->rnsec = rnsec;
+    cost->wnsec = wnsec;
+    cost->block = block;
+    return 0;
+}
+
+static void rusage(char* name) {
+    fprintf(stderr,
+        "usage: %s [options] trace\n"
+        "  -f path       file backend instead of RAM\n"
+        "  -m bytes      device size (default from trace)\n"
+        "  -c op:r:w[:block]  device cost, ns per op, per read and write byte\n"
+        "  -v            virtual device clock, no real sleeping\n"
+        "  -b banks:stripe    device banks interleaved by stripe bytes\n"
+        "  -a            issue transfers back to back, ignore recorded time\n"
+        "  -H            dump histogram buckets\n",
+        name);
+}
+
+int main(int argc, char **argv) {
+    rconf_t conf = {
+        .path = NULL,
+        .file = NULL,
+        .memsize = 0,
+        .nbanks = 1,
+        .stripe = 0,
+        .asap = 0,
+        .buckets = 0,
+    };
+
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 0);
+    hwmemory_getcost(&hwmemory, &conf.cost);
+    hwmemory_destroy(&hwmemory);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:m:c:vb:aH")) != -1) {
+        switch (opt) {
+            case 'f': conf.file = optarg; break;
+            case 'm': conf.memsize = atoi(optarg); break;
+            case 'c':
+                if (rparse_cost(optarg, &conf.cost) < 0) {
+                    rusage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'v': conf.cost.virtual = 1; break;
+            case 'b':
+                if (sscanf(optarg, "%d:%d", &conf.nbanks, &conf.stripe) != 2) {
+                    rusage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'a': conf.asap = 1; break;
+            case 'H': conf.buckets = 1; break;
+            default:
+                rusage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        rusage(argv[0]);
+        return 1;
+    }
+    conf.path = argv[optind];
+
+    FILE* trace = fopen(conf.path, "rb");
+    if (trace == NULL) {
+        fprintf(stderr, "cannot open trace %s\n", conf.path);
+        return 1;
+    }
+    hwtracehead_t head;
+    if (fread(&head, sizeof(head), 1, trace) != 1
+        || memcmp(head.magic, HWTRACE_MAGIC, sizeof(head.magic)) != 0) {
+        fprintf(stderr, "%s is not a trace file\n", conf.path);
+        fclose(trace);
+        return 1;
+    }
+    if (conf.memsize == 0) conf.memsize = head.size;
+
+    if (conf.file != NULL) {
+        if (hwmemory_open(&hwmemory, conf.file, conf.memsize) < 0) {
+            fprintf(stderr, "cannot open backend file %s\n", conf.file);
+            return 1;
+        }
+    } else {
+        hwmemory_init(&hwmemory, conf.memsize);
+    }
+    hwmemory_setcost(&hwmemory, &conf.cost);
+    if (hwmemory_setbanks(&hwmemory, conf.nbanks, conf.stripe) < 0) {
+        rusage(argv[0]);
+        return 1;
+    }
+
+    hwhist_t readhist;
+    hwhist_t writehist;
+    hwhist_init(&readhist);
+    hwhist_init(&writehist);
+
+    int bufsize = 4096;
+    char* buffer = malloc(bufsize);
+    memset(buffer, 0, bufsize);
+
+    long skipped = 0;
+    long wallstart = getnanotime();
+    long start = rclock(&conf);
+    hwtrace_t record;
+    while (fread(&record, sizeof(record), 1, trace) == 1) {
+        if (record.pos < 0 || record.size < 0 || record.pos + record.size > conf.memsize) {
+            skipped++;
+            continue;
+        }
+        if (record.size > bufsize) {
+            bufsize = record.size;
+            buffer = realloc(buffer, bufsize);
+            memset(buffer, 0, bufsize);
+        }
+
+        long issue = conf.asap ? rclock(&conf) : rwait(&conf, start, record.nsec);
+        if (record.op == HWTRACE_WRITE) {
+            hwmemory_write(&hwmemory, record.pos, buffer, record.size);
+            hwhist_add(&writehist, rclock(&conf) - issue);
+        } else {
+            hwmemory_read(&hwmemory, record.pos, buffer, record.size);
+            hwhist_add(&readhist, rclock(&conf) - issue);
+        }
+    }
+    long elapsed = rclock(&conf) - start;
+    long walltime = getnanotime() - wallstart;
+    fclose(trace);
+
+    hwiostat_t iostat;
+    hwmemory_iostat(&hwmemory, &iostat);
+
+    printf("{\"trace\":\"%s\",\"backend\":\"%s\",\"memsize\":%d,\"asap\":%d,"
+            "\"cost\":{\"opnsec\":%ld,\"rnsec\":%ld,\"wnsec\":%ld,\"block\":%d,\"virtual\":%d},"
+            "\"banks\":%d,\"stripe\":%d,",
+            conf.path, conf.file != NULL ? "file" : "ram", conf.memsize, conf.asap,
+            conf.cost.opnsec, conf.cost.rnsec, conf.cost.wnsec, conf.cost.block, conf.cost.virtual,
+            conf.nbanks, conf.stripe);
+    printf("\"transfers\":%ld,\"skipped\":%ld,\"nsec\":%ld,\"wallnsec\":%ld,",
+            iostat.rcalls + iostat.wcalls, skipped, elapsed, walltime);
+    printf("\"device\":{\"rcalls\":%ld,\"rbytes\":%ld,\"rnsec\":%ld,\"wcalls\":%ld,\"wbytes\":%ld,\"wnsec\":%ld},",
+            iostat.rcalls, iostat.rbytes, iostat.rnsec, iostat.wcalls, iostat.wbytes, iostat.wnsec);
+    printf("\"latency_ns\":{\"read\":");
+    hwhist_json(&readhist, stdout, conf.buckets);
+    printf(",\"write\":");
+    hwhist_json(&writehist, stdout, conf.buckets);
+    printf("}}\n");
+
+    free(buffer);
+    hwmemory_destroy(&hwmemory);
+    return 0;
+}
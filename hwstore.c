@@ -2,45 +2,164 @@
  * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
  */
 
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
+#include <sched.h>
 
 #include <hwmemory.h>
 #include <hwstore.h>
 
 
-#define STOREHEAD_SIZE  ((int)sizeof(hwstore_t))
+#define STOREHEAD_SIZE  ((int)sizeof(hwshead_t))
 #define CELLHEAD_SIZE   ((int)sizeof(hwcell_t))
 
+#define HWCORRUPT       -2      /* find met cell with bad header checksum */
 
-static void hwcell_init(hwcell_t* hwcell, int keysize, int valsize);
+
+static void hwcell_init(hwcell_t* hwcell, int capa);
+static int hwcell_nchunks(int valsize);
+static int hwcell_datasize(hwcell_t* hwcell);
+static unsigned int hwcell_crc(hwcell_t* hwcell);
+static int hwcell_intact(hwcell_t* hwcell, char* key, char* val);
+
+static hwmemory_t* hwstore_device(hwstore_t* hwstore, int addr, int* offset);
+static void hwstore_dread(hwstore_t* hwstore, int addr, void* data, int size);
+static void hwstore_dwrite(hwstore_t* hwstore, int addr, void* data, int size);
+static void hwstore_dwritev(hwstore_t* hwstore, int addr, struct iovec* iov, int iovcnt);
+static void hwstore_dreadv(hwstore_t* hwstore, int addr, struct iovec* iov, int iovcnt);
+static int hwstore_inside(hwstore_t* hwstore, int addr, int size);
+static int* hwstore_tailend(hwstore_t* hwstore, int addr);
+static int hwstore_grow(hwstore_t* hwstore, int need);
+static int hwstore_alignup(hwstore_t* hwstore, int size);
+static int hwstore_cellcapa(hwstore_t* hwstore, int datasize);
+static int hwstore_firstcell(hwstore_t* hwstore, int extent);
+static void hwstore_iocalls(hwstore_t* hwstore, long* reads, long* writes);
 
 static void hwstore_read_chead(hwstore_t* hwstore, int pos, hwcell_t *cell);
-static void hwstore_read_cell(hwstore_t* hwstore, int pos, hwcell_t *cell, char** key, char** val);
-static void hwstore_read_ckey(hwstore_t* hwstore, int pos, hwcell_t *cell, char** key);
+static char* hwstore_read_cell(hwstore_t* hwstore, int pos, hwcell_t *cell, hwscratch_t* scratch);
+static char* hwstore_read_skey(hwstore_t* hwstore, int pos, hwcell_t *cell, hwscratch_t* scratch);
+static char* hwscratch_get(hwscratch_t* scratch, int size);
 static void hwstore_read_cval(hwstore_t* hwstore, int pos, hwcell_t *cell, char** val);
+static int hwstore_read_value(hwstore_t* hwstore, int pos, hwcell_t *cell, char* key, char** val);
+static int hwstore_read_valbuf(hwstore_t* hwstore, int pos, hwcell_t *cell, char* key, char* buf);
 
 static void hwstore_write_cell(hwstore_t* hwstore, int pos, hwcell_t *cell, char* key, char* val);
 static void hwstore_write_chead(hwstore_t* hwstore, int pos, hwcell_t *cell);
 static void hwstore_write_shead(hwstore_t* hwstore);
 
 
-static int hwstore_trywrite_tofree(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize);
-static int hwstore_trywrite_tohead(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize);
-static int hwstore_trywrite_totail(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize);
+static int hwstore_take_head(hwstore_t* hwstore, int datasize, hwcell_t* cell);
+static int hwstore_take_free(hwstore_t* hwstore, int datasize, hwcell_t* cell);
+static void hwstore_refree(hwstore_t* hwstore, int pos, int capa);
+static void hwstore_write_free(hwstore_t* hwstore, int pos, int capa, int next);
+static void hwstore_freemap_build(hwstore_t* hwstore, hwfree_t* hwfree);
+static int hwstore_take_tail(hwstore_t* hwstore, int datasize, hwcell_t* cell);
+static int hwstore_take(hwstore_t* hwstore, int datasize, hwcell_t* cell);
+static void hwstore_putfree(hwstore_t* hwstore, int pos, hwcell_t* cell);
 static int hwstore_alloc(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize);
+static int hwstore_place(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize,
+                                int flags, int* next, hwcell_t* cell);
+static int hwstore_place_chunked(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize,
+                                int flags, int* next, hwcell_t* headcell);
+static void hwstore_free_chunks(hwstore_t* hwstore, int* table, int count);
+static void hwstore_unplace(hwstore_t* hwstore, int pos, hwcell_t* cell);
 static void hwstore_free(hwstore_t* hwstore, int addr);
+static void hwstore_unlink(hwstore_t* hwstore, int prevpos, hwcell_t* prevcell, int pos, hwcell_t* cell);
+static void hwstore_release(hwstore_t* hwstore, int prevpos, hwcell_t* prevcell, int pos, hwcell_t* cell);
+static int hwstore_snapped(hwstore_t* hwstore, hwcell_t* cell);
+static int hwstore_inplace(hwstore_t* hwstore, hwcell_t* cell, int keysize, int valsize);
+static int hwstore_replace(hwstore_t* hwstore, int addr, hwcell_t* cell, char* key, int keysize,
+                                char* val, int valsize);
+static int hwstore_retain(hwstore_t* hwstore, int pos, hwcell_t* cell);
+static void hwstore_reclaim(hwstore_t* hwstore);
+static int hwsnap_visible(hwsnap_t* hwsnap, hwcell_t* cell);
+
+static void hwstore_wlock(hwstore_t* hwstore);
+static void hwstore_wbegin(hwstore_t* hwstore);
+static void hwstore_wunlock(hwstore_t* hwstore);
+static int hwstore_rhome(void);
+static int hwstore_renter(hwstore_t* hwstore);
+static void hwstore_rexit(hwstore_t* hwstore, int slot);
+static int hwstore_rblocked(hwstore_t* hwstore, unsigned long epoch);
+static void hwstore_defer(hwstore_t* hwstore, int pos, hwcell_t* cell);
+static void hwstore_drain(hwstore_t* hwstore);
+static int hwstore_hotslot(int pos);
+static int hwstore_sweep(hwstore_t* hwstore, int budget);
+static int hwstore_scrub_cells(hwstore_t* hwstore, char* data, int size, int* used);
+static int hwstore_setexpire(hwstore_t* hwstore, char* key, int keysize, int ttl);
+static void hwstore_log(hwstore_t* hwstore, int op, char* key, int keysize, char* val, int valsize, long expire);
+static void hwstore_logflush(hwstore_t* hwstore);
+static int hwstore_replay(hwstore_t* hwstore, hwlogrec_t* rec, char* key, char* val);
+static int hwstore_evict(hwstore_t* hwstore, int datasize);
+static int hwstore_evict_merge(hwstore_t* hwstore, int datasize);
+static int hwstore_evict_addr(hwstore_t* hwstore, int addr);
+static void hwstore_unfree(hwstore_t* hwstore, int addr, hwcell_t* cell);
+static void hwstore_unlink_free(hwstore_t* hwstore, hwfentry_t* entry);
+static void hwstore_evict_cell(hwstore_t* hwstore, int prevpos, hwcell_t* prevcell, int pos, hwcell_t* cell);
+static int hwstore_cached(hwstore_t* hwstore, int pos, hwcell_t* cell);
+static void hwstore_touch(hwstore_t* hwstore, int pos);
+
+static int hwstore_find(hwstore_t* hwstore, char* key, int keysize, hwcell_t* currcell,
+                                hwscratch_t* scratch);
+static int hwstore_find_indexed(hwstore_t* hwstore, hwindex_t* hwindex, char* key, int keysize,
+                                hwcell_t* currcell, hwscratch_t* scratch);
+static void hwstore_index(hwstore_t* hwstore, char* key, int keysize, int addr);
+static void hwstore_unindex(hwstore_t* hwstore, int pos, hwcell_t* cell);
+static int hwstore_fetch(hwstore_t* hwstore, char* key, int keysize, char** val,
+                                char* buf, int bufsize, int* valsize);
+static int hwstore_txn_add(hwtxn_t* hwtxn, int op, char* key, int keysize, char* val, int valsize);
+static int hwstore_txn_last(hwtxn_t* hwtxn, int i);
+static int hwstore_addrcmp(const void* a, const void* b);
+static int hwstore_txn_shadowed(hwtxn_t* hwtxn, int* olds);
+static void hwstore_txn_cleanup(hwtxn_t* hwtxn, int* addrs, int placed, int* olds, int nolds);
+static int hwstore_expired(hwcell_t* cell, long now);
+static void hwstore_add_timer(hwstore_t* hwstore, int addr, long expire);
+
+static void hwstore_count(long* counter, long value);
+static void hwstore_count_live(hwstore_t* hwstore, hwcell_t* cell, int sign);
+static void hwstore_count_free(hwstore_t* hwstore, hwcell_t* cell, int sign);
+static void hwstore_opbegin(hwstore_t* hwstore, long* reads, long* writes);
+static void hwstore_opend(hwstore_t* hwstore, hwopstat_t* opstat, long reads, long writes);
+
+static void hwcell_init(hwcell_t* hwcell, int capa) {
+    hwcell->keysize = 0;
+    hwcell->valsize = 0;
+    hwcell->capa = capa;
+    hwcell->next = HWNULL;
+    hwcell->flags = 0;
+    hwcell->expire = 0;
+    hwcell->version = 0;
+    hwcell->retired = 0;
+    hwcell->datacrc = 0;
+    hwcell->crc = 0;
+}
 
-static int hwstore_find(hwstore_t* hwstore, char* key, int keysize, hwcell_t* currcell);
+static int hwcell_nchunks(int valsize) {
+    return (valsize + HWCHUNK_SIZE - 1) / HWCHUNK_SIZE;
+}
 
-static void hwcell_init(hwcell_t* hwcell, int keysize, int valsize) {
-    hwcell->keysize = keysize;
-    hwcell->valsize = valsize;
-    hwcell->capa = keysize + valsize;
-    hwcell->next = HWNULL;
+/* Bytes used in cell, chunked head keeps key and chunk table */
+static int hwcell_datasize(hwcell_t* hwcell) {
+    if ((hwcell->flags & HWCELL_CHUNKED) != 0) {
+        return hwcell->keysize + hwcell_nchunks(hwcell->valsize) * (int)sizeof(int);
+    }
+    return hwcell->keysize + hwcell->valsize;
+}
+
+/* Checksum of header fields before crc, datacrc among them */
+static unsigned int hwcell_crc(hwcell_t* hwcell) {
+    return hwcrc32c(0, hwcell, offsetof(hwcell_t, crc));
+}
+
+/* Check key and plain value as read by get, chunks are checked as they are read */
+static int hwcell_intact(hwcell_t* hwcell, char* key, char* val) {
+    if ((hwcell->flags & HWCELL_CHUNKED) != 0) return 1;
+    unsigned int crc = hwcrc32c(0, key, hwcell->keysize);
+    return hwcrc32c(crc, val, hwcell->valsize) == hwcell->datacrc;
 }
 
 void hwstore_init(hwstore_t* hwstore, hwmemory_t* hwmemory) {
@@ -49,62 +168,575 @@ void hwstore_init(hwstore_t* hwstore, hwmemory_t* hwmemory) {
     hwstore->head = HWNULL;
     hwstore->tail = HWNULL;
     hwstore->freehead = HWNULL;
+    hwstore->tailend = STOREHEAD_SIZE;
+    hwstore->freecapa = 0;
+    memset(&(hwstore->stats), 0, sizeof(hwstats_t));
+    hwstore->wheel = calloc(HWWHEEL_SLOTS, sizeof(hwslot_t));
+    hwstore->wheeltick = time(NULL);
+    hwstore->wheelpos = 0;
+    hwstore->hwcache = NULL;
+    hwstore->hwlog = NULL;
+    hwstore->evict = HWEVICT_NONE;
+    hwstore->hand = HWNULL;
+    memset(hwstore->extents, 0, sizeof(hwstore->extents));
+    hwstore->extents[0].hwmemory = hwmemory;
+    hwstore->nextents = 1;
+    hwstore->extsize = 0;
+    hwstore->version = 0;
+    hwstore->snaps = NULL;
+    hwstore->nsnaps = 0;
+    hwstore->snapcapa = 0;
+    hwstore->retires = NULL;
+    hwstore->nretires = 0;
+    hwstore->retirecapa = 0;
+    pthread_mutex_init(&(hwstore->wlock), NULL);
+    hwstore->seq = 0;
+    hwstore->epoch = 1;
+    memset(hwstore->readers, 0, sizeof(hwstore->readers));
+    hwstore->limbo = NULL;
+    hwstore->nlimbo = 0;
+    hwstore->limbocapa = 0;
+    hwstore->hot = calloc(HWHOT_SLOTS, 1);
+    hwstore->hwindex = NULL;
+    hwstore->indexepoch = 0;
+    hwstore->scratch.data = NULL;
+    hwstore->scratch.size = 0;
+    hwstore->scratch.grows = 0;
+    hwstore->scrubpos = HWNULL;
+    hwstore->hwfree = NULL;
+    hwstore->align = 1;
+}
+
+void hwstore_destroy(hwstore_t* hwstore) {
+    for (int i = 0; i < HWWHEEL_SLOTS; i++) {
+        free(hwstore->wheel[i].timers);
+    }
+    free(hwstore->wheel);
+    hwstore->wheel = NULL;
+    for (int i = 1; i < hwstore->nextents; i++) {
+        hwmemory_destroy(hwstore->extents[i].hwmemory);
+        free(hwstore->extents[i].hwmemory);
+    }
+    hwstore->nextents = 1;
+    free(hwstore->snaps);
+    free(hwstore->retires);
+    free(hwstore->limbo);
+    free(hwstore->hot);
+    free(hwstore->scratch.data);
+    for (int i = 0; i < HWREADER_SLOTS; i++) {
+        free(hwstore->readers[i].scratch.data);
+        hwstore->readers[i].scratch.data = NULL;
+        hwstore->readers[i].scratch.size = 0;
+        hwstore->readers[i].scratch.grows = 0;
+    }
+    hwstore->snaps = NULL;
+    hwstore->retires = NULL;
+    hwstore->limbo = NULL;
+    hwstore->hot = NULL;
+    hwstore->scratch.data = NULL;
+    hwstore->scratch.size = 0;
+    hwstore->scratch.grows = 0;
+    if (hwstore->hwindex != NULL) {
+        hwindex_destroy(hwstore->hwindex);
+        free(hwstore->hwindex);
+        hwstore->hwindex = NULL;
+    }
+    if (hwstore->hwfree != NULL) {
+        hwfree_destroy(hwstore->hwfree);
+        free(hwstore->hwfree);
+        hwstore->hwfree = NULL;
+    }
+    pthread_mutex_destroy(&(hwstore->wlock));
+}
+
+/* Cache must be empty or filled from this store, NULL detaches it */
+void hwstore_setcache(hwstore_t* hwstore, hwcache_t* hwcache) {
+    hwstore->hwcache = hwcache;
+}
+
+/* Record every set, del, commit and TTL change to log, NULL detaches it */
+void hwstore_setlog(hwstore_t* hwstore, hwlog_t* hwlog) {
+    hwstore_wlock(hwstore);
+    hwstore->hwlog = hwlog;
+    hwstore_wunlock(hwstore);
+}
+
+/* Grow by new RAM extents of extsize bytes when tail is out of space */
+int hwstore_setgrow(hwstore_t* hwstore, int extsize) {
+    if (extsize < 0 || extsize >= HWEXTENT_SIZE) return -1;
+    /* Addresses of bigger first device would clash with extent bits */
+    if (extsize > 0 && hwstore->size >= HWEXTENT_SIZE) return -1;
+    hwstore->extsize = extsize;
+    return 0;
+}
+
+/*
+ * Keep RAM index of keys, lookups probe it instead of walking used
+ * chain. Index is built from current chain, disabling waits for gets
+ * which may still probe it.
+ */
+int hwstore_setindex(hwstore_t* hwstore, int enable) {
+    hwstore_wlock(hwstore);
+    hwindex_t* hwindex = hwstore->hwindex;
+    if (enable && hwindex == NULL) {
+        hwindex = malloc(sizeof(hwindex_t));
+        hwindex_init(hwindex, hwstore->stats.usedchain);
+        int currpos = hwstore->head;
+        while (currpos != HWNULL) {
+            hwcell_t currcell;
+            hwstore_read_chead(hwstore, currpos, &currcell);
+            if ((currcell.flags & HWCELL_RETIRED) == 0) {
+                char* key = hwstore_read_skey(hwstore, currpos, &currcell, &(hwstore->scratch));
+                hwindex_insert(hwindex, hwindex_hash(key, currcell.keysize), currpos);
+            }
+            currpos = currcell.next;
+        }
+        hwindex_reclaim(hwindex);
+        __atomic_store_n(&(hwstore->hwindex), hwindex, __ATOMIC_RELEASE);
+        hwindex = NULL;
+    } else if (!enable && hwindex != NULL) {
+        __atomic_store_n(&(hwstore->hwindex), NULL, __ATOMIC_RELEASE);
+    } else {
+        hwindex = NULL;
+    }
+    unsigned long epoch = __atomic_load_n(&(hwstore->epoch), __ATOMIC_SEQ_CST);
+    hwstore_wunlock(hwstore);
+
+    if (hwindex != NULL) {
+        while (hwstore_rblocked(hwstore, epoch)) sched_yield();
+        hwindex_destroy(hwindex);
+        free(hwindex);
+    }
+    return 0;
+}
+
+/*
+ * Write-behind for every extent: writes wait only while limit bytes
+ * are buffered, 0 writes through again. Store must be idle meanwhile.
+ */
+int hwstore_setbehind(hwstore_t* hwstore, long limit) {
+    if (limit < 0) return -1;
+    for (int i = 0; i < hwstore->nextents; i++) {
+        if (hwmemory_setbehind(hwstore->extents[i].hwmemory, limit) < 0) return -1;
+    }
+    return 0;
+}
+
+/* Barrier, writes of completed operations are on device after it */
+void hwstore_sync(hwstore_t* hwstore) {
+    int nextents = __atomic_load_n(&(hwstore->nextents), __ATOMIC_ACQUIRE);
+    for (int i = 0; i < nextents; i++) {
+        hwmemory_sync(hwstore->extents[i].hwmemory);
+    }
+}
+
+/*
+ * Keep free cells in RAM map beside free chain, so allocation needs no
+ * walk of the chain. The chain on device stays whole, the map is only
+ * its copy in RAM, built by one sequential read of all cells.
+ */
+int hwstore_setfreemap(hwstore_t* hwstore, int enable) {
+    hwstore_wlock(hwstore);
+    if (enable && hwstore->hwfree == NULL) {
+        hwfree_t* hwfree = malloc(sizeof(hwfree_t));
+        hwfree_init(hwfree);
+        hwstore_freemap_build(hwstore, hwfree);
+        hwstore->hwfree = hwfree;
+    } else if (!enable && hwstore->hwfree != NULL) {
+        hwfree_destroy(hwstore->hwfree);
+        free(hwstore->hwfree);
+        hwstore->hwfree = NULL;
+    }
+    hwstore_wunlock(hwstore);
+    return 0;
+}
+
+/*
+ * Cells of an extent lie one after other from its start, each one byte
+ * past end of previous. Only headers matter here, so a read piece
+ * ending inside a cell is fine, next piece starts at next header.
+ * Chain order comes from next links of free headers.
+ */
+static void hwstore_freemap_build(hwstore_t* hwstore, hwfree_t* hwfree) {
+    for (int extent = 0; extent < hwstore->nextents; extent++) {
+        int pos = hwstore_firstcell(hwstore, extent);
+        int tailend = *hwstore_tailend(hwstore, pos);
+        while (pos + CELLHEAD_SIZE <= tailend) {
+            int size = tailend - pos < HWSCRUB_READ ? tailend - pos : HWSCRUB_READ;
+            char* data = hwscratch_get(&(hwstore->scratch), size);
+            hwstore_dread(hwstore, pos, data, size);
+            int offset = 0;
+            while (offset + CELLHEAD_SIZE <= size) {
+                hwcell_t cell;
+                memcpy(&cell, data + offset, CELLHEAD_SIZE);
+                if ((cell.flags & HWCELL_FREE) != 0) {
+                    hwfree_put(hwfree, pos + offset, cell.capa, cell.next);
+                }
+                offset += CELLHEAD_SIZE + cell.capa + 1;
+            }
+            pos += offset;
+        }
+    }
+    hwfree_link(hwfree);
+}
+
+/*
+ * Align cell starts to align bytes, a power of two. Capacity of each
+ * new cell is rounded so next cell starts aligned too. Headers must
+ * never cross a device block: align has to hold a header and divide
+ * block size or be its multiple, and block has to hold a header too.
+ * Block of 1 is byte addressed memory, with no blocks to cross. Only
+ * empty store can change alignment.
+ */
+int hwstore_setalign(hwstore_t* hwstore, int align) {
+    if (align < 1 || align > HWALIGN_MAX || (align & (align - 1)) != 0) return -1;
+    if (hwstore->tail != HWNULL || hwstore->nextents != 1) return -1;
+    if (align > 1) {
+        hwcost_t cost;
+        hwmemory_getcost(hwstore->hwmemory, &cost);
+        if (align < CELLHEAD_SIZE) return -1;
+        if (cost.block > 1 && (cost.block < CELLHEAD_SIZE
+            || (cost.block % align != 0 && align % cost.block != 0))) return -1;
+    }
+    hwstore->align = align;
+    hwstore->tailend = hwstore_firstcell(hwstore, 0);
+    hwstore->stats.padbytes = hwstore->tailend - STOREHEAD_SIZE;
+    return 0;
+}
+
+static int hwstore_alignup(hwstore_t* hwstore, int size) {
+    return (size + hwstore->align - 1) & ~(hwstore->align - 1);
+}
+
+/* Capacity for datasize bytes, cell with its gap byte fills whole units */
+static int hwstore_cellcapa(hwstore_t* hwstore, int datasize) {
+    return hwstore_alignup(hwstore, CELLHEAD_SIZE + datasize + 1) - CELLHEAD_SIZE - 1;
+}
+
+static int hwstore_firstcell(hwstore_t* hwstore, int extent) {
+    if (extent == 0) return hwstore_alignup(hwstore, STOREHEAD_SIZE);
+    return HWADDR(extent, hwstore_alignup(hwstore, 1));
+}
+
+int hwstore_setevict(hwstore_t* hwstore, int evict) {
+    if (evict != HWEVICT_NONE && evict != HWEVICT_CLOCK) return -1;
+    hwstore->evict = evict;
+    hwstore->hand = HWNULL;
+    return 0;
+}
+
+static void hwstore_count(long* counter, long value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+/* Counters of cell becoming live or leaving live set, sign is 1 or -1 */
+static void hwstore_count_live(hwstore_t* hwstore, hwcell_t* cell, int sign) {
+    int datasize = hwcell_datasize(cell);
+    hwstore_count(&(hwstore->stats.livecells), sign);
+    if ((cell->flags & HWCELL_CHUNK) != 0) {
+        hwstore_count(&(hwstore->stats.chunkcells), sign);
+    } else {
+        hwstore_count(&(hwstore->stats.usedchain), sign);
+    }
+    hwstore_count(&(hwstore->stats.livebytes), sign * datasize);
+    hwstore_count(&(hwstore->stats.wastedbytes), sign * (cell->capa - datasize));
+}
+
+/* Counters of cell entering or leaving free chain */
+static void hwstore_count_free(hwstore_t* hwstore, hwcell_t* cell, int sign) {
+    hwstore_count(&(hwstore->stats.freecells), sign);
+    hwstore_count(&(hwstore->stats.freechain), sign);
+    hwstore_count(&(hwstore->freecapa), sign * cell->capa);
+}
+
+/* Device calls of calling thread, so other threads do not count to op */
+static void hwstore_iocalls(hwstore_t* hwstore, long* reads, long* writes) {
+    hwiostat_t iostat;
+    hwmemory_tiostat(&iostat);
+    *reads = iostat.rcalls;
+    *writes = iostat.wcalls;
+}
+
+static void hwstore_opbegin(hwstore_t* hwstore, long* reads, long* writes) {
+    hwstore_iocalls(hwstore, reads, writes);
+}
+
+static void hwstore_opend(hwstore_t* hwstore, hwopstat_t* opstat, long reads, long writes) {
+    long endreads, endwrites;
+    hwstore_iocalls(hwstore, &endreads, &endwrites);
+    hwstore_count(&(opstat->count), 1);
+    hwstore_count(&(opstat->reads), endreads - reads);
+    hwstore_count(&(opstat->writes), endwrites - writes);
+}
+
+/* Device transfer counters summed over extents */
+void hwstore_iostat(hwstore_t* hwstore, hwiostat_t* iostat) {
+    memset(iostat, 0, sizeof(hwiostat_t));
+    for (int i = 0; i < hwstore->nextents; i++) {
+        hwiostat_t extstat;
+        hwmemory_iostat(hwstore->extents[i].hwmemory, &extstat);
+        iostat->rcalls += extstat.rcalls;
+        iostat->rbytes += extstat.rbytes;
+        iostat->rnsec += extstat.rnsec;
+        iostat->wcalls += extstat.wcalls;
+        iostat->wbytes += extstat.wbytes;
+        iostat->wnsec += extstat.wnsec;
+    }
+}
+
+static hwmemory_t* hwstore_device(hwstore_t* hwstore, int addr, int* offset) {
+    if (hwstore->nextents == 1) {
+        *offset = addr;
+        return hwstore->hwmemory;
+    }
+    *offset = HWADDR_OFFSET(addr);
+    return hwstore->extents[HWADDR_EXTENT(addr)].hwmemory;
+}
+
+/* Cells never cross extent bound, one transfer touches one device */
+static void hwstore_dread(hwstore_t* hwstore, int addr, void* data, int size) {
+    int offset;
+    hwmemory_t* hwmemory = hwstore_device(hwstore, addr, &offset);
+    hwmemory_read(hwmemory, offset, data, size);
+}
+
+static void hwstore_dwrite(hwstore_t* hwstore, int addr, void* data, int size) {
+    int offset;
+    hwmemory_t* hwmemory = hwstore_device(hwstore, addr, &offset);
+    hwmemory_write(hwmemory, offset, data, size);
+}
+
+static void hwstore_dwritev(hwstore_t* hwstore, int addr, struct iovec* iov, int iovcnt) {
+    int offset;
+    hwmemory_t* hwmemory = hwstore_device(hwstore, addr, &offset);
+    hwmemory_writev(hwmemory, offset, iov, iovcnt);
+}
+
+static void hwstore_dreadv(hwstore_t* hwstore, int addr, struct iovec* iov, int iovcnt) {
+    int offset;
+    hwmemory_t* hwmemory = hwstore_device(hwstore, addr, &offset);
+    hwmemory_readv(hwmemory, offset, iov, iovcnt);
+}
+
+/* Whether size bytes from addr lie within cells of an extent */
+static int hwstore_inside(hwstore_t* hwstore, int addr, int size) {
+    if (addr <= 0 || size < 0) return 0;
+    int extent = hwstore->nextents == 1 ? 0 : HWADDR_EXTENT(addr);
+    if (extent >= hwstore->nextents) return 0;
+    if (addr < hwstore_firstcell(hwstore, extent)) return 0;
+    return addr + size <= *hwstore_tailend(hwstore, addr);
+}
+
+/* Tail bound of extent holding addr, last extent keeps it in store */
+static int* hwstore_tailend(hwstore_t* hwstore, int addr) {
+    int extent = hwstore->nextents == 1 ? 0 : HWADDR_EXTENT(addr);
+    if (extent == hwstore->nextents - 1) return &(hwstore->tailend);
+    return &(hwstore->extents[extent].tailend);
+}
+
+/*
+ * Add RAM extent with cost and banks of first device. Old extents are
+ * not touched, their tail space stays for merges.
+ */
+static int hwstore_grow(hwstore_t* hwstore, int need) {
+    if (hwstore->extsize == 0 || hwstore->nextents == HWEXTENT_MAX) return -1;
+    if (need + 1 >= hwstore->extsize) return -1;
+
+    hwmemory_t* first = hwstore->hwmemory;
+    hwmemory_t* hwmemory = malloc(sizeof(hwmemory_t));
+    hwmemory_init(hwmemory, hwstore->extsize);
+    hwmemory_setcost(hwmemory, &(first->cost));
+    hwmemory_setbanks(hwmemory, first->nbanks, first->stripe);
+    if (first->behind != NULL) {
+        hwmemory_setbehind(hwmemory, first->behind->limit);
+    }
+
+    int extent = hwstore->nextents;
+    hwstore->extents[extent - 1].tailend = hwstore->tailend;
+    hwstore->extents[extent].hwmemory = hwmemory;
+    hwstore->nextents++;
+    hwstore->tailend = hwstore_firstcell(hwstore, extent) - 1;
+    hwstore_count(&(hwstore->stats.padbytes), hwstore_alignup(hwstore, 1) - 1);
+    return extent;
 }
 
 static void hwstore_read_chead(hwstore_t* hwstore, int pos, hwcell_t *cell) {
-    hwmemory_read(hwstore->hwmemory, pos, cell, CELLHEAD_SIZE);
+    hwstore_dread(hwstore, pos, cell, CELLHEAD_SIZE);
 }
 
-static void hwstore_read_cell(hwstore_t* hwstore, int pos, hwcell_t *cell, char** key, char** val) {
-    hwmemory_read(hwstore->hwmemory, pos, cell, CELLHEAD_SIZE);
-    pos += CELLHEAD_SIZE;
-    *key = malloc(cell->keysize);
-    *val = malloc(cell->valsize);
-    hwmemory_read(hwstore->hwmemory, pos, *key, cell->keysize);
-    pos += cell->keysize;
-    hwmemory_read(hwstore->hwmemory, pos, *val, cell->valsize);
+/*
+ * Header to cell, key and value to scratch one after other. Key and
+ * plain value follow each other on device, they come in one read.
+ */
+static char* hwstore_read_cell(hwstore_t* hwstore, int pos, hwcell_t *cell, hwscratch_t* scratch) {
+    hwstore_dread(hwstore, pos, cell, CELLHEAD_SIZE);
+    char* data = hwscratch_get(scratch, cell->keysize + cell->valsize);
+    if ((cell->flags & HWCELL_CHUNKED) != 0) {
+        hwstore_dread(hwstore, pos + CELLHEAD_SIZE, data, cell->keysize);
+        hwstore_read_valbuf(hwstore, pos, cell, data, data + cell->keysize);
+        return data;
+    }
+    hwstore_dread(hwstore, pos + CELLHEAD_SIZE, data, cell->keysize + cell->valsize);
+    return data;
 }
 
-static void hwstore_read_ckey(hwstore_t* hwstore, int pos, hwcell_t *cell, char** key) {
-    //hwmemory_read(hwstore->hwmemory, pos, cell, CELLHEAD_SIZE);
-    pos += CELLHEAD_SIZE;
-    *key = malloc(cell->keysize);
-    hwmemory_read(hwstore->hwmemory, pos, *key, cell->keysize);
+/* Key to scratch, valid until next use of scratch */
+static char* hwstore_read_skey(hwstore_t* hwstore, int pos, hwcell_t *cell, hwscratch_t* scratch) {
+    char* key = hwscratch_get(scratch, cell->keysize);
+    hwstore_dread(hwstore, pos + CELLHEAD_SIZE, key, cell->keysize);
+    return key;
+}
+
+/* Grows only for larger size, so steady walks make no heap calls */
+static char* hwscratch_get(hwscratch_t* scratch, int size) {
+    if (size > scratch->size) {
+        scratch->size = (size + 63) & ~63;
+        scratch->data = realloc(scratch->data, scratch->size);
+        __atomic_store_n(&(scratch->grows), scratch->grows + 1, __ATOMIC_RELAXED);
+    }
+    return scratch->data;
 }
 
 static void hwstore_read_cval(hwstore_t* hwstore, int pos, hwcell_t *cell, char** val) {
-    //hwmemory_read(hwstore->hwmemory, pos, cell, CELLHEAD_SIZE);
     pos += CELLHEAD_SIZE;
     pos += cell->keysize;
     *val = malloc(cell->valsize);
-    hwmemory_read(hwstore->hwmemory, pos, *val, cell->valsize);
+    hwstore_dread(hwstore, pos, *val, cell->valsize);
+}
+
+/*
+ * Read value of cell. Chunk table of chunked cell gives all chunk
+ * addresses at once, so chunk reads are issued together on model
+ * timeline and overlap on different banks. Returns -1 and frees value
+ * if a chunk is corrupt.
+ */
+static int hwstore_read_value(hwstore_t* hwstore, int pos, hwcell_t *cell, char* key, char** val) {
+    if ((cell->flags & HWCELL_CHUNKED) == 0) {
+        hwstore_read_cval(hwstore, pos, cell, val);
+        return 0;
+    }
+    *val = malloc(cell->valsize);
+    if (hwstore_read_valbuf(hwstore, pos, cell, key, *val) < 0) {
+        free(*val);
+        *val = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Read value to buffer of valsize bytes, small chunk tables stay on stack.
+ * Chunk table is checked against key before its addresses are followed,
+ * each chunk comes with its header and is checked against it. Returns -1
+ * on corrupt table or chunk.
+ */
+static int hwstore_read_valbuf(hwstore_t* hwstore, int pos, hwcell_t *cell, char* key, char* buf) {
+    if ((cell->flags & HWCELL_CHUNKED) == 0) {
+        hwstore_dread(hwstore, pos + CELLHEAD_SIZE + cell->keysize, buf, cell->valsize);
+        return 0;
+    }
+    int nchunks = hwcell_nchunks(cell->valsize);
+    int tablesize = nchunks * sizeof(int);
+    if (nchunks <= 0 || !hwstore_inside(hwstore, pos, CELLHEAD_SIZE + cell->keysize + tablesize)) {
+        return -1;
+    }
+    int stacktable[HWCHUNK_STACK];
+    int* table = nchunks <= HWCHUNK_STACK ? stacktable : malloc(tablesize);
+    hwstore_dread(hwstore, pos + CELLHEAD_SIZE + cell->keysize, table, tablesize);
+    int res = hwcrc32c(hwcrc32c(0, key, cell->keysize), table, tablesize) == cell->datacrc ? 0 : -1;
+
+    long issue = hwmemory_tclock();
+    long done = issue;
+    for (int i = 0; i < nchunks && res == 0; i++) {
+        int offset = i * HWCHUNK_SIZE;
+        int size = cell->valsize - offset < HWCHUNK_SIZE ? cell->valsize - offset : HWCHUNK_SIZE;
+        if (!hwstore_inside(hwstore, table[i], CELLHEAD_SIZE + size)) {
+            res = -1;
+            break;
+        }
+        hwcell_t chunkcell;
+        struct iovec iov[2];
+        iov[0].iov_base = &chunkcell;
+        iov[0].iov_len = CELLHEAD_SIZE;
+        iov[1].iov_base = buf + offset;
+        iov[1].iov_len = size;
+        hwmemory_tset(issue);
+        hwstore_dreadv(hwstore, table[i], iov, 2);
+        if (hwmemory_tclock() > done) done = hwmemory_tclock();
+        if (chunkcell.crc != hwcell_crc(&chunkcell) || (chunkcell.flags & HWCELL_CHUNK) == 0
+            || chunkcell.next != pos || chunkcell.valsize != size
+            || chunkcell.datacrc != hwcrc32c(0, buf + offset, size)) {
+            res = -1;
+        }
+    }
+    hwmemory_tset(done);
+    if (table != stacktable) free(table);
+    return res;
 }
 
 
+/* Header, key and value go to device in one write, with checksums */
 static void hwstore_write_cell(hwstore_t* hwstore, int pos, hwcell_t *cell, char* key, char* val) {
-    hwmemory_write(hwstore->hwmemory, pos, cell, CELLHEAD_SIZE);
-    pos += CELLHEAD_SIZE;
-    hwmemory_write(hwstore->hwmemory, pos, key, cell->keysize);
-    pos += cell->keysize;
-    hwmemory_write(hwstore->hwmemory, pos, val, cell->valsize);
+    int valsize = hwcell_datasize(cell) - cell->keysize;
+    cell->datacrc = hwcrc32c(hwcrc32c(0, key, cell->keysize), val, valsize);
+    cell->crc = hwcell_crc(cell);
+    struct iovec iov[3];
+    iov[0].iov_base = cell;
+    iov[0].iov_len = CELLHEAD_SIZE;
+    iov[1].iov_base = key;
+    iov[1].iov_len = cell->keysize;
+    /* Value of chunked cell is its chunk table, tombstone has none */
+    iov[2].iov_base = val;
+    iov[2].iov_len = valsize;
+    hwstore_dwritev(hwstore, pos, iov, valsize > 0 ? 3 : 2);
 }
 
+/* Header alone changes, key and value keep their checksum */
 static void hwstore_write_chead(hwstore_t* hwstore, int pos, hwcell_t *cell) {
-    hwmemory_write(hwstore->hwmemory, pos, cell, CELLHEAD_SIZE);
+    cell->crc = hwcell_crc(cell);
+    hwstore_dwrite(hwstore, pos, cell, CELLHEAD_SIZE);
 }
 
 static void hwstore_write_shead(hwstore_t* hwstore) {
-    hwstore_t chwstore = *hwstore;
-    chwstore.magic = STORE_MAGIC;
-    hwmemory_write(hwstore->hwmemory, 0, &chwstore, STOREHEAD_SIZE);
+    hwshead_t shead;
+    shead.magic = STORE_MAGIC;
+    shead.reserved = 0;
+    shead.size = hwstore->size;
+    shead.head = hwstore->head;
+    shead.tail = hwstore->tail;
+    shead.freehead = hwstore->freehead;
+    hwstore_dwrite(hwstore, 0, &shead, STOREHEAD_SIZE);
+}
+
+/* First cell of empty store goes right after store header */
+static int hwstore_take_head(hwstore_t* hwstore, int datasize, hwcell_t* cell) {
+    int headpos = hwstore_firstcell(hwstore, 0);
+    if (hwstore->tailend != headpos || hwstore->nextents != 1) return -1;
+
+    int capa = hwstore_cellcapa(hwstore, datasize);
+    if (headpos + CELLHEAD_SIZE + capa >= hwstore->size) return -1;
+    hwcell_init(cell, capa);
+    hwstore_count(&(hwstore->stats.padbytes), capa - datasize);
+    hwstore->tail = headpos;
+    hwstore->tailend = headpos + CELLHEAD_SIZE + capa;
+    return headpos;
 }
 
-static int hwstore_trywrite_tofree(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize) {
+/* Take first fit from free chain */
+static int hwstore_take_free(hwstore_t* hwstore, int datasize, hwcell_t* cell) {
+    if (hwstore->hwfree != NULL) {
+        hwfentry_t entry;
+        int pos = hwfree_take(hwstore->hwfree, datasize, &entry);
+        if (pos < 0) return -1;
+        hwstore_unlink_free(hwstore, &entry);
+        hwcell_init(cell, entry.capa);
+        hwstore_count_free(hwstore, cell, -1);
+        return pos;
+    }
+
     /* Check free chain */
     if (hwstore->freehead == HWNULL) return -1;
 
-    int datasize = keysize + valsize;
-
     hwcell_t freecell;
     int freepos = hwstore->freehead;
     hwstore_read_chead(hwstore, freepos, &freecell);
@@ -112,13 +744,8 @@ static int hwstore_trywrite_tofree(hwstore_t* hwstore, char* key, int keysize, c
     if (freecell.capa >= datasize) {
         /* Delete cell from free chain */
         hwstore->freehead = freecell.next;
-        /* Insert cell to chain */
-        freecell.next = hwstore->head;
-        hwstore->head = freepos;
-
-        hwstore_write_cell(hwstore, freepos, &freecell, key, val);
-        hwstore_write_shead(hwstore);
-
+        hwstore_count_free(hwstore, &freecell, -1);
+        hwcell_init(cell, freecell.capa);
         return freepos;
     }
 
@@ -132,244 +759,1744 @@ static int hwstore_trywrite_tofree(hwstore_t* hwstore, char* key, int keysize, c
             /* Delete free cell from chain */
             freecell.next = nextcell.next;
             hwstore_write_chead(hwstore, freepos, &freecell);
-
-            /* Insert next cell to used chain */
-            nextcell.next = hwstore->head;
-            hwstore_write_cell(hwstore, nextpos, &nextcell, key, val);
-
-            hwstore->head = nextpos;
-            hwstore_write_shead(hwstore);
-
-            return freepos;
+            hwstore_count_free(hwstore, &nextcell, -1);
+            hwcell_init(cell, nextcell.capa);
+            return nextpos;
         }
 
-        hwstore_read_chead(hwstore, freepos, &freecell);
-        freepos = freecell.next;
-    }
-    return -1;
-
-}
-
-static int hwstore_trywrite_tohead(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize) {
-
-    /* Check null store head */
-    if (hwstore->head == HWNULL) {
-        hwcell_t headcell;
-        hwcell_init(&headcell, keysize, valsize);
-
-        /* Write new cell */
-        int headpos = 0 + STOREHEAD_SIZE;
-        hwstore_write_cell(hwstore, headpos, &headcell, key, val);
-
-        /* Update store descriptor */
-        hwstore->head = headpos;
-        hwstore->tail = headpos;
-        hwstore->freehead = HWNULL;
-        hwstore_write_shead(hwstore);
-        return headpos;
+        /* Step to next free cell */
+        freepos = nextpos;
+        freecell = nextcell;
     }
     return -1;
 }
 
-static int hwstore_trywrite_totail(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize) {
-    /* Check tail space */
-    int datasize = keysize + valsize;
-
-    /* Read tail call from device */
-    hwcell_t tailcell;
-    int tailpos = hwstore->tail;
-    hwstore_read_chead(hwstore, tailpos, &tailcell);
-
+static int hwstore_take_tail(hwstore_t* hwstore, int datasize, hwcell_t* cell) {
     /* Calculate exists and future bound of cells */
-    int tailend = hwstore->tail + CELLHEAD_SIZE + tailcell.capa;
-    int nextend = tailend + CELLHEAD_SIZE + datasize;
-
-    /* Compare future bound and size of device */
-    if (nextend < hwstore->size) {
-        hwcell_t nextcell;
-        hwcell_init(&nextcell, keysize, valsize);
-
-        /* Write new tail cell */
+    int tailend = hwstore->tailend;
+    int offset;
+    hwmemory_t* hwmemory = hwstore_device(hwstore, tailend, &offset);
+    int extsize = hwmemory_size(hwmemory);
+    int capa = hwstore_cellcapa(hwstore, datasize);
+
+    /* Compare future bound and size of device, grow if it is out */
+    if (offset + CELLHEAD_SIZE + capa >= extsize
+        && hwstore_grow(hwstore, hwstore_alignup(hwstore, 1) - 1 + CELLHEAD_SIZE + capa) > 0) {
+        tailend = hwstore->tailend;
+        offset = HWADDR_OFFSET(tailend);
+        extsize = hwstore->extsize;
+    }
+    if (offset + CELLHEAD_SIZE + capa < extsize) {
         int nextpos = tailend + 1;
-        hwstore_write_cell(hwstore, nextpos, &nextcell, key, val);
-
-        /* Update old tail cell */
-        tailcell.next = nextpos;
-        hwstore_write_chead(hwstore, tailpos, &tailcell);
-
-        /* Update store descriptor */
+        hwcell_init(cell, capa);
+        hwstore_count(&(hwstore->stats.padbytes), capa - datasize);
         hwstore->tail = nextpos;
-        hwstore_write_shead(hwstore);
+        hwstore->tailend = nextpos + CELLHEAD_SIZE + capa;
         return nextpos;
     }
-
     return -1;
 }
 
-static int hwstore_alloc(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize) {
+/*
+ * Take space for datasize bytes off free chain, tail or by eviction.
+ * Returned cell is in no chain and its header is not written yet.
+ */
+static int hwstore_take(hwstore_t* hwstore, int datasize, hwcell_t* cell) {
     int addr = -1;
 
-    if ((addr = hwstore_trywrite_tohead(hwstore, key, keysize, val, valsize)) > 0) {
+    if ((addr = hwstore_take_head(hwstore, datasize, cell)) > 0) {
+        hwstore_count(&(hwstore->stats.headhits), 1);
         return addr;
     }
 
-    if ((addr = hwstore_trywrite_tofree(hwstore, key, keysize, val, valsize)) > 0) {
+    if ((addr = hwstore_take_free(hwstore, datasize, cell)) > 0) {
+        hwstore_count(&(hwstore->stats.freehits), 1);
         return addr;
     }
 
-    if ((addr = hwstore_trywrite_totail(hwstore, key, keysize, val, valsize)) > 0) {
+    if ((addr = hwstore_take_tail(hwstore, datasize, cell)) > 0) {
+        hwstore_count(&(hwstore->stats.tailhits), 1);
         return addr;
     }
 
+    /* Cells left by readers since last write */
+    if (hwstore->nlimbo > 0) {
+        hwstore_drain(hwstore);
+        if ((addr = hwstore_take_free(hwstore, datasize, cell)) > 0) {
+            hwstore_count(&(hwstore->stats.freehits), 1);
+            return addr;
+        }
+    }
+
+    /* Evicted cell is on free head and fits, snapshots pin all cells */
+    if (hwstore->evict == HWEVICT_CLOCK && hwstore->nsnaps == 0 && (hwstore_evict(hwstore, datasize) > 0
+        || hwstore_evict_merge(hwstore, datasize) > 0)) {
+        if ((addr = hwstore_take_free(hwstore, datasize, cell)) > 0) {
+            hwstore_count(&(hwstore->stats.freehits), 1);
+            return addr;
+        }
+    }
+
+    hwstore_count(&(hwstore->stats.allocfails), 1);
+    return -1;
+}
+
+/*
+ * Insert cell to free head, stale timers see no expiry. Free header
+ * holds capacity and link only, so free map can rewrite it from RAM.
+ */
+static void hwstore_putfree(hwstore_t* hwstore, int pos, hwcell_t* cell) {
+    hwcell_init(cell, cell->capa);
+    cell->flags = HWCELL_FREE;
+    cell->next = hwstore->freehead;
+    if (hwstore->hwfree != NULL) {
+        hwfree_put(hwstore->hwfree, pos, cell->capa, hwstore->freehead);
+    }
+    hwstore->freehead = pos;
+    hwstore_write_chead(hwstore, pos, cell);
+    hwstore_count_free(hwstore, cell, 1);
+}
+
+static void hwstore_write_free(hwstore_t* hwstore, int pos, int capa, int next) {
+    hwcell_t cell;
+    hwcell_init(&cell, capa);
+    cell.flags = HWCELL_FREE;
+    cell.next = next;
+    hwstore_write_chead(hwstore, pos, &cell);
+}
+
+/* Capacity of free cell changed by merge, move it to its new bucket */
+static void hwstore_refree(hwstore_t* hwstore, int pos, int capa) {
+    if (hwstore->hwfree != NULL) {
+        hwfree_resize(hwstore->hwfree, pos, capa);
+    }
+}
+
+/* Place cell and insert it to used chain head */
+static int hwstore_alloc(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize) {
+    hwcell_t cell;
+    int addr = hwstore_place(hwstore, key, keysize, val, valsize, 0, &(hwstore->head), &cell);
+    if (addr < 0) return -1;
+    hwstore->head = addr;
+    hwstore_write_shead(hwstore);
+    hwstore_index(hwstore, key, keysize, addr);
     return addr;
 }
 
-static void hwstore_free(hwstore_t* hwstore, int addr) {
+/*
+ * Take space for key and value and write cell with given flags. Link to
+ * next cell is read after space is taken, as taking may evict cells.
+ * Cell is counted live but is in used chain only after caller publishes
+ * it through store head or link of other cell.
+ */
+static int hwstore_place(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize,
+                                int flags, int* next, hwcell_t* cell) {
+    if (valsize > HWCHUNK_SIZE) {
+        return hwstore_place_chunked(hwstore, key, keysize, val, valsize, flags, next, cell);
+    }
 
-    if (hwstore->head == HWNULL) return;
+    int addr = hwstore_take(hwstore, keysize + valsize, cell);
+    if (addr < 0) return -1;
+    cell->keysize = keysize;
+    cell->valsize = valsize;
+    cell->flags = flags;
+    cell->version = hwstore->version;
+    cell->retired = 0;
+    cell->next = *next;
+    hwstore_write_cell(hwstore, addr, cell, key, val);
+    hwstore_count_live(hwstore, cell, 1);
+    return addr;
+}
 
-    /* Check head for address */
-    int headpos = hwstore->head;
-    if (headpos == addr) {
-        hwcell_t headcell;
-        hwstore_read_chead(hwstore, headpos, &headcell);
+/*
+ * Large value goes to HWCHUNK_SIZE chunk cells, which fit fragmented
+ * free space. Head cell in used chain keeps key and table of chunk
+ * addresses, chunk cells are in no chain and point back to head.
+ */
+static int hwstore_place_chunked(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize,
+                                int flags, int* next, hwcell_t* headcell) {
+    int nchunks = hwcell_nchunks(valsize);
+    int* table = malloc(nchunks * sizeof(int));
+
+    int headpos = hwstore_take(hwstore, keysize + nchunks * (int)sizeof(int), headcell);
+    if (headpos < 0) {
+        free(table);
+        return -1;
+    }
+    headcell->keysize = keysize;
+    headcell->valsize = valsize;
+    headcell->flags = flags | HWCELL_CHUNKED;
+    headcell->version = hwstore->version;
+    headcell->retired = 0;
+    /* Head is not free nor in used chain, merges keep off it */
+    hwstore_write_chead(hwstore, headpos, headcell);
+
+    for (int i = 0; i < nchunks; i++) {
+        int offset = i * HWCHUNK_SIZE;
+        int size = valsize - offset < HWCHUNK_SIZE ? valsize - offset : HWCHUNK_SIZE;
+
+        hwcell_t chunkcell;
+        int chunkpos = hwstore_take(hwstore, size, &chunkcell);
+        if (chunkpos < 0) {
+            hwstore_free_chunks(hwstore, table, i);
+            hwstore_putfree(hwstore, headpos, headcell);
+            hwstore_write_shead(hwstore);
+            free(table);
+            return -1;
+        }
+        chunkcell.valsize = size;
+        chunkcell.flags = HWCELL_CHUNK;
+        chunkcell.version = hwstore->version;
+        chunkcell.retired = 0;
+        chunkcell.next = headpos;
+        chunkcell.datacrc = hwcrc32c(0, val + offset, size);
+        chunkcell.crc = hwcell_crc(&chunkcell);
+        struct iovec iov[2];
+        iov[0].iov_base = &chunkcell;
+        iov[0].iov_len = CELLHEAD_SIZE;
+        iov[1].iov_base = val + offset;
+        iov[1].iov_len = size;
+        hwstore_dwritev(hwstore, chunkpos, iov, 2);
+        hwstore_count_live(hwstore, &chunkcell, 1);
+
+        table[i] = chunkpos;
+    }
 
-        /* Delete cell from used head */
-        hwstore->head = headcell.next;
+    headcell->next = *next;
+    hwstore_write_cell(hwstore, headpos, headcell, key, (char*)table);
+    hwstore_count_live(hwstore, headcell, 1);
+    free(table);
+    return headpos;
+}
 
-        /* Insert cell to free head */
-        headcell.next = hwstore->freehead;
-        hwstore->freehead = headpos;
+static void hwstore_free_chunks(hwstore_t* hwstore, int* table, int count) {
+    for (int i = 0; i < count; i++) {
+        hwcell_t chunkcell;
+        hwstore_read_chead(hwstore, table[i], &chunkcell);
+        hwstore_count_live(hwstore, &chunkcell, -1);
+        hwstore_putfree(hwstore, table[i], &chunkcell);
+    }
+}
 
-        hwstore_write_chead(hwstore, headpos, &headcell);
-        hwstore_write_shead(hwstore);
-        return;
+/* Move live cell which is out of used chain to free chain */
+static void hwstore_unplace(hwstore_t* hwstore, int pos, hwcell_t* cell) {
+    if ((cell->flags & HWCELL_CHUNKED) != 0) {
+        int nchunks = hwcell_nchunks(cell->valsize);
+        int* table = malloc(nchunks * sizeof(int));
+        hwstore_dread(hwstore, pos + CELLHEAD_SIZE + cell->keysize, table, nchunks * sizeof(int));
+        hwstore_free_chunks(hwstore, table, nchunks);
+        free(table);
     }
+    hwstore_count_live(hwstore, cell, -1);
+    hwstore_putfree(hwstore, pos, cell);
+}
 
-    /* Check cell chain after head cell */
-    int currpos = hwstore->head;
-    hwcell_t currcell;
-    hwstore_read_chead(hwstore, currpos, &currcell);
+/* Delete cell from used chain */
+static void hwstore_unlink(hwstore_t* hwstore, int prevpos, hwcell_t* prevcell, int pos, hwcell_t* cell) {
+    hwstore_unindex(hwstore, pos, cell);
+    if (prevpos == HWNULL) {
+        hwstore->head = cell->next;
+    } else {
+        prevcell->next = cell->next;
+        hwstore_write_chead(hwstore, prevpos, prevcell);
+    }
+    if (hwstore->hand == pos) {
+        hwstore->hand = prevpos;
+    }
+}
 
-    while (currcell.next != HWNULL) {
-        if (currcell.next == addr) {
+static void hwstore_release(hwstore_t* hwstore, int prevpos, hwcell_t* prevcell, int pos, hwcell_t* cell) {
+    if (hwstore_retain(hwstore, pos, cell)) return;
+    hwstore_unlink(hwstore, prevpos, prevcell, pos, cell);
+    hwstore_defer(hwstore, pos, cell);
+    hwstore_write_shead(hwstore);
+}
 
-            printf("del addr = %d\n", currcell.next);
+/* Cell was written before some open snapshot */
+static int hwstore_snapped(hwstore_t* hwstore, hwcell_t* cell) {
+    for (int i = 0; i < hwstore->nsnaps; i++) {
+        if (cell->version <= hwstore->snaps[i]) return 1;
+    }
+    return 0;
+}
 
-            /* Read next cell */
-            hwcell_t nextcell;
-            int nextpos = currcell.next;
-            hwstore_read_chead(hwstore, nextpos, &nextcell);
+/*
+ * Old version seen by snapshot is marked retired and stays in used
+ * chain, readers of store skip it. Returns 1 if cell was kept.
+ */
+static int hwstore_retain(hwstore_t* hwstore, int pos, hwcell_t* cell) {
+    if ((cell->flags & HWCELL_RETIRED) != 0 || !hwstore_snapped(hwstore, cell)) return 0;
 
-            /* Delete next used cell from chain */
-            currcell.next = nextcell.next;
-            hwstore_write_chead(hwstore, currpos, &currcell);
+    hwstore_unindex(hwstore, pos, cell);
+    cell->flags |= HWCELL_RETIRED;
+    cell->retired = hwstore->version;
+    hwstore_write_chead(hwstore, pos, cell);
 
-            /* Insert next cell to free head */
-            nextcell.next = hwstore->freehead;
+    if (hwstore->nretires == hwstore->retirecapa) {
+        hwstore->retirecapa = hwstore->retirecapa == 0 ? 8 : hwstore->retirecapa * 2;
+        hwstore->retires = realloc(hwstore->retires, hwstore->retirecapa * sizeof(hwretire_t));
+    }
+    hwretire_t* retire = &(hwstore->retires[hwstore->nretires++]);
+    retire->addr = pos;
+    retire->version = cell->version;
+    retire->retired = cell->retired;
+    hwstore_count(&(hwstore->stats.retired), 1);
+    return 1;
+}
 
-            hwstore->freehead = nextpos;
-            hwstore_write_chead(hwstore, nextpos, &nextcell);
-            hwstore_write_shead(hwstore);
-            return;
+/* Free retired cells which no open snapshot sees */
+static void hwstore_reclaim(hwstore_t* hwstore) {
+    int i = 0;
+    while (i < hwstore->nretires) {
+        hwretire_t retire = hwstore->retires[i];
+        int seen = 0;
+        for (int j = 0; j < hwstore->nsnaps && !seen; j++) {
+            seen = retire.version <= hwstore->snaps[j] && hwstore->snaps[j] < retire.retired;
         }
-        currpos = currcell.next;
-        hwstore_read_chead(hwstore, currpos, &currcell);
+        if (seen) {
+            i++;
+            continue;
+        }
+        hwstore->retires[i] = hwstore->retires[--hwstore->nretires];
+        hwstore_count(&(hwstore->stats.retired), -1);
+        hwstore_free(hwstore, retire.addr);
     }
-    return;
 }
 
-void hwstore_print(hwstore_t* hwstore) {
+static void hwstore_free(hwstore_t* hwstore, int addr) {
+    int prevpos = HWNULL;
+    hwcell_t prevcell;
     int currpos = hwstore->head;
-    while (currpos != HWNULL) {
-        hwcell_t currcell;
-        char* key = NULL;
-        char* val = NULL;
-        hwstore_read_cell(hwstore, currpos, &currcell, &key, &val);
-        printf("## used cell addr = %3d, key = %s, val=%s\n", currpos, key, val);
-        free(key);
-        free(val);
-        currpos = currcell.next;
-    }
-
-    currpos = hwstore->freehead;
     while (currpos != HWNULL) {
         hwcell_t currcell;
         hwstore_read_chead(hwstore, currpos, &currcell);
-        printf("#  free cell addr = %3d\n", currpos);
+        if (currpos == addr) {
+            hwstore_release(hwstore, prevpos, &prevcell, currpos, &currcell);
+            return;
+        }
+        prevpos = currpos;
+        prevcell = currcell;
         currpos = currcell.next;
     }
     return;
 }
 
-int hwstore_get(hwstore_t* hwstore, char* key, int keysize, char** val) {
-    int currpos = hwstore->head;
-    while (currpos != HWNULL) {
+/* Cells with value in RAM cache are hot even if device bit is clear */
+static int hwstore_cached(hwstore_t* hwstore, int pos, hwcell_t* cell) {
+    if (hwstore->hwcache == NULL) return 0;
+    char* key = hwstore_read_skey(hwstore, pos, cell, &(hwstore->scratch));
+    return hwcache_has(hwstore->hwcache, key, cell->keysize);
+}
+
+static void hwstore_evict_cell(hwstore_t* hwstore, int prevpos, hwcell_t* prevcell, int pos, hwcell_t* cell) {
+    if (hwstore->hwcache != NULL) {
+        char* key = hwstore_read_skey(hwstore, pos, cell, &(hwstore->scratch));
+        hwcache_del(hwstore->hwcache, key, cell->keysize);
+    }
+    hwstore_release(hwstore, prevpos, prevcell, pos, cell);
+    hwstore_count(&(hwstore->stats.evicted), 1);
+}
+
+/*
+ * CLOCK sweep over used chain, HWEVICT_SCAN cells per call. Accessed
+ * cells lose their bit, first cold cell with capacity for datasize is
+ * freed. Cells are not merged, so only a cell big enough helps: if every
+ * such cell in the window was hot, the first one is freed anyway, if the
+ * window had none, the sweep goes on for one lap. Returns freed address
+ * or -1.
+ */
+static int hwstore_evict(hwstore_t* hwstore, int datasize) {
+    if (hwstore->head == HWNULL) return -1;
+
+    int prevpos = hwstore->hand;
+    hwcell_t prevcell;
+    if (prevpos != HWNULL) {
+        hwstore_read_chead(hwstore, prevpos, &prevcell);
+    }
+
+    int fitprev = HWNULL;
+    int fitpos = HWNULL;
+    int lap = (int)hwstore->stats.usedchain + 1;
+    int limit = HWEVICT_SCAN;
+    for (int i = 0; i < limit; i++) {
+        if (i + 1 == limit && fitpos == HWNULL && limit < lap) {
+            limit = lap;
+        }
+        int currpos = prevpos == HWNULL ? hwstore->head : prevcell.next;
+        if (currpos == HWNULL) {
+            /* Wrap to chain head */
+            prevpos = HWNULL;
+            continue;
+        }
         hwcell_t currcell;
         hwstore_read_chead(hwstore, currpos, &currcell);
-        if (currcell.keysize == keysize) {
-            char* hwkey = NULL;
-            hwstore_read_ckey(hwstore, currpos, &currcell, &hwkey);
-
-            if (memcmp(key, hwkey, keysize) == 0) {
-                hwstore_read_cval(hwstore, currpos, &currcell, val);
+        unsigned char* hot = &(hwstore->hot[hwstore_hotslot(currpos)]);
+        int accessed = (currcell.flags & HWCELL_ACCESSED) != 0 || __atomic_load_n(hot, __ATOMIC_RELAXED) != 0;
 
-                free(hwkey);
+        if (currcell.capa >= datasize) {
+            if (!accessed && !hwstore_cached(hwstore, currpos, &currcell)) {
+                hwstore->hand = prevpos;
+                hwstore_evict_cell(hwstore, prevpos, &prevcell, currpos, &currcell);
                 return currpos;
             }
-
-            free(hwkey);
+            if (fitpos == HWNULL) {
+                fitprev = prevpos;
+                fitpos = currpos;
+            }
         }
-        currpos = currcell.next;
-    }
+        if ((currcell.flags & HWCELL_ACCESSED) != 0) {
+            currcell.flags &= ~HWCELL_ACCESSED;
+            hwstore_write_chead(hwstore, currpos, &currcell);
+        }
+        if (accessed) {
+            __atomic_store_n(hot, 0, __ATOMIC_RELAXED);
+        }
+        prevpos = currpos;
+        prevcell = currcell;
+    }
+    hwstore->hand = prevpos;
+    if (fitpos == HWNULL) return -1;
+
+    /* Sweep changed only flags, links of window are still valid */
+    hwcell_t fitcell;
+    hwstore_read_chead(hwstore, fitpos, &fitcell);
+    if (fitprev != HWNULL) {
+        hwstore_read_chead(hwstore, fitprev, &prevcell);
+    }
+    hwstore_evict_cell(hwstore, fitprev, &prevcell, fitpos, &fitcell);
+    return fitpos;
+}
+
+/* Evict used cell by address, walks used chain for predecessor */
+static int hwstore_evict_addr(hwstore_t* hwstore, int addr) {
+    int prevpos = HWNULL;
+    hwcell_t prevcell;
+    int currpos = hwstore->head;
+    while (currpos != HWNULL) {
+        hwcell_t currcell;
+        hwstore_read_chead(hwstore, currpos, &currcell);
+        if (currpos == addr) {
+            hwstore_evict_cell(hwstore, prevpos, &prevcell, currpos, &currcell);
+            return currpos;
+        }
+        prevpos = currpos;
+        prevcell = currcell;
+        currpos = currcell.next;
+    }
     return -1;
 }
 
-static int hwstore_find(hwstore_t* hwstore, char* key, int keysize, hwcell_t* currcell) {
+/* Delete cell from free chain */
+static void hwstore_unfree(hwstore_t* hwstore, int addr, hwcell_t* cell) {
+    if (hwstore->hwfree != NULL) {
+        hwfentry_t entry;
+        if (hwfree_remove(hwstore->hwfree, addr, &entry) == 0) {
+            hwstore_unlink_free(hwstore, &entry);
+            hwstore_write_shead(hwstore);
+            hwstore_count_free(hwstore, cell, -1);
+        }
+        return;
+    }
+    if (hwstore->freehead == addr) {
+        hwstore->freehead = cell->next;
+        hwstore_write_shead(hwstore);
+        hwstore_count_free(hwstore, cell, -1);
+        return;
+    }
+    int currpos = hwstore->freehead;
+    while (currpos != HWNULL) {
+        hwcell_t currcell;
+        hwstore_read_chead(hwstore, currpos, &currcell);
+        if (currcell.next == addr) {
+            currcell.next = cell->next;
+            hwstore_write_chead(hwstore, currpos, &currcell);
+            hwstore_count_free(hwstore, cell, -1);
+            return;
+        }
+        currpos = currcell.next;
+    }
+}
+
+/* Map has unlinked entry in RAM already, chain on device follows */
+static void hwstore_unlink_free(hwstore_t* hwstore, hwfentry_t* entry) {
+    if (entry->prev == HWNULL) {
+        hwstore->freehead = entry->next;
+        return;
+    }
+    hwfentry_t* preventry = hwfree_get(hwstore->hwfree, entry->prev);
+    hwstore_write_free(hwstore, preventry->addr, preventry->capa, preventry->next);
+}
+
+/*
+ * No cell is big enough: evict cell at clock hand and grow it over its
+ * physical neighbours, evicting used ones, or over space after tail.
+ * Neighbour of cell is at pos + CELLHEAD_SIZE + capa + 1. Merged cell
+ * stays on free head. Returns its address or -1 at end of device.
+ */
+static int hwstore_evict_merge(hwstore_t* hwstore, int datasize) {
+    if (hwstore->head == HWNULL) return -1;
+
+    int pos = hwstore->head;
+    if (hwstore->hand != HWNULL) {
+        hwcell_t handcell;
+        hwstore_read_chead(hwstore, hwstore->hand, &handcell);
+        if (handcell.next != HWNULL) pos = handcell.next;
+    }
+    hwstore_evict_addr(hwstore, pos);
+
+    hwcell_t cell;
+    hwstore_read_chead(hwstore, pos, &cell);
+    while (cell.capa < datasize) {
+        int nextpos = pos + CELLHEAD_SIZE + cell.capa + 1;
+        int* tailend = hwstore_tailend(hwstore, pos);
+        if (nextpos > *tailend) {
+            /* Last cell takes space after tail of its extent */
+            int need = hwstore_cellcapa(hwstore, datasize) - cell.capa;
+            int offset;
+            hwmemory_t* hwmemory = hwstore_device(hwstore, *tailend, &offset);
+            if (offset + need >= hwmemory_size(hwmemory)) return -1;
+            hwstore_count(&(hwstore->stats.padbytes), need - (datasize - cell.capa));
+            cell.capa += need;
+            *tailend += need;
+            hwstore_count(&(hwstore->freecapa), need);
+            hwstore_write_chead(hwstore, pos, &cell);
+            hwstore_refree(hwstore, pos, cell.capa);
+            break;
+        }
+        hwcell_t nextcell;
+        hwstore_read_chead(hwstore, nextpos, &nextcell);
+        if ((nextcell.flags & HWCELL_FREE) == 0) {
+            /* Chunk goes with its head cell */
+            int owner = (nextcell.flags & HWCELL_CHUNK) != 0 ? nextcell.next : nextpos;
+            hwstore_evict_addr(hwstore, owner);
+            hwstore_read_chead(hwstore, nextpos, &nextcell);
+            /* Cell of allocation in progress */
+            if ((nextcell.flags & HWCELL_FREE) == 0) {
+                hwstore_write_shead(hwstore);
+                return -1;
+            }
+        }
+        hwstore_unfree(hwstore, nextpos, &nextcell);
+        if (hwstore->tail == nextpos) {
+            hwstore->tail = pos;
+        }
+        if (hwstore->scrubpos == nextpos) {
+            hwstore->scrubpos = pos;
+        }
+
+        /* Unlink may have rewritten next field of merged cell */
+        int span = CELLHEAD_SIZE + 1 + nextcell.capa;
+        hwstore_read_chead(hwstore, pos, &cell);
+        cell.capa += span;
+        hwstore_count(&(hwstore->freecapa), span);
+        hwstore_write_chead(hwstore, pos, &cell);
+        hwstore_refree(hwstore, pos, cell.capa);
+    }
+    hwstore_write_shead(hwstore);
+    return pos;
+}
+
+static int hwstore_hotslot(int pos) {
+    return (int)(((unsigned)pos * 2654435761U) >> 20) & (HWHOT_SLOTS - 1);
+}
+
+/*
+ * Get marks cell in RAM, device header is written by writers only.
+ * Hash collisions keep some cold cells for one more lap.
+ */
+static void hwstore_touch(hwstore_t* hwstore, int pos) {
+    if (hwstore->evict == HWEVICT_NONE) return;
+    unsigned char* hot = &(hwstore->hot[hwstore_hotslot(pos)]);
+    if (__atomic_load_n(hot, __ATOMIC_RELAXED) == 0) {
+        __atomic_store_n(hot, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void hwstore_print(hwstore_t* hwstore) {
     int currpos = hwstore->head;
     while (currpos != HWNULL) {
-        hwstore_read_chead(hwstore, currpos, currcell);
-        if (currcell->keysize == keysize) {
-            char* hwkey = NULL;
-            hwstore_read_ckey(hwstore, currpos, currcell, &hwkey);
+        hwcell_t currcell;
+        char* data = hwstore_read_cell(hwstore, currpos, &currcell, &(hwstore->scratch));
+        printf("## used cell addr = %3d, key = %.*s, val=%.*s\n", currpos, currcell.keysize, data,
+                                currcell.valsize, data + currcell.keysize);
+        currpos = currcell.next;
+    }
+
+    currpos = hwstore->freehead;
+    while (currpos != HWNULL) {
+        hwcell_t currcell;
+        hwstore_read_chead(hwstore, currpos, &currcell);
+        printf("#  free cell addr = %3d\n", currpos);
+        currpos = currcell.next;
+    }
+    return;
+}
 
+/* Gets pass scratch of their reader slot, writers the one of store */
+static int hwstore_find(hwstore_t* hwstore, char* key, int keysize, hwcell_t* currcell,
+                                hwscratch_t* scratch) {
+    hwindex_t* hwindex = __atomic_load_n(&(hwstore->hwindex), __ATOMIC_ACQUIRE);
+    if (hwindex != NULL) {
+        return hwstore_find_indexed(hwstore, hwindex, key, keysize, currcell, scratch);
+    }
+    int currpos = hwstore->head;
+    while (currpos != HWNULL) {
+        hwstore_read_chead(hwstore, currpos, currcell);
+        /* Link of bad header leads nowhere */
+        if (currcell->crc != hwcell_crc(currcell)) return HWCORRUPT;
+        if (currcell->keysize == keysize && (currcell->flags & HWCELL_RETIRED) == 0) {
+            char* hwkey = hwstore_read_skey(hwstore, currpos, currcell, scratch);
             if (memcmp(key, hwkey, keysize) == 0) {
-                free(hwkey);
+                /* Key deleted by transaction which was not cleaned up */
+                if ((currcell->flags & HWCELL_TOMBSTONE) != 0) return -1;
                 return currpos;
             }
-            free(hwkey);
         }
         currpos = currcell->next;
     }
     return -1;
 }
 
+/*
+ * Index holds every linked cell which is not retired, tombstones too,
+ * so at most one candidate has the key once writer is done.
+ */
+static int hwstore_find_indexed(hwstore_t* hwstore, hwindex_t* hwindex, char* key, int keysize,
+                                hwcell_t* currcell, hwscratch_t* scratch) {
+    hwiprobe_t probe;
+    hwindex_probe(hwindex, hwindex_hash(key, keysize), &probe);
+    int currpos;
+    int corrupt = 0;
+    while ((currpos = hwindex_next(&probe)) > 0) {
+        hwstore_read_chead(hwstore, currpos, currcell);
+        if (currcell->crc != hwcell_crc(currcell)) {
+            corrupt = 1;
+            continue;
+        }
+        if (currcell->keysize != keysize) continue;
+        if ((currcell->flags & (HWCELL_RETIRED | HWCELL_FREE | HWCELL_CHUNK)) != 0) continue;
+        char* hwkey = hwstore_read_skey(hwstore, currpos, currcell, scratch);
+        if (memcmp(key, hwkey, keysize) == 0) {
+            if ((currcell->flags & HWCELL_TOMBSTONE) != 0) return -1;
+            return currpos;
+        }
+    }
+    return corrupt ? HWCORRUPT : -1;
+}
+
+/* Add cell just linked to used chain, writer side */
+static void hwstore_index(hwstore_t* hwstore, char* key, int keysize, int addr) {
+    if (hwstore->hwindex == NULL) return;
+    if (hwindex_insert(hwstore->hwindex, hwindex_hash(key, keysize), addr)) {
+        /* Old table is freed when gets of this epoch are gone */
+        hwstore->indexepoch = __atomic_load_n(&(hwstore->epoch), __ATOMIC_RELAXED);
+    }
+}
+
+/* Drop cell which leaves used chain or gets retired */
+static void hwstore_unindex(hwstore_t* hwstore, int pos, hwcell_t* cell) {
+    if (hwstore->hwindex == NULL || (cell->flags & HWCELL_RETIRED) != 0) return;
+    char* key = hwstore_read_skey(hwstore, pos, cell, &(hwstore->scratch));
+    hwindex_remove(hwstore->hwindex, hwindex_hash(key, cell->keysize), pos);
+}
+
+int hwstore_get(hwstore_t* hwstore, char* key, int keysize, char** val) {
+    int valsize;
+    return hwstore_getval(hwstore, key, keysize, val, &valsize);
+}
+
+/* Get which also returns value size, for values which are not strings */
+int hwstore_getval(hwstore_t* hwstore, char* key, int keysize, char** val, int* valsize) {
+    return hwstore_fetch(hwstore, key, keysize, val, NULL, 0, valsize);
+}
+
+/*
+ * Get to caller buffer, no heap copy of value is made. Value size is
+ * set on hit, value is copied only if it fits into bufsize bytes.
+ */
+int hwstore_getbuf(hwstore_t* hwstore, char* key, int keysize, char* buf, int bufsize, int* valsize) {
+    return hwstore_fetch(hwstore, key, keysize, NULL, buf, bufsize, valsize);
+}
+
+/* Value goes to new heap copy in val or, if buf is given, to buf */
+static int hwstore_fetch(hwstore_t* hwstore, char* key, int keysize, char** val,
+                                char* buf, int bufsize, int* valsize) {
+    long reads, writes;
+    hwstore_opbegin(hwstore, &reads, &writes);
+
+    long now = time(NULL);
+    int addr = -1;
+    if (hwstore->hwcache != NULL) {
+        if (buf != NULL) {
+            addr = hwcache_getbuf(hwstore->hwcache, key, keysize, buf, bufsize, valsize, now);
+        } else {
+            addr = hwcache_get(hwstore->hwcache, key, keysize, val, valsize, now);
+        }
+        if (addr > 0) {
+            hwstore_opend(hwstore, &(hwstore->readers[hwstore_rhome()].get), reads, writes);
+            return addr;
+        }
+    }
+
+    /* Walk without lock, repeat if a writer was active meanwhile */
+    hwcell_t currcell;
+    int expired = 0;
+    int bad = 0;
+    unsigned long seq;
+    for (;;) {
+        /* Slot is left between tries, so waiting get holds no cells */
+        int slot = hwstore_renter(hwstore);
+        seq = __atomic_load_n(&(hwstore->seq), __ATOMIC_ACQUIRE);
+        if ((seq & 1) == 0) {
+            addr = hwstore_find(hwstore, key, keysize, &currcell, &(hwstore->readers[slot].scratch));
+            expired = addr > 0 && hwstore_expired(&currcell, now);
+            bad = 0;
+            if (addr > 0 && !expired && buf != NULL) {
+                if (currcell.valsize <= bufsize) {
+                    bad = hwstore_read_valbuf(hwstore, addr, &currcell, key, buf) < 0;
+                }
+            } else if (addr > 0 && !expired) {
+                bad = hwstore_read_value(hwstore, addr, &currcell, key, val) < 0;
+            }
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&(hwstore->seq), __ATOMIC_RELAXED) == seq) {
+                hwstore_rexit(hwstore, slot);
+                break;
+            }
+            if (addr > 0 && !expired && buf == NULL && !bad) {
+                free(*val);
+                *val = NULL;
+            }
+            hwstore_count(&(hwstore->stats.retries), 1);
+        }
+        hwstore_rexit(hwstore, slot);
+        sched_yield();
+    }
+
+    /* Checked once walk is known to be undisturbed by writers */
+    if (addr > 0 && !expired && bad) {
+        addr = HWCORRUPT;
+    } else if (addr > 0 && !expired && (buf == NULL || currcell.valsize <= bufsize)
+        && !hwcell_intact(&currcell, key, buf != NULL ? buf : *val)) {
+        if (buf == NULL) {
+            free(*val);
+            *val = NULL;
+        }
+        addr = HWCORRUPT;
+    }
+    if (addr == HWCORRUPT) {
+        hwstore_count(&(hwstore->stats.corrupt), 1);
+        addr = -1;
+    }
+
+    if (expired) {
+        /* Lazy expiry, left to timer sweep if writer is busy */
+        if (pthread_mutex_trylock(&(hwstore->wlock)) == 0) {
+            hwstore_wbegin(hwstore);
+            addr = hwstore_find(hwstore, key, keysize, &currcell, &(hwstore->scratch));
+            if (addr > 0 && hwstore_expired(&currcell, now)) {
+                hwstore_free(hwstore, addr);
+                hwstore_count(&(hwstore->stats.expired), 1);
+            }
+            hwstore_wunlock(hwstore);
+        }
+        addr = -1;
+    }
+    if (addr > 0) {
+        *valsize = currcell.valsize;
+        hwstore_touch(hwstore, addr);
+        char* data = buf != NULL ? buf : *val;
+        if (hwstore->hwcache != NULL && (buf == NULL || currcell.valsize <= bufsize)) {
+            hwcache_put(hwstore->hwcache, key, keysize, data, currcell.valsize, addr, currcell.expire);
+            /* Writer may have updated cache before stale value came */
+            if (__atomic_load_n(&(hwstore->seq), __ATOMIC_ACQUIRE) != seq) {
+                hwcache_del(hwstore->hwcache, key, keysize);
+            }
+        }
+    }
+
+    hwstore_opend(hwstore, &(hwstore->readers[hwstore_rhome()].get), reads, writes);
+    return addr;
+}
+
+/*
+ * Writers are serialized by store lock and make sequence odd while they
+ * change store, so gets can validate what they read without lock.
+ */
+static void hwstore_wlock(hwstore_t* hwstore) {
+    pthread_mutex_lock(&(hwstore->wlock));
+    hwstore_wbegin(hwstore);
+}
+
+static void hwstore_wbegin(hwstore_t* hwstore) {
+    __atomic_store_n(&(hwstore->seq), hwstore->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void hwstore_wunlock(hwstore_t* hwstore) {
+    hwstore_drain(hwstore);
+    __atomic_store_n(&(hwstore->seq), hwstore->seq + 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&(hwstore->epoch), 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&(hwstore->wlock));
+}
+
+/* Home slot of calling thread, its gets are counted there */
+static int hwstore_rhome(void) {
+    static int nexthome = 0;
+    static __thread int home = -1;
+    if (home < 0) {
+        home = __atomic_fetch_add(&nexthome, 1, __ATOMIC_RELAXED) % HWREADER_SLOTS;
+    }
+    return home;
+}
+
+/* Reader takes free slot with current epoch, starting from its home */
+static int hwstore_renter(hwstore_t* hwstore) {
+    int home = hwstore_rhome();
+    for (int i = home, tries = 1;; i = (i + 1) % HWREADER_SLOTS, tries++) {
+        unsigned long epoch = __atomic_load_n(&(hwstore->epoch), __ATOMIC_SEQ_CST);
+        unsigned long idle = 0;
+        if (__atomic_compare_exchange_n(&(hwstore->readers[i].epoch), &idle, epoch, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return i;
+        }
+        /* Every slot is taken, let their holders run */
+        if (tries % HWREADER_SLOTS == 0) sched_yield();
+    }
+}
+
+static void hwstore_rexit(hwstore_t* hwstore, int slot) {
+    __atomic_store_n(&(hwstore->readers[slot].epoch), 0, __ATOMIC_RELEASE);
+}
+
+/* Some reader started at or before epoch, 0 is any reader */
+static int hwstore_rblocked(hwstore_t* hwstore, unsigned long epoch) {
+    for (int i = 0; i < HWREADER_SLOTS; i++) {
+        unsigned long rdepoch = __atomic_load_n(&(hwstore->readers[i].epoch), __ATOMIC_ACQUIRE);
+        if (rdepoch != 0 && (epoch == 0 || rdepoch <= epoch)) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Free unlinked cell, or hold it while some get may still traverse it.
+ * Unlink is made visible before readers are checked, so reader which
+ * is not seen here starts after unlink and can not reach the cell.
+ */
+static void hwstore_defer(hwstore_t* hwstore, int pos, hwcell_t* cell) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!hwstore_rblocked(hwstore, 0)) {
+        hwstore_unplace(hwstore, pos, cell);
+        return;
+    }
+    if (hwstore->nlimbo == hwstore->limbocapa) {
+        hwstore->limbocapa = hwstore->limbocapa == 0 ? 16 : hwstore->limbocapa * 2;
+        hwstore->limbo = realloc(hwstore->limbo, hwstore->limbocapa * sizeof(hwlimbo_t));
+    }
+    hwstore->limbo[hwstore->nlimbo].addr = pos;
+    hwstore->limbo[hwstore->nlimbo].epoch = __atomic_load_n(&(hwstore->epoch), __ATOMIC_RELAXED);
+    hwstore->nlimbo++;
+    hwstore_count(&(hwstore->stats.deferred), 1);
+}
+
+/* Free held cells of epochs which no active reader started in */
+static void hwstore_drain(hwstore_t* hwstore) {
+    int freed = 0;
+    int i = 0;
+    while (i < hwstore->nlimbo) {
+        hwlimbo_t limbo = hwstore->limbo[i];
+        if (hwstore_rblocked(hwstore, limbo.epoch)) {
+            i++;
+            continue;
+        }
+        hwstore->limbo[i] = hwstore->limbo[--hwstore->nlimbo];
+        hwcell_t cell;
+        hwstore_read_chead(hwstore, limbo.addr, &cell);
+        hwstore_unplace(hwstore, limbo.addr, &cell);
+        freed = 1;
+    }
+    if (freed) {
+        hwstore_write_shead(hwstore);
+    }
+    if (hwstore->hwindex != NULL && hwstore->hwindex->nold > 0
+        && !hwstore_rblocked(hwstore, hwstore->indexepoch)) {
+        hwindex_reclaim(hwstore->hwindex);
+    }
+}
+
 int hwstore_del(hwstore_t* hwstore, char* key, int keysize) {
+    long reads, writes;
+    hwstore_opbegin(hwstore, &reads, &writes);
+    hwstore_wlock(hwstore);
+
+    if (hwstore->hwcache != NULL) {
+        hwcache_del(hwstore->hwcache, key, keysize);
+    }
+
     int addr = -1;
     hwcell_t currcell;
-    if ((addr = hwstore_find(hwstore, key, keysize, &currcell)) > 0) {
+    if ((addr = hwstore_find(hwstore, key, keysize, &currcell, &(hwstore->scratch))) > 0) {
         hwstore_free(hwstore, addr);
+        hwstore_log(hwstore, HWLOG_DEL, key, keysize, NULL, 0, 0);
+        hwstore_logflush(hwstore);
+        if (hwstore_expired(&currcell, time(NULL))) {
+            hwstore_count(&(hwstore->stats.expired), 1);
+            addr = -1;
+        }
     }
+
+    hwstore_wunlock(hwstore);
+    hwstore_opend(hwstore, &(hwstore->stats.del), reads, writes);
     return addr;
 }
 
 int hwstore_set(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize) {
+    long reads, writes;
+    hwstore_opbegin(hwstore, &reads, &writes);
+    hwstore_wlock(hwstore);
+
     int addr = -1;
     hwcell_t currcell;
 
-    if ((addr = hwstore_find(hwstore, key, keysize, &currcell)) > 0) {
+    if ((addr = hwstore_find(hwstore, key, keysize, &currcell, &(hwstore->scratch))) > 0) {
         int datasize = keysize + valsize;
-        if (datasize > currcell.capa) {
+        if (!hwstore_inplace(hwstore, &currcell, keysize, valsize)) {
             hwstore_free(hwstore, addr);
-            int newaddr = hwstore_alloc(hwstore, key, keysize, val, valsize);
-            return newaddr;
+            addr = hwstore_alloc(hwstore, key, keysize, val, valsize);
+        } else {
+            /* Rewrite cell in place, new value has no expiry */
+            int olddatasize = currcell.keysize + currcell.valsize;
+            currcell.keysize = keysize;
+            currcell.valsize = valsize;
+            currcell.expire = 0;
+            currcell.version = hwstore->version;
+            if (hwstore->evict != HWEVICT_NONE) {
+                currcell.flags |= HWCELL_ACCESSED;
+            }
+            hwstore_write_cell(hwstore, addr, &currcell, key, val);
+            hwstore_count(&(hwstore->stats.livebytes), datasize - olddatasize);
+            hwstore_count(&(hwstore->stats.wastedbytes), olddatasize - datasize);
         }
-
-        currcell.keysize = keysize;
-        currcell.valsize = valsize;
-        hwstore_write_cell(hwstore, addr, &currcell, key, val);
-        return addr;
+    } else {
+        addr = hwstore_alloc(hwstore, key, keysize, val, valsize);
     }
+    if (addr > 0) {
+        hwstore_log(hwstore, HWLOG_SET, key, keysize, val, valsize, 0);
+        hwstore_logflush(hwstore);
+    }
+    if (hwstore->hwcache != NULL) {
+        if (addr > 0) {
+            hwcache_update(hwstore->hwcache, key, keysize, val, valsize, addr, 0);
+        } else {
+            hwcache_del(hwstore->hwcache, key, keysize);
+        }
+    }
+    hwstore_sweep(hwstore, HWEXPIRE_STEP);
+    hwstore_wunlock(hwstore);
+
+    hwstore_opend(hwstore, &(hwstore->stats.set), reads, writes);
+    return addr;
+}
+
+/* Plain cell can take new value of same key in place */
+static int hwstore_inplace(hwstore_t* hwstore, hwcell_t* cell, int keysize, int valsize) {
+    return keysize + valsize <= cell->capa && valsize <= HWCHUNK_SIZE
+        && (cell->flags & HWCELL_CHUNKED) == 0 && !hwstore_snapped(hwstore, cell);
+}
+
+/* Free cell and write new one for same key, expiry is kept */
+static int hwstore_replace(hwstore_t* hwstore, int addr, hwcell_t* cell, char* key, int keysize,
+                                char* val, int valsize) {
+    long expire = cell->expire;
+    hwstore_free(hwstore, addr);
     addr = hwstore_alloc(hwstore, key, keysize, val, valsize);
+    if (addr > 0 && expire != 0) {
+        hwcell_t newcell;
+        hwstore_read_chead(hwstore, addr, &newcell);
+        newcell.expire = expire;
+        hwstore_write_chead(hwstore, addr, &newcell);
+        hwstore_add_timer(hwstore, addr, expire);
+    }
+    return addr;
+}
+
+/*
+ * Append to value of key, missing key is created. If cell has room
+ * left, only new bytes and cell header are written, otherwise cell is
+ * replaced. Expiry is kept. Returns address or -1.
+ */
+int hwstore_append(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize) {
+    long reads, writes;
+    hwstore_opbegin(hwstore, &reads, &writes);
+    hwstore_wlock(hwstore);
+
+    if (hwstore->hwcache != NULL) {
+        hwcache_del(hwstore->hwcache, key, keysize);
+    }
+    hwcell_t currcell;
+    char* oldval = NULL;
+    int addr = hwstore_find(hwstore, key, keysize, &currcell, &(hwstore->scratch));
+    if (addr > 0 && hwstore_expired(&currcell, time(NULL))) {
+        hwstore_free(hwstore, addr);
+        hwstore_count(&(hwstore->stats.expired), 1);
+        addr = -1;
+    }
+
+    if (addr < 0) {
+        addr = hwstore_alloc(hwstore, key, keysize, val, valsize);
+    } else if (hwstore_inplace(hwstore, &currcell, keysize, currcell.valsize + valsize)) {
+        hwstore_dwrite(hwstore, addr + CELLHEAD_SIZE + keysize + currcell.valsize, val, valsize);
+        currcell.valsize += valsize;
+        currcell.version = hwstore->version;
+        /* Checksum runs over key then value, so it extends by new bytes */
+        currcell.datacrc = hwcrc32c(currcell.datacrc, val, valsize);
+        hwstore_write_chead(hwstore, addr, &currcell);
+        hwstore_count(&(hwstore->stats.livebytes), valsize);
+        hwstore_count(&(hwstore->stats.wastedbytes), -valsize);
+    } else if (hwstore_read_value(hwstore, addr, &currcell, key, &oldval) < 0) {
+        /* Old value is lost, appending to it would hide that */
+        hwstore_count(&(hwstore->stats.corrupt), 1);
+        addr = -1;
+    } else {
+        int newsize = currcell.valsize + valsize;
+        char* newval = malloc(newsize);
+        memcpy(newval, oldval, currcell.valsize);
+        memcpy(newval + currcell.valsize, val, valsize);
+        addr = hwstore_replace(hwstore, addr, &currcell, key, keysize, newval, newsize);
+        free(oldval);
+        free(newval);
+    }
+    if (addr > 0) {
+        hwstore_log(hwstore, HWLOG_APPEND, key, keysize, val, valsize, 0);
+        hwstore_logflush(hwstore);
+    }
+    hwstore_sweep(hwstore, HWEXPIRE_STEP);
+    hwstore_wunlock(hwstore);
+
+    hwstore_opend(hwstore, &(hwstore->stats.set), reads, writes);
     return addr;
 }
+
+/*
+ * Add delta to 64-bit counter of key, missing key starts from zero.
+ * Only the value bytes are read and written. Expiry is kept. Returns
+ * address, -1 if value is not a counter or store is full.
+ */
+int hwstore_incr(hwstore_t* hwstore, char* key, int keysize, long delta, long* result) {
+    long reads, writes;
+    hwstore_opbegin(hwstore, &reads, &writes);
+    hwstore_wlock(hwstore);
+
+    hwcell_t currcell;
+    int addr = hwstore_find(hwstore, key, keysize, &currcell, &(hwstore->scratch));
+    if (addr > 0 && hwstore_expired(&currcell, time(NULL))) {
+        hwstore_free(hwstore, addr);
+        hwstore_count(&(hwstore->stats.expired), 1);
+        addr = -1;
+    }
+
+    long counter = delta;
+    if (addr < 0) {
+        addr = hwstore_alloc(hwstore, key, keysize, (char*)&counter, sizeof(long));
+        currcell.expire = 0;
+    } else if (currcell.valsize != sizeof(long)) {
+        addr = -1;
+    } else {
+        int valpos = addr + CELLHEAD_SIZE + keysize;
+        hwstore_dread(hwstore, valpos, &counter, sizeof(long));
+        counter += delta;
+        if (hwstore_inplace(hwstore, &currcell, keysize, sizeof(long))) {
+            /* Found key equals stored one, checksum is rebuilt from it */
+            hwstore_dwrite(hwstore, valpos, &counter, sizeof(long));
+            currcell.version = hwstore->version;
+            currcell.datacrc = hwcrc32c(hwcrc32c(0, key, keysize), &counter, sizeof(long));
+            hwstore_write_chead(hwstore, addr, &currcell);
+        } else {
+            addr = hwstore_replace(hwstore, addr, &currcell, key, keysize, (char*)&counter, sizeof(long));
+        }
+    }
+    if (hwstore->hwcache != NULL) {
+        if (addr > 0) {
+            hwcache_update(hwstore->hwcache, key, keysize, (char*)&counter, sizeof(long), addr, currcell.expire);
+        } else {
+            hwcache_del(hwstore->hwcache, key, keysize);
+        }
+    }
+    if (addr > 0) {
+        *result = counter;
+        hwstore_log(hwstore, HWLOG_INCR, key, keysize, (char*)&delta, sizeof(long), 0);
+        hwstore_logflush(hwstore);
+    }
+    hwstore_sweep(hwstore, HWEXPIRE_STEP);
+    hwstore_wunlock(hwstore);
+
+    hwstore_opend(hwstore, &(hwstore->stats.set), reads, writes);
+    return addr;
+}
+
+void hwstore_txn_begin(hwstore_t* hwstore, hwtxn_t* hwtxn) {
+    memset(hwtxn, 0, sizeof(hwtxn_t));
+    hwtxn->hwstore = hwstore;
+}
+
+static int hwstore_txn_add(hwtxn_t* hwtxn, int op, char* key, int keysize, char* val, int valsize) {
+    if (keysize <= 0 || valsize < 0) return -1;
+    if (hwtxn->count == hwtxn->capa) {
+        hwtxn->capa = hwtxn->capa == 0 ? 8 : hwtxn->capa * 2;
+        hwtxn->ops = realloc(hwtxn->ops, hwtxn->capa * sizeof(hwtxop_t));
+    }
+    hwtxop_t* txop = &(hwtxn->ops[hwtxn->count]);
+    txop->op = op;
+    txop->key = malloc(keysize);
+    memcpy(txop->key, key, keysize);
+    txop->keysize = keysize;
+    txop->val = NULL;
+    txop->valsize = valsize;
+    if (valsize > 0) {
+        txop->val = malloc(valsize);
+        memcpy(txop->val, val, valsize);
+    }
+    hwtxn->count++;
+    return 0;
+}
+
+/* Buffer set, store is not touched until commit */
+int hwstore_txn_set(hwtxn_t* hwtxn, char* key, int keysize, char* val, int valsize) {
+    return hwstore_txn_add(hwtxn, HWTXN_SET, key, keysize, val, valsize);
+}
+
+int hwstore_txn_del(hwtxn_t* hwtxn, char* key, int keysize) {
+    return hwstore_txn_add(hwtxn, HWTXN_DEL, key, keysize, NULL, 0);
+}
+
+void hwstore_txn_abort(hwtxn_t* hwtxn) {
+    for (int i = 0; i < hwtxn->count; i++) {
+        free(hwtxn->ops[i].key);
+        free(hwtxn->ops[i].val);
+    }
+    free(hwtxn->ops);
+    hwtxn->ops = NULL;
+    hwtxn->count = 0;
+    hwtxn->capa = 0;
+}
+
+/* Later operation on the same key wins */
+static int hwstore_txn_last(hwtxn_t* hwtxn, int i) {
+    hwtxop_t* txop = &(hwtxn->ops[i]);
+    for (int j = i + 1; j < hwtxn->count; j++) {
+        if (hwtxn->ops[j].keysize == txop->keysize
+            && memcmp(hwtxn->ops[j].key, txop->key, txop->keysize) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Ascending order of cell addresses */
+static int hwstore_addrcmp(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Old versions of batch keys, looked up before batch is linked. With
+ * index each lookup is a probe, without it a walk as for a plain set.
+ * Returns their count, addresses are sorted.
+ */
+static int hwstore_txn_shadowed(hwtxn_t* hwtxn, int* olds) {
+    hwstore_t* hwstore = hwtxn->hwstore;
+    int nolds = 0;
+    for (int i = 0; i < hwtxn->count; i++) {
+        if (!hwstore_txn_last(hwtxn, i)) continue;
+        hwtxop_t* txop = &(hwtxn->ops[i]);
+        hwcell_t cell;
+        int addr = hwstore_find(hwstore, txop->key, txop->keysize, &cell, &(hwstore->scratch));
+        if (addr > 0) olds[nolds++] = addr;
+    }
+    qsort(olds, nolds, sizeof(int), hwstore_addrcmp);
+    return nolds;
+}
+
+/*
+ * Drop old versions below batch, then tombstones of batch. Walk below
+ * batch stops at last old version, batch cells link one to next so
+ * tombstones need no walk. Store head is written once at end.
+ */
+static void hwstore_txn_cleanup(hwtxn_t* hwtxn, int* addrs, int placed, int* olds, int nolds) {
+    hwstore_t* hwstore = hwtxn->hwstore;
+    int prevpos = addrs[0];
+    hwcell_t prevcell;
+    hwstore_read_chead(hwstore, prevpos, &prevcell);
+    int currpos = prevcell.next;
+    int left = nolds;
+    while (currpos != HWNULL && left > 0) {
+        hwcell_t currcell;
+        hwstore_read_chead(hwstore, currpos, &currcell);
+        int nextpos = currcell.next;
+        int drop = bsearch(&currpos, olds, nolds, sizeof(int), hwstore_addrcmp) != NULL;
+        if (drop) left--;
+        if (drop && !hwstore_retain(hwstore, currpos, &currcell)) {
+            hwstore_unlink(hwstore, prevpos, &prevcell, currpos, &currcell);
+            hwstore_defer(hwstore, currpos, &currcell);
+        } else {
+            prevpos = currpos;
+            prevcell = currcell;
+        }
+        currpos = nextpos;
+    }
+
+    prevpos = HWNULL;
+    for (int k = placed - 1; k >= 0; k--) {
+        hwcell_t cell;
+        hwstore_read_chead(hwstore, addrs[k], &cell);
+        if ((cell.flags & HWCELL_TOMBSTONE) != 0 && !hwstore_retain(hwstore, addrs[k], &cell)) {
+            hwstore_unlink(hwstore, prevpos, &prevcell, addrs[k], &cell);
+            hwstore_defer(hwstore, addrs[k], &cell);
+        } else {
+            prevpos = addrs[k];
+            prevcell = cell;
+        }
+    }
+    hwstore_write_shead(hwstore);
+}
+
+/*
+ * New cells are written out of used chain, each linked to previous one,
+ * deletes leave tombstone cells. Single store head write publishes whole
+ * batch on top of used chain, it shadows old versions which are freed
+ * afterwards. If space runs out, batch cells are freed and store keeps
+ * old state. Transaction ends in any case.
+ */
+int hwstore_txn_commit(hwtxn_t* hwtxn) {
+    hwstore_t* hwstore = hwtxn->hwstore;
+    long reads, writes;
+    hwstore_opbegin(hwstore, &reads, &writes);
+    hwstore_wlock(hwstore);
+
+    int* addrs = malloc((hwtxn->count + 1) * sizeof(int));
+    int placed = 0;
+    int next = HWNULL;
+    int res = 0;
+    for (int i = 0; i < hwtxn->count; i++) {
+        if (!hwstore_txn_last(hwtxn, i)) continue;
+        hwtxop_t* txop = &(hwtxn->ops[i]);
+
+        int flags = txop->op == HWTXN_DEL ? HWCELL_TOMBSTONE : 0;
+        hwcell_t cell;
+        int addr = hwstore_place(hwstore, txop->key, txop->keysize, txop->val, txop->valsize,
+                                        flags, &next, &cell);
+        if (addr < 0) {
+            res = -1;
+            break;
+        }
+        addrs[placed++] = addr;
+        next = addr;
+    }
+
+    if (res < 0) {
+        for (int i = 0; i < placed; i++) {
+            hwcell_t cell;
+            hwstore_read_chead(hwstore, addrs[i], &cell);
+            hwstore_unplace(hwstore, addrs[i], &cell);
+        }
+        hwstore_write_shead(hwstore);
+    } else if (placed > 0) {
+        /* Chain may change while space is taken, bottom is linked last */
+        hwcell_t bottomcell;
+        hwstore_read_chead(hwstore, addrs[0], &bottomcell);
+        bottomcell.next = hwstore->head;
+        hwstore_write_chead(hwstore, addrs[0], &bottomcell);
+        int* olds = malloc(placed * sizeof(int));
+        int nolds = hwstore_txn_shadowed(hwtxn, olds);
+
+        /* Commit point */
+        hwstore->head = addrs[placed - 1];
+        hwstore_write_shead(hwstore);
+
+        int k = 0;
+        for (int i = 0; i < hwtxn->count; i++) {
+            if (!hwstore_txn_last(hwtxn, i)) continue;
+            hwstore_index(hwstore, hwtxn->ops[i].key, hwtxn->ops[i].keysize, addrs[k++]);
+        }
+
+        hwstore_txn_cleanup(hwtxn, addrs, placed, olds, nolds);
+        free(olds);
+
+        /* Batch goes to log in one write, followers apply it at once */
+        for (int i = 0; i < hwtxn->count; i++) {
+            if (!hwstore_txn_last(hwtxn, i)) continue;
+            hwtxop_t* txop = &(hwtxn->ops[i]);
+            hwstore_log(hwstore, txop->op == HWTXN_SET ? HWLOG_SET : HWLOG_DEL,
+                                    txop->key, txop->keysize, txop->val, txop->valsize, 0);
+        }
+        hwstore_logflush(hwstore);
+    }
+
+    if (hwstore->hwcache != NULL) {
+        int k = 0;
+        for (int i = 0; i < hwtxn->count; i++) {
+            if (!hwstore_txn_last(hwtxn, i)) continue;
+            hwtxop_t* txop = &(hwtxn->ops[i]);
+            if (res == 0 && txop->op == HWTXN_SET) {
+                hwcache_update(hwstore->hwcache, txop->key, txop->keysize, txop->val, txop->valsize,
+                                        addrs[k], 0);
+            } else if (res == 0) {
+                hwcache_del(hwstore->hwcache, txop->key, txop->keysize);
+            }
+            k++;
+        }
+    }
+    free(addrs);
+    hwstore_txn_abort(hwtxn);
+    hwstore_sweep(hwstore, HWEXPIRE_STEP);
+    hwstore_wunlock(hwstore);
+
+    hwstore_opend(hwstore, &(hwstore->stats.commit), reads, writes);
+    return res;
+}
+
+/*
+ * Snapshot takes current version, later writes get next one. Old
+ * versions seen by snapshot are retired instead of freed, so store
+ * walks and gets of snapshot go on while writers change the store.
+ */
+void hwstore_snapshot_open(hwstore_t* hwstore, hwsnap_t* hwsnap) {
+    hwstore_wlock(hwstore);
+    hwsnap->hwstore = hwstore;
+    hwsnap->version = hwstore->version;
+    hwsnap->time = time(NULL);
+    hwsnap->cursor = HWNULL;
+
+    if (hwstore->nsnaps == hwstore->snapcapa) {
+        hwstore->snapcapa = hwstore->snapcapa == 0 ? 4 : hwstore->snapcapa * 2;
+        hwstore->snaps = realloc(hwstore->snaps, hwstore->snapcapa * sizeof(long));
+    }
+    hwstore->snaps[hwstore->nsnaps++] = hwsnap->version;
+    hwstore->version++;
+    hwstore_wunlock(hwstore);
+}
+
+void hwstore_snapshot_close(hwsnap_t* hwsnap) {
+    hwstore_t* hwstore = hwsnap->hwstore;
+    hwstore_wlock(hwstore);
+    for (int i = 0; i < hwstore->nsnaps; i++) {
+        if (hwstore->snaps[i] == hwsnap->version) {
+            hwstore->snaps[i] = hwstore->snaps[--hwstore->nsnaps];
+            break;
+        }
+    }
+    hwstore_reclaim(hwstore);
+    hwstore_wunlock(hwstore);
+}
+
+static int hwsnap_visible(hwsnap_t* hwsnap, hwcell_t* cell) {
+    if ((cell->flags & HWCELL_TOMBSTONE) != 0) return 0;
+    if (cell->version > hwsnap->version) return 0;
+    if ((cell->flags & HWCELL_RETIRED) != 0 && cell->retired <= hwsnap->version) return 0;
+    return !hwstore_expired(cell, hwsnap->time);
+}
+
+/* Value of key as of snapshot open, snapshot reads skip value cache */
+int hwstore_snapshot_get(hwsnap_t* hwsnap, char* key, int keysize, char** val) {
+    hwstore_t* hwstore = hwsnap->hwstore;
+    int addr = -1;
+    pthread_mutex_lock(&(hwstore->wlock));
+    int currpos = hwstore->head;
+    while (currpos != HWNULL) {
+        hwcell_t currcell;
+        hwstore_read_chead(hwstore, currpos, &currcell);
+        if (currcell.keysize == keysize && hwsnap_visible(hwsnap, &currcell)) {
+            char* hwkey = hwstore_read_skey(hwstore, currpos, &currcell, &(hwstore->scratch));
+            if (memcmp(key, hwkey, keysize) == 0) {
+                if (hwstore_read_value(hwstore, currpos, &currcell, key, val) < 0) {
+                    hwstore_count(&(hwstore->stats.corrupt), 1);
+                } else {
+                    addr = currpos;
+                }
+                break;
+            }
+        }
+        currpos = currcell.next;
+    }
+    pthread_mutex_unlock(&(hwstore->wlock));
+    return addr;
+}
+
+/*
+ * Iterate cells of snapshot. New cells go to chain head and visible
+ * cells are not unlinked, so walk resumes from last returned cell.
+ * Returns cell address, -1 at end.
+ */
+int hwstore_snapshot_next(hwsnap_t* hwsnap, char** key, int* keysize, char** val, int* valsize) {
+    hwstore_t* hwstore = hwsnap->hwstore;
+    if (hwsnap->cursor < 0) return -1;
+
+    pthread_mutex_lock(&(hwstore->wlock));
+    int currpos = hwstore->head;
+    if (hwsnap->cursor != HWNULL) {
+        hwcell_t cursorcell;
+        hwstore_read_chead(hwstore, hwsnap->cursor, &cursorcell);
+        currpos = cursorcell.next;
+    }
+    while (currpos != HWNULL) {
+        hwcell_t currcell;
+        hwstore_read_chead(hwstore, currpos, &currcell);
+        if (hwsnap_visible(hwsnap, &currcell)) {
+            /* Caller owns key, scratch only holds it for the copy */
+            char* skey = hwstore_read_skey(hwstore, currpos, &currcell, &(hwstore->scratch));
+            *key = malloc(currcell.keysize);
+            memcpy(*key, skey, currcell.keysize);
+            if (hwstore_read_value(hwstore, currpos, &currcell, *key, val) < 0) {
+                /* Corrupt value is skipped, walk goes on */
+                hwstore_count(&(hwstore->stats.corrupt), 1);
+                free(*key);
+                *key = NULL;
+                currpos = currcell.next;
+                continue;
+            }
+            *keysize = currcell.keysize;
+            *valsize = currcell.valsize;
+            hwsnap->cursor = currpos;
+            pthread_mutex_unlock(&(hwstore->wlock));
+            return currpos;
+        }
+        currpos = currcell.next;
+    }
+    hwsnap->cursor = -1;
+    pthread_mutex_unlock(&(hwstore->wlock));
+    return -1;
+}
+
+static int hwstore_expired(hwcell_t* cell, long now) {
+    return cell->expire != 0 && cell->expire <= now;
+}
+
+static void hwstore_add_timer(hwstore_t* hwstore, int addr, long expire) {
+    hwslot_t* slot = &(hwstore->wheel[expire % HWWHEEL_SLOTS]);
+    if (slot->count == slot->capa) {
+        slot->capa = slot->capa == 0 ? 8 : slot->capa * 2;
+        slot->timers = realloc(slot->timers, slot->capa * sizeof(hwtimer_t));
+    }
+    slot->timers[slot->count].addr = addr;
+    slot->timers[slot->count].expire = expire;
+    slot->count++;
+}
+
+int hwstore_set_ttl(hwstore_t* hwstore, char* key, int keysize, int ttl) {
+    hwstore_wlock(hwstore);
+    int addr = hwstore_setexpire(hwstore, key, keysize, ttl);
+    hwstore_wunlock(hwstore);
+    return addr;
+}
+
+static int hwstore_setexpire(hwstore_t* hwstore, char* key, int keysize, int ttl) {
+    if (hwstore->hwcache != NULL) {
+        hwcache_del(hwstore->hwcache, key, keysize);
+    }
+
+    hwcell_t currcell;
+    int addr = hwstore_find(hwstore, key, keysize, &currcell, &(hwstore->scratch));
+    if (addr < 0) return -1;
+
+    long now = time(NULL);
+    if (hwstore_expired(&currcell, now)) {
+        hwstore_free(hwstore, addr);
+        hwstore_count(&(hwstore->stats.expired), 1);
+        return -1;
+    }
+
+    /* Zero or negative ttl removes expiry */
+    currcell.expire = ttl > 0 ? now + ttl : 0;
+    hwstore_write_chead(hwstore, addr, &currcell);
+    if (ttl > 0) {
+        hwstore_add_timer(hwstore, addr, currcell.expire);
+    }
+    hwstore_log(hwstore, HWLOG_EXPIRE, key, keysize, NULL, 0, currcell.expire);
+    hwstore_logflush(hwstore);
+    return addr;
+}
+
+/* Expiry and eviction are not logged, follower does them by itself */
+static void hwstore_log(hwstore_t* hwstore, int op, char* key, int keysize, char* val, int valsize, long expire) {
+    if (hwstore->hwlog == NULL) return;
+    hwlog_add(hwstore->hwlog, op, key, keysize, val, valsize, expire);
+}
+
+static void hwstore_logflush(hwstore_t* hwstore) {
+    if (hwstore->hwlog == NULL) return;
+    hwlog_flush(hwstore->hwlog);
+}
+
+/* Apply single log record, -1 if store has no room for it */
+static int hwstore_replay(hwstore_t* hwstore, hwlogrec_t* rec, char* key, char* val) {
+    switch (rec->op & HWLOG_OPMASK) {
+        case HWLOG_SET:
+            return hwstore_set(hwstore, key, rec->keysize, val, rec->valsize) < 0 ? -1 : 0;
+        case HWLOG_DEL:
+            hwstore_del(hwstore, key, rec->keysize);
+            return 0;
+        case HWLOG_APPEND:
+            return hwstore_append(hwstore, key, rec->keysize, val, rec->valsize) < 0 ? -1 : 0;
+        case HWLOG_INCR: {
+            long delta, result;
+            memcpy(&delta, val, sizeof(long));
+            hwstore_incr(hwstore, key, rec->keysize, delta, &result);
+            return 0;
+        }
+        case HWLOG_EXPIRE: {
+            long ttl = rec->expire - time(NULL);
+            if (rec->expire == 0) {
+                hwstore_set_ttl(hwstore, key, rec->keysize, 0);
+            } else if (ttl <= 0) {
+                hwstore_del(hwstore, key, rec->keysize);
+            } else {
+                hwstore_set_ttl(hwstore, key, rec->keysize, (int)ttl);
+            }
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Follower side: read what log stream has and apply up to about budget
+ * records. Transaction batch is applied as one transaction once all its
+ * records are read. If store has no room, position stays at failed
+ * record so it can be applied again. Returns count of applied records,
+ * -1 for broken log or full store.
+ */
+int hwstore_apply(hwstore_t* hwstore, hwfollow_t* hwfollow, int budget) {
+    if (hwfollow_fill(hwfollow) < 0) return -1;
+
+    hwtxn_t hwtxn;
+    hwlogrec_t rec;
+    char *key, *val;
+    int applied = 0;
+    int batch = 0;
+    int mark = hwfollow->bufpos;
+    int res = 0;
+    while (applied < budget) {
+        if (batch == 0) mark = hwfollow->bufpos;
+        if ((res = hwfollow_next(hwfollow, &rec, &key, &val)) <= 0) break;
+
+        if (batch == 0 && (rec.op & HWLOG_MORE) == 0) {
+            if ((res = hwstore_replay(hwstore, &rec, key, val)) < 0) break;
+            hwfollow->seq = rec.seq;
+            applied++;
+            continue;
+        }
+        if (batch == 0) {
+            hwstore_txn_begin(hwstore, &hwtxn);
+        }
+        if ((rec.op & HWLOG_OPMASK) == HWLOG_DEL) {
+            hwstore_txn_del(&hwtxn, key, rec.keysize);
+        } else {
+            hwstore_txn_set(&hwtxn, key, rec.keysize, val, rec.valsize);
+        }
+        batch++;
+        if ((rec.op & HWLOG_MORE) == 0) {
+            if ((res = hwstore_txn_commit(&hwtxn)) < 0) {
+                batch = 0;
+                break;
+            }
+            hwfollow->seq = rec.seq;
+            applied += batch;
+            batch = 0;
+        }
+    }
+    if (batch > 0) {
+        hwstore_txn_abort(&hwtxn);
+    }
+    /* Unfinished batch or failed record is read again next time */
+    if (batch > 0 || res < 0) {
+        hwfollow->bufpos = mark;
+    }
+    return res < 0 ? -1 : applied;
+}
+
+/* Returns seconds to live, 0 for key without expiry, -1 for miss */
+int hwstore_ttl(hwstore_t* hwstore, char* key, int keysize) {
+    hwcell_t currcell;
+    pthread_mutex_lock(&(hwstore->wlock));
+    int addr = hwstore_find(hwstore, key, keysize, &currcell, &(hwstore->scratch));
+    pthread_mutex_unlock(&(hwstore->wlock));
+    if (addr < 0) return -1;
+
+    long now = time(NULL);
+    if (hwstore_expired(&currcell, now)) return -1;
+    if (currcell.expire == 0) return 0;
+    return (int)(currcell.expire - now);
+}
+
+/*
+ * Sweep due timers of wheel, examine at most budget timers and resume
+ * on next call. Timers of later wheel turns stay in their slot. Returns
+ * count of reclaimed cells.
+ */
+int hwstore_expire(hwstore_t* hwstore, int budget) {
+    hwstore_wlock(hwstore);
+    int reclaimed = hwstore_sweep(hwstore, budget);
+    hwstore_wunlock(hwstore);
+    return reclaimed;
+}
+
+static int hwstore_sweep(hwstore_t* hwstore, int budget) {
+    long now = time(NULL);
+    int reclaimed = 0;
+
+    /* Each slot is visited once per turn, so one turn covers any gap */
+    if (now - hwstore->wheeltick >= HWWHEEL_SLOTS) {
+        hwstore->wheeltick = now - HWWHEEL_SLOTS + 1;
+        hwstore->wheelpos = 0;
+    }
+
+    while (budget > 0) {
+        hwslot_t* slot = &(hwstore->wheel[hwstore->wheeltick % HWWHEEL_SLOTS]);
+
+        while (hwstore->wheelpos < slot->count && budget > 0) {
+            hwtimer_t timer = slot->timers[hwstore->wheelpos];
+            budget--;
+            if (timer.expire > now) {
+                hwstore->wheelpos++;
+                continue;
+            }
+            slot->count--;
+            slot->timers[hwstore->wheelpos] = slot->timers[slot->count];
+
+            /* Cell may be rewritten or freed after timer was set */
+            hwcell_t cell;
+            hwstore_read_chead(hwstore, timer.addr, &cell);
+            if (cell.expire == timer.expire && (cell.flags & HWCELL_RETIRED) == 0) {
+                hwstore_free(hwstore, timer.addr);
+                hwstore_count(&(hwstore->stats.expired), 1);
+                reclaimed++;
+            }
+        }
+        if (hwstore->wheelpos < slot->count) break;
+        if (hwstore->wheeltick >= now) break;
+        hwstore->wheeltick++;
+        hwstore->wheelpos = 0;
+    }
+    return reclaimed;
+}
+
+/*
+ * Check cell checksums in address order, extent by extent, reading the
+ * device in HWSCRUB_READ pieces until budget bytes are read or the pass
+ * ends. Each piece is read and checked under writer lock, so no cell is
+ * half written, but sequence is kept and gets go on meanwhile. Next call
+ * resumes where this one stopped. Returns count of bad cells.
+ */
+int hwstore_scrub(hwstore_t* hwstore, long budget) {
+    int bad = 0;
+    while (budget > 0) {
+        pthread_mutex_lock(&(hwstore->wlock));
+        int pos = hwstore->scrubpos != HWNULL ? hwstore->scrubpos : hwstore_firstcell(hwstore, 0);
+        int tailend = *hwstore_tailend(hwstore, pos);
+        int size = tailend - pos < HWSCRUB_READ ? tailend - pos : HWSCRUB_READ;
+        int used = 0;
+        if (size >= CELLHEAD_SIZE) {
+            char* data = hwscratch_get(&(hwstore->scratch), size);
+            hwstore_dread(hwstore, pos, data, size);
+            bad += hwstore_scrub_cells(hwstore, data, size, &used);
+            if (used == 0) {
+                /* Cell larger than one piece is read alone */
+                hwcell_t cell;
+                memcpy(&cell, data, CELLHEAD_SIZE);
+                size = CELLHEAD_SIZE + cell.capa;
+                if (size > tailend - pos) {
+                    bad++;
+                    used = -1;
+                } else {
+                    data = hwscratch_get(&(hwstore->scratch), size);
+                    hwstore_dread(hwstore, pos, data, size);
+                    bad += hwstore_scrub_cells(hwstore, data, size, &used);
+                }
+            }
+        } else {
+            size = 0;
+        }
+        budget -= size;
+        hwstore_count(&(hwstore->stats.scrubbytes), size);
+
+        /* Bounds of cells after bad header are lost, rest of extent too */
+        pos = used < 0 ? tailend : pos + used;
+        if (pos + CELLHEAD_SIZE > tailend) {
+            int extent = hwstore->nextents == 1 ? 0 : HWADDR_EXTENT(pos);
+            pos = extent + 1 < hwstore->nextents ? hwstore_firstcell(hwstore, extent + 1) : HWNULL;
+        }
+        hwstore->scrubpos = pos;
+        if (pos == HWNULL) {
+            hwstore_count(&(hwstore->stats.scrubpasses), 1);
+        }
+        pthread_mutex_unlock(&(hwstore->wlock));
+        if (pos == HWNULL) break;
+    }
+    if (bad > 0) {
+        hwstore_count(&(hwstore->stats.corrupt), bad);
+    }
+    return bad;
+}
+
+/*
+ * Check cells which lie whole in data read at scrub position. Used is
+ * set to offset of first cell left for next read, or to -1 at a bad
+ * header. Free cells have no data to check. Returns count of bad cells.
+ */
+static int hwstore_scrub_cells(hwstore_t* hwstore, char* data, int size, int* used) {
+    int bad = 0;
+    int offset = 0;
+    while (offset + CELLHEAD_SIZE <= size) {
+        hwcell_t cell;
+        memcpy(&cell, data + offset, CELLHEAD_SIZE);
+        if (cell.crc != hwcell_crc(&cell) || cell.capa < 0) {
+            *used = -1;
+            return bad + 1;
+        }
+        if (CELLHEAD_SIZE + cell.capa > size - offset) break;
+        hwstore_count(&(hwstore->stats.scrubbed), 1);
+        int datasize = hwcell_datasize(&cell);
+        if ((cell.flags & HWCELL_FREE) == 0 && (datasize > cell.capa
+            || hwcrc32c(0, data + offset + CELLHEAD_SIZE, datasize) != cell.datacrc)) {
+            bad++;
+        }
+        offset += CELLHEAD_SIZE + cell.capa + 1;
+    }
+    *used = offset;
+    return bad;
+}
+
+static void hwstore_opavg(hwopstat_t* opstat) {
+    opstat->avgreads = 0;
+    opstat->avgwrites = 0;
+    if (opstat->count > 0) {
+        opstat->avgreads = (double)opstat->reads / opstat->count;
+        opstat->avgwrites = (double)opstat->writes / opstat->count;
+    }
+}
+
+void hwstore_stats(hwstore_t* hwstore, hwstats_t* stats) {
+    *stats = hwstore->stats;
+    stats->freebytes = __atomic_load_n(&(hwstore->freecapa), __ATOMIC_RELAXED);
+    for (int i = 0; i < hwstore->nextents; i++) {
+        int tailend = i == hwstore->nextents - 1 ? hwstore->tailend : hwstore->extents[i].tailend;
+        int offset;
+        hwmemory_t* hwmemory = hwstore_device(hwstore, tailend, &offset);
+        stats->freebytes += hwmemory_size(hwmemory) - offset;
+    }
+    stats->extents = hwstore->nextents;
+    stats->metabytes = STOREHEAD_SIZE + (stats->livecells + stats->freecells) * CELLHEAD_SIZE;
+    stats->scratchgrows = hwstore->scratch.grows;
+    for (int i = 0; i < HWREADER_SLOTS; i++) {
+        stats->scratchgrows += __atomic_load_n(&(hwstore->readers[i].scratch.grows), __ATOMIC_RELAXED);
+        hwopstat_t* get = &(hwstore->readers[i].get);
+        stats->get.count += __atomic_load_n(&(get->count), __ATOMIC_RELAXED);
+        stats->get.reads += __atomic_load_n(&(get->reads), __ATOMIC_RELAXED);
+        stats->get.writes += __atomic_load_n(&(get->writes), __ATOMIC_RELAXED);
+    }
+    hwstore_opavg(&(stats->get));
+    hwstore_opavg(&(stats->set));
+    hwstore_opavg(&(stats->del));
+    hwstore_opavg(&(stats->commit));
+}
@@ -10,35 +10,276 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
+
+#include <hwcache.h>
+#include <hwlog.h>
+#include <hwindex.h>
+#include <hwcrc.h>
+#include <hwfree.h>
 
 #define HWNULL          0
 #define STORE_MAGIC     0xABBAABBA
 
+#define HWWHEEL_SLOTS   256
+#define HWEXPIRE_STEP   16
+
+#define HWEVICT_NONE    0       /* set fails when device is full */
+#define HWEVICT_CLOCK   1       /* set evicts cold cell when device is full */
+#define HWEVICT_SCAN    64      /* cells examined per eviction */
+#define HWHOT_SLOTS     4096    /* access bits set by gets, by address hash */
+
+#define HWREADER_SLOTS  64      /* concurrent lock-free gets */
+
+/*
+ * Grown store spans several devices, cell address keeps extent number
+ * in high bits and offset in extent in low bits. Extent 0 is the device
+ * given to hwstore_init, its addresses are plain offsets.
+ */
+#define HWEXTENT_BITS   24
+#define HWEXTENT_SIZE   (1 << HWEXTENT_BITS)
+#define HWEXTENT_MAX    64
+
+#define HWADDR(extent, offset)  (((extent) << HWEXTENT_BITS) | (offset))
+#define HWADDR_EXTENT(addr)     ((addr) >> HWEXTENT_BITS)
+#define HWADDR_OFFSET(addr)     ((addr) & (HWEXTENT_SIZE - 1))
+
+#define HWCELL_ACCESSED 0x1
+#define HWCELL_FREE     0x2
+#define HWCELL_CHUNKED  0x4     /* value is table of chunk addresses */
+#define HWCELL_CHUNK    0x8     /* chunk of value, next is head cell */
+#define HWCELL_TOMBSTONE    0x10    /* key deleted by transaction */
+#define HWCELL_RETIRED  0x20    /* old version kept for open snapshots */
+
+#define HWCHUNK_SIZE    256     /* values over it are chunked */
+#define HWCHUNK_STACK   64      /* chunk tables read to stack buffer */
+
+#define HWSCRUB_READ    (64 * 1024) /* bytes of one scrub read */
+
+#define HWALIGN_MAX     4096    /* largest alignment of cell starts */
+
 typedef struct __attribute__((packed)) {
     int     keysize;
     int     valsize;
     int     capa;
     int     next;
+    int     flags;
+    long    expire;     /* unix time of expiry, 0 is never */
+    long    version;    /* store version when cell was written */
+    long    retired;    /* store version when cell was replaced */
+    unsigned int    datacrc;    /* CRC32C of key and value bytes */
+    unsigned int    crc;    /* CRC32C of header fields above */
 } hwcell_t;
 
+/* Store descriptor as written to device at address 0 */
 typedef struct __attribute__((packed)) {
-    union {
-        hwmemory_t*   hwmemory;
-        int         magic;
-    };
+    int     magic;
+    int     reserved;
     int     size;
     int     head;
     int     tail;
     int     freehead;
+} hwshead_t;
+
+/* Operation counters: calls and device calls spent by them */
+typedef struct {
+    long    count;
+    long    reads;
+    long    writes;
+    double  avgreads;
+    double  avgwrites;
+} hwopstat_t;
+
+typedef struct {
+    long    livecells;
+    long    freecells;
+    long    usedchain;      /* length of head chain */
+    long    chunkcells;     /* live chunks of large values */
+    long    freechain;      /* length of freehead chain */
+    long    livebytes;      /* key and value bytes of live cells */
+    long    freebytes;      /* free cells capacity and space after tail */
+    long    wastedbytes;    /* unused capacity of live cells */
+    long    metabytes;      /* store and cell headers */
+    long    headhits;       /* allocation paths */
+    long    freehits;
+    long    tailhits;
+    long    allocfails;
+    long    expired;        /* cells reclaimed after expiry */
+    long    evicted;        /* cells reclaimed by eviction */
+    long    extents;        /* devices spanned by store */
+    long    retired;        /* old versions kept for snapshots */
+    long    deferred;       /* freed cells waiting for readers */
+    long    retries;        /* gets repeated after concurrent write */
+    long    corrupt;        /* cells failed checksum on get or scrub */
+    long    scrubbed;       /* cells checked by scrub */
+    long    scrubbytes;     /* bytes read by scrub */
+    long    scrubpasses;    /* scrubs over whole store */
+    long    padbytes;       /* space lost to cell alignment */
+    long    scratchgrows;   /* reallocations of scratch buffers */
+    hwopstat_t  get;
+    hwopstat_t  set;
+    hwopstat_t  del;
+    hwopstat_t  commit;
+} hwstats_t;
+
+typedef struct {
+    hwmemory_t* hwmemory;
+    int     tailend;    /* end of last cell of closed extent */
+} hwextent_t;
+
+/* Expiry timer, checked against cell on device before reclaim */
+typedef struct {
+    int     addr;
+    long    expire;
+} hwtimer_t;
+
+/* Old version in used chain, freed when no snapshot sees it */
+typedef struct {
+    int     addr;
+    long    version;
+    long    retired;
+} hwretire_t;
+
+/* Reused buffer for keys and cells read by walks, grows to largest need */
+typedef struct {
+    char*   data;
+    int     size;
+    int     grows;      /* times data was reallocated */
+} hwscratch_t;
+
+/* Epoch of active reader, 0 for free slot, one cache line each */
+typedef struct {
+    unsigned long   epoch;
+    hwscratch_t scratch;    /* owned by get holding the slot */
+    hwopstat_t  get;        /* gets of threads with this home slot */
+} __attribute__((aligned(64))) hwreader_t;
+
+/* Unlinked cell which readers of its epoch may still traverse */
+typedef struct {
+    int     addr;
+    unsigned long   epoch;
+} hwlimbo_t;
+
+/* Slot of timer wheel with one second granularity */
+typedef struct {
+    hwtimer_t*  timers;
+    int     count;
+    int     capa;
+} hwslot_t;
+
+typedef struct {
+    hwmemory_t* hwmemory;
+    int     size;
+    int     head;
+    int     tail;
+    int     freehead;
+    int     tailend;
+    long    freecapa;
+    hwstats_t   stats;
+    hwslot_t*   wheel;
+    long    wheeltick;
+    int     wheelpos;
+    hwcache_t*  hwcache;    /* optional value cache, not owned */
+    hwlog_t*    hwlog;      /* optional change log, not owned */
+    int     evict;
+    int     hand;       /* clock hand, cell before next candidate */
+    hwextent_t  extents[HWEXTENT_MAX];
+    int     nextents;
+    int     extsize;    /* size of new extents, 0 is no growth */
+    long    version;    /* stamp of writes, bumped by snapshot open */
+    long*   snaps;      /* versions of open snapshots */
+    int     nsnaps;
+    int     snapcapa;
+    hwretire_t* retires;
+    int     nretires;
+    int     retirecapa;
+    pthread_mutex_t wlock;  /* writers, gets take no lock */
+    unsigned long   seq;    /* odd while writer changes store */
+    unsigned long   epoch;  /* bumped after each write */
+    hwreader_t  readers[HWREADER_SLOTS];
+    hwlimbo_t*  limbo;
+    int     nlimbo;
+    int     limbocapa;
+    unsigned char*  hot;    /* access bits for CLOCK eviction */
+    hwindex_t*  hwindex;    /* optional RAM key index */
+    hwscratch_t scratch;    /* owned by holder of writer lock */
+    unsigned long   indexepoch; /* epoch of last index table swap */
+    int     scrubpos;   /* next cell for scrub, HWNULL at pass start */
+    hwfree_t*   hwfree;     /* optional RAM map of free cells */
+    int     align;      /* cell starts and sizes, 1 is none */
 } hwstore_t;
 
+/*
+ * Point-in-time view: cells written up to version and not retired by
+ * then. Visible cells stay in used chain until snapshot is closed.
+ */
+typedef struct {
+    hwstore_t*  hwstore;
+    long    version;
+    long    time;       /* expiry is checked at open time */
+    int     cursor;     /* last cell returned by next, -1 at end */
+} hwsnap_t;
+
+#define HWTXN_SET       1
+#define HWTXN_DEL       2
+
+/* Buffered operation, keeps own copy of key and value */
+typedef struct {
+    int     op;
+    char*   key;
+    int     keysize;
+    char*   val;
+    int     valsize;
+} hwtxop_t;
+
+typedef struct {
+    hwstore_t*  hwstore;
+    hwtxop_t*   ops;
+    int     count;
+    int     capa;
+} hwtxn_t;
+
 
 void hwstore_init(hwstore_t* hwstore, hwmemory_t* hwmemory);
+void hwstore_destroy(hwstore_t* hwstore);
+void hwstore_setcache(hwstore_t* hwstore, hwcache_t* hwcache);
+void hwstore_setlog(hwstore_t* hwstore, hwlog_t* hwlog);
+int hwstore_setevict(hwstore_t* hwstore, int evict);
+int hwstore_setgrow(hwstore_t* hwstore, int extsize);
+int hwstore_setindex(hwstore_t* hwstore, int enable);
+int hwstore_setbehind(hwstore_t* hwstore, long limit);
+int hwstore_setfreemap(hwstore_t* hwstore, int enable);
+int hwstore_setalign(hwstore_t* hwstore, int align);
+void hwstore_sync(hwstore_t* hwstore);
+void hwstore_iostat(hwstore_t* hwstore, hwiostat_t* iostat);
 
 int hwstore_set(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize);
 int hwstore_get(hwstore_t* hwstore, char* key, int keysize, char** val);
+int hwstore_getval(hwstore_t* hwstore, char* key, int keysize, char** val, int* valsize);
+int hwstore_getbuf(hwstore_t* hwstore, char* key, int keysize, char* buf, int bufsize, int* valsize);
 int hwstore_del(hwstore_t* hwstore, char* key, int keysize);
+int hwstore_append(hwstore_t* hwstore, char* key, int keysize, char* val, int valsize);
+int hwstore_incr(hwstore_t* hwstore, char* key, int keysize, long delta, long* result);
+
+void hwstore_txn_begin(hwstore_t* hwstore, hwtxn_t* hwtxn);
+int hwstore_txn_set(hwtxn_t* hwtxn, char* key, int keysize, char* val, int valsize);
+int hwstore_txn_del(hwtxn_t* hwtxn, char* key, int keysize);
+int hwstore_txn_commit(hwtxn_t* hwtxn);
+void hwstore_txn_abort(hwtxn_t* hwtxn);
+
+void hwstore_snapshot_open(hwstore_t* hwstore, hwsnap_t* hwsnap);
+void hwstore_snapshot_close(hwsnap_t* hwsnap);
+int hwstore_snapshot_get(hwsnap_t* hwsnap, char* key, int keysize, char** val);
+int hwstore_snapshot_next(hwsnap_t* hwsnap, char** key, int* keysize, char** val, int* valsize);
+
+int hwstore_set_ttl(hwstore_t* hwstore, char* key, int keysize, int ttl);
+int hwstore_ttl(hwstore_t* hwstore, char* key, int keysize);
+int hwstore_expire(hwstore_t* hwstore, int budget);
+int hwstore_scrub(hwstore_t* hwstore, long budget);
+
+int hwstore_apply(hwstore_t* hwstore, hwfollow_t* hwfollow, int budget);
 
 void hwstore_print(hwstore_t* hwstore);
+void hwstore_stats(hwstore_t* hwstore, hwstats_t* stats);
 
 #endif
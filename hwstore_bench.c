@@ -0,0 +1,572 @@
+/*
+ * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <hwmemory.h>
+#include <hwstore.h>
+#include <hwhist.h>
+
+/*
+ * YCSB-style workload driver: preload a key space, then run a read/write
+ * mix with uniform or zipfian key choice from one or more threads and
+ * print the result as one JSON object.
+ */
+
+#define DIST_UNIFORM    0
+#define DIST_ZIPF       1
+
+typedef struct {
+    long    ops;
+    long    keys;
+    int     readpct;
+    int     dist;
+    double  theta;
+    int     keymin;
+    int     keymax;
+    int     valmin;
+    int     valmax;
+    int     threads;
+    int     memsize;
+    long    seed;
+    int     buckets;
+    hwcost_t    cost;
+    int     nbanks;
+    int     stripe;
+    long    vstart;
+    char*   trace;
+    long    cachesize;
+    int     evict;
+    int     extsize;
+    int     index;
+    int     freemap;
+    int     align;
+    long    behind;
+    int     scrub;
+} bconf_t;
+
+typedef struct {
+    long    items;
+    double  theta;
+    double  alpha;
+    double  zetan;
+    double  eta;
+    double  half;
+} bzipf_t;
+
+typedef struct {
+    bconf_t*    conf;
+    bzipf_t*    zipf;
+    hwstore_t*  hwstore;
+    hwmemory_t* hwmemory;
+    int         id;
+    unsigned long rnd;
+    hwhist_t    readhist;
+    hwhist_t    writehist;
+    long        misses;
+    long        errors;
+} bthread_t;
+
+static pthread_mutex_t storelock = PTHREAD_MUTEX_INITIALIZER;
+static long storeclock = 0;
+
+static long getnanotime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L * 1000L * 1000L + ts.tv_nsec;
+}
+
+/* Op latency as client sees it, thread model clock adds simulated time */
+static long bclock(bthread_t* bthread) {
+    long now = getnanotime();
+    if (bthread->conf->cost.virtual) {
+        now += hwmemory_tclock();
+    }
+    return now;
+}
+
+/* Writers lock is also held on model timeline, gets take no lock */
+static void block(void) {
+    pthread_mutex_lock(&storelock);
+    hwmemory_tsync(storeclock);
+}
+
+static void bunlock(void) {
+    storeclock = hwmemory_tclock();
+    pthread_mutex_unlock(&storelock);
+}
+
+/* Model timeline end over all extents of store */
+static long bvclock(hwstore_t* hwstore) {
+    long vclock = 0;
+    for (int i = 0; i < hwstore->nextents; i++) {
+        hwmemory_t* hwmemory = hwstore->extents[i].hwmemory;
+        long extclock = hwmemory_vorigin(hwmemory) + hwmemory_vclock(hwmemory);
+        if (extclock > vclock) vclock = extclock;
+    }
+    return vclock;
+}
+
+static unsigned long brand(unsigned long* state) {
+    /* xorshift64* */
+    unsigned long x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DUL;
+}
+
+static double brand01(unsigned long* state) {
+    return (brand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static unsigned long bhash(unsigned long x) {
+    /* FNV-1a over the bytes of x */
+    unsigned long hash = 0xCBF29CE484222325UL;
+    for (int i = 0; i < 8; i++) {
+        hash ^= (x >> (i * 8)) & 0xFF;
+        hash *= 0x100000001B3UL;
+    }
+    return hash;
+}
+
+static void bzipf_init(bzipf_t* zipf, long items, double theta) {
+    double zeta2 = 0;
+    double zetan = 0;
+    for (long i = 1; i <= items; i++) {
+        double term = 1.0 / pow((double)i, theta);
+        zetan += term;
+        if (i <= 2) zeta2 += term;
+    }
+    zipf->items = items;
+    zipf->theta = theta;
+    zipf->zetan = zetan;
+    zipf->alpha = 1.0 / (1.0 - theta);
+    zipf->eta = (1.0 - pow(2.0 / items, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    zipf->half = 1.0 + pow(0.5, theta);
+}
+
+static long bzipf_next(bzipf_t* zipf, unsigned long* state) {
+    double u = brand01(state);
+    double uz = u * zipf->zetan;
+    long rank;
+    if (uz < 1.0) {
+        rank = 0;
+    } else if (uz < zipf->half) {
+        rank = 1;
+    } else {
+        rank = (long)(zipf->items * pow(zipf->eta * u - zipf->eta + 1.0, zipf->alpha));
+    }
+    if (rank >= zipf->items) rank = zipf->items - 1;
+    /* Scramble ranks so hot keys are spread over the key space */
+    return (long)(bhash(rank) % zipf->items);
+}
+
+static int bsize(int min, int max, unsigned long seed) {
+    if (max <= min) return min;
+    return min + (int)(seed % (unsigned long)(max - min + 1));
+}
+
+static int bmakekey(bconf_t* conf, long keyid, char* key) {
+    /* Key size and contents depend only on key id */
+    int keysize = bsize(conf->keymin, conf->keymax, bhash(keyid ^ 0x5A5A));
+    char digits[32];
+    int len = snprintf(digits, sizeof(digits), "k%ld", keyid);
+    for (int i = 0; i < keysize; i++) {
+        key[i] = i < len ? digits[i] : (char)('a' + (keyid + i) % 26);
+    }
+    return keysize;
+}
+
+static int bmakeval(bconf_t* conf, unsigned long* state, char* val) {
+    int valsize = bsize(conf->valmin, conf->valmax, brand(state));
+    char fill = (char)('A' + brand(state) % 26);
+    memset(val, fill, valsize);
+    return valsize;
+}
+
+static long bnextkey(bthread_t* bthread) {
+    if (bthread->conf->dist == DIST_ZIPF) {
+        return bzipf_next(bthread->zipf, &bthread->rnd);
+    }
+    return (long)(brand(&bthread->rnd) % (unsigned long)bthread->conf->keys);
+}
+
+static void* bthread_run(void* arg) {
+    bthread_t* bthread = (bthread_t*)arg;
+    bconf_t* conf = bthread->conf;
+
+    char* key = malloc(conf->keymax);
+    char* val = malloc(conf->valmax);
+
+    hwmemory_tsync(conf->vstart);
+
+    long ops = conf->ops / conf->threads;
+    if (bthread->id < conf->ops % conf->threads) ops++;
+
+    for (long i = 0; i < ops; i++) {
+        long keyid = bnextkey(bthread);
+        int keysize = bmakekey(conf, keyid, key);
+        int isread = (int)(brand(&bthread->rnd) % 100) < conf->readpct;
+
+        if (isread) {
+            char* rval = NULL;
+            long start = bclock(bthread);
+            int addr = hwstore_get(bthread->hwstore, key, keysize, &rval);
+            hwhist_add(&bthread->readhist, bclock(bthread) - start);
+            if (addr < 0) bthread->misses++;
+            free(rval);
+        } else {
+            int valsize = bmakeval(conf, &bthread->rnd, val);
+            long start = bclock(bthread);
+            block();
+            int addr = hwstore_set(bthread->hwstore, key, keysize, val, valsize);
+            bunlock();
+            hwhist_add(&bthread->writehist, bclock(bthread) - start);
+            if (addr < 0) bthread->errors++;
+        }
+    }
+    free(key);
+    free(val);
+    return NULL;
+}
+
+static int bparse_range(char* arg, int* min, int* max) {
+    if (sscanf(arg, "%d:%d", min, max) == 2) return 0;
+    if (sscanf(arg, "%d", min) == 1) {
+        *max = *min;
+        return 0;
+    }
+    return -1;
+}
+
+static int bparse_cost(char* arg, hwcost_t* cost) {
+    long opnsec, rnsec, wnsec;
+    int block = 1;
+    int n = sscanf(arg, "%ld:%ld:%ld:%d", &opnsec, &rnsec, &wnsec, &block);
+    if (n < 3) return -1;
+    cost->opnsec = opnsec;
+    cost->rnsec = rnsec;
+    cost->wnsec = wnsec;
+    cost->block = block;
+    return 0;
+}
+
+static void busage(char* name) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -n ops        operations in run phase (default 1000)\n"
+        "  -k keys       size of key space, preloaded (default 32)\n"
+        "  -r percent    share of reads, rest are sets (default 50)\n"
+        "  -d dist       key choice: uniform or zipf (default zipf)\n"
+        "  -z theta      zipf skew (default 0.99)\n"
+        "  -K min[:max]  key size in bytes (default 8:16)\n"
+        "  -V min[:max]  value size in bytes (default 16:64)\n"
+        "  -t threads    client threads (default 1)\n"
+        "  -m bytes      device size (default 1048576)\n"
+        "  -s seed       random seed (default 1)\n"
+        "  -c op:r:w[:block]  device cost, ns per op, per read and write byte\n"
+        "  -v            virtual device clock, no real sleeping\n"
+        "  -b banks:stripe    device banks interleaved by stripe bytes (default 1)\n"
+        "  -T path       record device trace of run phase\n"
+        "  -C bytes      value cache budget (default 0, no cache)\n"
+        "  -E            evict cold cells when device is full\n"
+        "  -G bytes      grow store by extents of this size (default 0, no growth)\n"
+        "  -I            keep RAM key index\n"
+        "  -A            keep RAM map of free cells\n"
+        "  -B bytes      align cells to bytes, power of two from 64 (default 1, none)\n"
+        "  -W bytes      write-behind buffer limit (default 0, write through)\n"
+        "  -S            time one scrub pass over store after run\n"
+        "  -H            dump histogram buckets\n",
+        name);
+}
+
+int main(int argc, char **argv) {
+    bconf_t conf = {
+        .ops = 1000,
+        .keys = 32,
+        .readpct = 50,
+        .dist = DIST_ZIPF,
+        .theta = 0.99,
+        .keymin = 8,
+        .keymax = 16,
+        .valmin = 16,
+        .valmax = 64,
+        .threads = 1,
+        .memsize = 1024 * 1024,
+        .seed = 1,
+        .buckets = 0,
+        .nbanks = 1,
+        .stripe = 0,
+        .trace = NULL,
+        .cachesize = 0,
+        .evict = HWEVICT_NONE,
+        .extsize = 0,
+        .index = 0,
+        .freemap = 0,
+        .align = 1,
+        .behind = 0,
+        .scrub = 0,
+    };
+
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 0);
+    hwmemory_getcost(&hwmemory, &conf.cost);
+    hwmemory_destroy(&hwmemory);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:k:r:d:z:K:V:t:m:s:c:vb:T:C:EG:IW:SAB:H")) != -1) {
+        switch (opt) {
+            case 'n': conf.ops = atol(optarg); break;
+            case 'k': conf.keys = atol(optarg); break;
+            case 'r': conf.readpct = atoi(optarg); break;
+            case 'd':
+                if (strcmp(optarg, "uniform") == 0) {
+                    conf.dist = DIST_UNIFORM;
+                } else if (strcmp(optarg, "zipf") == 0) {
+                    conf.dist = DIST_ZIPF;
+                } else {
+                    busage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'z': conf.theta = atof(optarg); break;
+            case 'K':
+                if (bparse_range(optarg, &conf.keymin, &conf.keymax) < 0) {
+                    busage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'V':
+                if (bparse_range(optarg, &conf.valmin, &conf.valmax) < 0) {
+                    busage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 't': conf.threads = atoi(optarg); break;
+            case 'm': conf.memsize = atoi(optarg); break;
+            case 's': conf.seed = atol(optarg); break;
+            case 'c':
+                if (bparse_cost(optarg, &conf.cost) < 0) {
+                    busage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'v': conf.cost.virtual = 1; break;
+            case 'b':
+                if (sscanf(optarg, "%d:%d", &conf.nbanks, &conf.stripe) != 2) {
+                    busage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'T': conf.trace = optarg; break;
+            case 'C': conf.cachesize = atol(optarg); break;
+            case 'E': conf.evict = HWEVICT_CLOCK; break;
+            case 'G': conf.extsize = atoi(optarg); break;
+            case 'I': conf.index = 1; break;
+            case 'A': conf.freemap = 1; break;
+            case 'B': conf.align = atoi(optarg); break;
+            case 'W': conf.behind = atol(optarg); break;
+            case 'S': conf.scrub = 1; break;
+            case 'H': conf.buckets = 1; break;
+            default:
+                busage(argv[0]);
+                return 1;
+        }
+    }
+    if (conf.keys < 1 || conf.threads < 1 || conf.keymax < conf.keymin
+        || conf.valmax < conf.valmin || conf.theta <= 0 || conf.theta >= 1) {
+        busage(argv[0]);
+        return 1;
+    }
+    /* Keys shorter than their decimal id would collide */
+    char digits[32];
+    int idlen = snprintf(digits, sizeof(digits), "k%ld", conf.keys - 1);
+    if (conf.keymin < idlen) conf.keymin = idlen;
+    if (conf.keymax < conf.keymin) conf.keymax = conf.keymin;
+
+    hwmemory_init(&hwmemory, conf.memsize);
+    hwmemory_setcost(&hwmemory, &conf.cost);
+    if (hwmemory_setbanks(&hwmemory, conf.nbanks, conf.stripe) < 0) {
+        busage(argv[0]);
+        return 1;
+    }
+
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+    hwstore_setevict(&hwstore, conf.evict);
+    hwstore_setindex(&hwstore, conf.index);
+    hwstore_setfreemap(&hwstore, conf.freemap);
+    if (hwstore_setalign(&hwstore, conf.align) < 0) {
+        busage(argv[0]);
+        return 1;
+    }
+    if (hwstore_setbehind(&hwstore, conf.behind) < 0) {
+        busage(argv[0]);
+        return 1;
+    }
+    if (hwstore_setgrow(&hwstore, conf.extsize) < 0) {
+        busage(argv[0]);
+        return 1;
+    }
+    hwcache_t hwcache;
+    hwcache_init(&hwcache, conf.cachesize);
+    if (conf.cachesize > 0) {
+        hwstore_setcache(&hwstore, &hwcache);
+    }
+
+    bzipf_t zipf;
+    if (conf.dist == DIST_ZIPF) {
+        bzipf_init(&zipf, conf.keys, conf.theta);
+    }
+
+    /* Load phase */
+    unsigned long loadrnd = conf.seed * 0x9E3779B97F4A7C15UL + 1;
+    char* key = malloc(conf.keymax);
+    char* val = malloc(conf.valmax);
+    for (long keyid = 0; keyid < conf.keys; keyid++) {
+        int keysize = bmakekey(&conf, keyid, key);
+        int valsize = bmakeval(&conf, &loadrnd, val);
+        if (hwstore_set(&hwstore, key, keysize, val, valsize) < 0) {
+            fprintf(stderr, "load failed at key %ld, device too small\n", keyid);
+            return 1;
+        }
+    }
+    free(key);
+    free(val);
+    hwstore_sync(&hwstore);
+
+    /* Run phase */
+    hwiostat_t iostart;
+    hwstore_iostat(&hwstore, &iostart);
+    long vstart = bvclock(&hwstore);
+    conf.vstart = vstart;
+    storeclock = vstart;
+    if (conf.trace != NULL && hwmemory_trace_open(&hwmemory, conf.trace) < 0) {
+        fprintf(stderr, "cannot open trace %s\n", conf.trace);
+        return 1;
+    }
+
+    bthread_t* bthreads = calloc(conf.threads, sizeof(bthread_t));
+    pthread_t* tids = calloc(conf.threads, sizeof(pthread_t));
+    for (int i = 0; i < conf.threads; i++) {
+        bthreads[i].conf = &conf;
+        bthreads[i].zipf = &zipf;
+        bthreads[i].hwstore = &hwstore;
+        bthreads[i].hwmemory = &hwmemory;
+        bthreads[i].id = i;
+        bthreads[i].rnd = (conf.seed + i + 1) * 0x9E3779B97F4A7C15UL;
+        hwhist_init(&bthreads[i].readhist);
+        hwhist_init(&bthreads[i].writehist);
+    }
+
+    long start = getnanotime();
+    for (int i = 0; i < conf.threads; i++) {
+        pthread_create(&tids[i], NULL, bthread_run, &bthreads[i]);
+    }
+    for (int i = 0; i < conf.threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    /* Buffered writes are part of run */
+    hwstore_sync(&hwstore);
+    long elapsed = getnanotime() - start;
+    hwmemory_trace_close(&hwmemory);
+    long devtime = bvclock(&hwstore) - vstart;
+    /* In virtual mode run time is the model time of the last transfer */
+    if (conf.cost.virtual) elapsed += devtime;
+
+    hwiostat_t iostat;
+    hwstore_iostat(&hwstore, &iostat);
+    iostat.rcalls -= iostart.rcalls;
+    iostat.rbytes -= iostart.rbytes;
+    iostat.rnsec -= iostart.rnsec;
+    iostat.wcalls -= iostart.wcalls;
+    iostat.wbytes -= iostart.wbytes;
+    iostat.wnsec -= iostart.wnsec;
+
+    hwstats_t stats;
+    hwstore_stats(&hwstore, &stats);
+    hwcstats_t cstats;
+    hwcache_stats(&hwcache, &cstats);
+
+    /* Scrub pass is timed apart from run, its reads are not in iostat */
+    long scrubnsec = 0;
+    int scrubbad = 0;
+    hwstats_t scrubstats = stats;
+    if (conf.scrub) {
+        long sstart = getnanotime();
+        long svstart = bvclock(&hwstore);
+        scrubbad = hwstore_scrub(&hwstore, LONG_MAX);
+        scrubnsec = getnanotime() - sstart;
+        if (conf.cost.virtual) scrubnsec += bvclock(&hwstore) - svstart;
+        hwstore_stats(&hwstore, &scrubstats);
+    }
+
+    hwhist_t readhist;
+    hwhist_t writehist;
+    hwhist_init(&readhist);
+    hwhist_init(&writehist);
+    long misses = 0;
+    long errors = 0;
+    for (int i = 0; i < conf.threads; i++) {
+        hwhist_merge(&readhist, &bthreads[i].readhist);
+        hwhist_merge(&writehist, &bthreads[i].writehist);
+        misses += bthreads[i].misses;
+        errors += bthreads[i].errors;
+    }
+
+    double seconds = elapsed / 1e9;
+    double ops = (double)(conf.ops > 0 ? conf.ops : 1);
+
+    printf("{\"workload\":{\"ops\":%ld,\"keys\":%ld,\"readpct\":%d,\"dist\":\"%s\",\"theta\":%.3f,"
+            "\"keysize\":[%d,%d],\"valsize\":[%d,%d],\"threads\":%d,\"memsize\":%d,\"seed\":%ld,"
+            "\"cost\":{\"opnsec\":%ld,\"rnsec\":%ld,\"wnsec\":%ld,\"block\":%d,\"virtual\":%d},"
+            "\"banks\":%d,\"stripe\":%d},",
+            conf.ops, conf.keys, conf.readpct, conf.dist == DIST_ZIPF ? "zipf" : "uniform", conf.theta,
+            conf.keymin, conf.keymax, conf.valmin, conf.valmax, conf.threads, conf.memsize, conf.seed,
+            conf.cost.opnsec, conf.cost.rnsec, conf.cost.wnsec, conf.cost.block, conf.cost.virtual,
+            conf.nbanks, conf.stripe);
+    printf("\"seconds\":%.6f,\"opsps\":%.1f,\"misses\":%ld,\"errors\":%ld,",
+            seconds, seconds > 0 ? conf.ops / seconds : 0.0, misses, errors);
+    printf("\"device\":{\"devnsec\":%ld,\"rcalls\":%ld,\"rbytes\":%ld,\"rnsec\":%ld,\"wcalls\":%ld,\"wbytes\":%ld,\"wnsec\":%ld,"
+            "\"rcalls_per_op\":%.1f,\"rbytes_per_op\":%.1f,\"wcalls_per_op\":%.1f,\"wbytes_per_op\":%.1f},",
+            devtime, iostat.rcalls, iostat.rbytes, iostat.rnsec, iostat.wcalls, iostat.wbytes, iostat.wnsec,
+            iostat.rcalls / ops, iostat.rbytes / ops, iostat.wcalls / ops, iostat.wbytes / ops);
+    printf("\"store\":{\"livecells\":%ld,\"freecells\":%ld,\"livebytes\":%ld,\"freebytes\":%ld,"
+            "\"wastedbytes\":%ld,\"headhits\":%ld,\"freehits\":%ld,\"tailhits\":%ld,\"allocfails\":%ld,\"evicted\":%ld,\"extents\":%ld,\"chunkcells\":%ld,"
+            "\"align\":%d,\"padbytes\":%ld},",
+            stats.livecells, stats.freecells, stats.livebytes, stats.freebytes,
+            stats.wastedbytes, stats.headhits, stats.freehits, stats.tailhits, stats.allocfails, stats.evicted, stats.extents, stats.chunkcells,
+            conf.align, stats.padbytes);
+    printf("\"cache\":{\"budget\":%ld,\"bytes\":%ld,\"count\":%ld,\"hits\":%ld,\"misses\":%ld,"
+            "\"admits\":%ld,\"promotes\":%ld,\"evicts\":%ld},",
+            cstats.budget, cstats.bytes, cstats.count, cstats.hits, cstats.misses,
+            cstats.admits, cstats.promotes, cstats.evicts);
+    if (conf.scrub) {
+        long scrubbytes = scrubstats.scrubbytes - stats.scrubbytes;
+        printf("\"scrub\":{\"seconds\":%.6f,\"cells\":%ld,\"bytes\":%ld,\"mbps\":%.1f,\"bad\":%d,\"hardware\":%d},",
+                scrubnsec / 1e9, scrubstats.scrubbed - stats.scrubbed, scrubbytes,
+                scrubnsec > 0 ? scrubbytes * 1e3 / scrubnsec : 0.0, scrubbad, hwcrc_hardware());
+    }
+    printf("\"latency_ns\":{\"read\":");
+    hwhist_json(&readhist, stdout, conf.buckets);
+    printf(",\"write\":");
+    hwhist_json(&writehist, stdout, conf.buckets);
+    printf("}}\n");
+
+    free(bthreads);
+    free(tids);
+    hwstore_destroy(&hwstore);
+    hwcache_destroy(&hwcache);
+    hwmemory_destroy(&hwmemory);
+    return errors > 0 ? 1 : 0;
+}
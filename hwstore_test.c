@@ -2,20 +2,1409 @@
  * Copyright 2023 Oleg Borodin  <borodin@unix7.org>
  */
 
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <hwmemory.h>
 #include <hwstore.h>
+#include <hwfixed.h>
+
+HWFIXED_DEFINE(fix16, 8, 16)
+
+typedef struct {
+    hwmemory_t* hwmemory;
+    int     pos;
+    long    start;
+} bankarg_t;
+
+static void* bank_writer(void* arg) {
+    bankarg_t* bankarg = (bankarg_t*)arg;
+    char buffer[16] = { 0 };
+    hwmemory_tsync(bankarg->start);
+    hwmemory_write(bankarg->hwmemory, bankarg->pos, buffer, sizeof(buffer));
+    return NULL;
+}
+
+static int test_banks(void) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024);
+    hwcost_t cost = { .opnsec = 100, .rnsec = 10, .wnsec = 10, .block = 1, .virtual = 1 };
+    hwmemory_setcost(&hwmemory, &cost);
+    hwmemory_setbanks(&hwmemory, 4, 16);
+
+    /* Striped transfer is served by all banks at once */
+    char buffer[64] = { 0 };
+    long start = hwmemory_tclock();
+    hwmemory_write(&hwmemory, 0, buffer, sizeof(buffer));
+    long striped = hwmemory_tclock() - start;
+
+    /* Threads on different banks overlap, on same bank queue */
+    long clock = hwmemory_vclock(&hwmemory);
+    pthread_t tids[2];
+    bankarg_t args[2] = { { &hwmemory, 0, clock }, { &hwmemory, 16, clock } };
+    for (int i = 0; i < 2; i++) pthread_create(&tids[i], NULL, bank_writer, &args[i]);
+    for (int i = 0; i < 2; i++) pthread_join(tids[i], NULL);
+    long parallel = hwmemory_vclock(&hwmemory) - clock;
+
+    clock = hwmemory_vclock(&hwmemory);
+    args[0].start = args[1].start = clock;
+    args[1].pos = 64;
+    for (int i = 0; i < 2; i++) pthread_create(&tids[i], NULL, bank_writer, &args[i]);
+    for (int i = 0; i < 2; i++) pthread_join(tids[i], NULL);
+    long serial = hwmemory_vclock(&hwmemory) - clock;
+
+    hwmemory_destroy(&hwmemory);
+    printf("banks striped = %ld, parallel = %ld, serial = %ld\n", striped, parallel, serial);
+    if (striped != 100 + 16 * 10 || parallel != 100 + 16 * 10 || serial != 2 * (100 + 16 * 10)) {
+        printf("banks mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_trace(void) {
+    char devpath[] = "/tmp/hwstore_dev.XXXXXX";
+    char tracepath[] = "/tmp/hwstore_trace.XXXXXX";
+    close(mkstemp(devpath));
+    close(mkstemp(tracepath));
+
+    /* File backend with trace of two transfers */
+    hwmemory_t hwmemory;
+    if (hwmemory_open(&hwmemory, devpath, 1024) < 0) {
+        printf("cannot open %s\n", devpath);
+        return 1;
+    }
+    hwcost_t cost = { .opnsec = 100, .rnsec = 1, .wnsec = 1, .block = 1, .virtual = 1 };
+    hwmemory_setcost(&hwmemory, &cost);
+    hwmemory_trace_open(&hwmemory, tracepath);
+
+    char data[] = "hello";
+    char rdata[sizeof(data)] = { 0 };
+    hwmemory_write(&hwmemory, 100, data, sizeof(data));
+    hwmemory_read(&hwmemory, 100, rdata, sizeof(rdata));
+    hwmemory_destroy(&hwmemory);
+
+    FILE* trace = fopen(tracepath, "rb");
+    hwtracehead_t head;
+    hwtrace_t records[3];
+    int nhead = fread(&head, sizeof(head), 1, trace);
+    int nrecords = fread(records, sizeof(hwtrace_t), 3, trace);
+    fclose(trace);
+    unlink(devpath);
+    unlink(tracepath);
+
+    printf("trace records = %d, data = %s\n", nrecords, rdata);
+    if (nhead != 1 || head.size != 1024 || nrecords != 2 || strcmp(rdata, data) != 0
+        || records[0].op != HWTRACE_WRITE || records[1].op != HWTRACE_READ
+        || records[1].pos != 100 || records[1].nsec != 100 + (int)sizeof(data)) {
+        printf("trace mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_iov(void) {
+    char devpath[] = "/tmp/hwstore_dev.XXXXXX";
+    close(mkstemp(devpath));
+
+    hwmemory_t hwmemory;
+    if (hwmemory_open(&hwmemory, devpath, 1024) < 0) {
+        printf("cannot open %s\n", devpath);
+        return 1;
+    }
+    hwcost_t cost = { .opnsec = 100, .rnsec = 1, .wnsec = 1, .block = 1, .virtual = 1 };
+    hwmemory_setcost(&hwmemory, &cost);
+
+    /* Three buffers written and two read back, one operation each */
+    struct iovec iov[3];
+    iov[0].iov_base = "he";
+    iov[0].iov_len = 2;
+    iov[1].iov_base = "ll";
+    iov[1].iov_len = 2;
+    iov[2].iov_base = "o";
+    iov[2].iov_len = 2;
+    int wsize = hwmemory_writev(&hwmemory, 200, iov, 3);
+
+    char head[4] = { 0 };
+    char tail[3] = { 0 };
+    iov[0].iov_base = head;
+    iov[0].iov_len = 3;
+    iov[1].iov_base = tail;
+    iov[1].iov_len = 3;
+    int rsize = hwmemory_readv(&hwmemory, 200, iov, 2);
+    int over = hwmemory_readv(&hwmemory, 1020, iov, 2);
+    long clock = hwmemory_tclock();
+
+    hwiostat_t iostat;
+    hwmemory_iostat(&hwmemory, &iostat);
+    hwmemory_destroy(&hwmemory);
+    unlink(devpath);
+
+    printf("iov sizes = %d/%d, data = %s%s, calls = %ld/%ld\n", wsize, rsize, head, tail,
+                iostat.wcalls, iostat.rcalls);
+    if (wsize != 6 || rsize != 6 || over != -1 || strcmp(head, "hel") != 0 || strcmp(tail, "lo") != 0
+        || iostat.wcalls != 1 || iostat.rcalls != 1 || clock < 2 * (100 + 6)) {
+        printf("iov mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_ttl(void) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 4);
+    hwcost_t cost = { .opnsec = 100, .rnsec = 1, .wnsec = 1, .block = 1, .virtual = 1 };
+    hwmemory_setcost(&hwmemory, &cost);
+
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+
+    hwstore_set(&hwstore, "lazy", 5, "v1", 3);
+    hwstore_set(&hwstore, "swept", 6, "v2", 3);
+    hwstore_set(&hwstore, "kept", 5, "v3", 3);
+    hwstore_set_ttl(&hwstore, "lazy", 5, 1);
+    hwstore_set_ttl(&hwstore, "swept", 6, 1);
+    int ttl = hwstore_ttl(&hwstore, "lazy", 5);
+    int nottl = hwstore_ttl(&hwstore, "kept", 5);
+
+    sleep(1);
+
+    char* val = NULL;
+    int lazy = hwstore_get(&hwstore, "lazy", 5, &val);
+    int swept = hwstore_expire(&hwstore, 100);
+    int kept = hwstore_get(&hwstore, "kept", 5, &val);
+    free(val);
+
+    hwstats_t stats;
+    hwstore_stats(&hwstore, &stats);
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+
+    printf("ttl = %d, no ttl = %d, lazy = %d, swept = %d, expired = %ld\n", ttl, nottl, lazy, swept, stats.expired);
+    if (ttl != 1 || nottl != 0 || lazy != -1 || swept != 1 || kept < 0
+        || stats.expired != 2 || stats.livecells != 1) {
+        printf("ttl mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_cache(void) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 4);
+    hwcost_t cost = { .opnsec = 100, .rnsec = 1, .wnsec = 1, .block = 1, .virtual = 1 };
+    hwmemory_setcost(&hwmemory, &cost);
+
+    hwcache_t hwcache;
+    hwcache_init(&hwcache, 1024 * 4);
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+    hwstore_setcache(&hwstore, &hwcache);
+
+    hwstore_set(&hwstore, "hot", 4, "v1", 3);
+    char* val = NULL;
+    hwstore_get(&hwstore, "hot", 4, &val);
+    free(val);
+
+    /* Second get is served from cache without device reads */
+    hwiostat_t before, after;
+    hwmemory_iostat(&hwmemory, &before);
+    hwstore_get(&hwstore, "hot", 4, &val);
+    hwmemory_iostat(&hwmemory, &after);
+    int hitreads = (int)(after.rcalls - before.rcalls);
+    free(val);
+
+    /* Set and del must not leave stale values in cache */
+    hwstore_set(&hwstore, "hot", 4, "value2", 7);
+    hwstore_get(&hwstore, "hot", 4, &val);
+    int updated = strcmp(val, "value2") == 0;
+    free(val);
+    val = NULL;
+    hwstore_del(&hwstore, "hot", 4);
+    int deleted = hwstore_get(&hwstore, "hot", 4, &val);
+
+    hwcstats_t stats;
+    hwcache_stats(&hwcache, &stats);
+    hwstore_destroy(&hwstore);
+    hwcache_destroy(&hwcache);
+    hwmemory_destroy(&hwmemory);
+
+    printf("cache hit reads = %d, hits = %ld, misses = %ld\n", hitreads, stats.hits, stats.misses);
+    if (hitreads != 0 || !updated || deleted != -1 || stats.hits != 2 || stats.count != 0) {
+        printf("cache mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_evict(void) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 + 128);
+    hwcost_t cost = { .opnsec = 100, .rnsec = 1, .wnsec = 1, .block = 1, .virtual = 1 };
+    hwmemory_setcost(&hwmemory, &cost);
+
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+    hwstore_setevict(&hwstore, HWEVICT_CLOCK);
+
+    /* Device holds about twenty cells, hot key is read between sets */
+    int fails = 0;
+    char* val = NULL;
+    hwstore_set(&hwstore, "hot00", 6, "VALUE", 6);
+    for (int i = 0; i < 100; i++) {
+        char key[16];
+        sprintf(key, "key%02d", i);
+        if (hwstore_set(&hwstore, key, 6, "value", 6) < 0) fails++;
+        if (hwstore_get(&hwstore, "hot00", 6, &val) < 0) fails++;
+        free(val);
+        val = NULL;
+    }
+    int last = hwstore_get(&hwstore, "key99", 6, &val);
+    free(val);
+
+    /* Record larger than any cell takes merged neighbours */
+    char big[200];
+    memset(big, 'B', sizeof(big));
+    int merged = hwstore_set(&hwstore, "big", 4, big, sizeof(big));
+
+    hwstats_t stats;
+    hwstore_stats(&hwstore, &stats);
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+
+    printf("evict live = %ld, evicted = %ld, fails = %d\n", stats.livecells, stats.evicted, fails);
+    if (fails != 0 || last < 0 || merged < 0 || stats.evicted == 0 || stats.allocfails != 0) {
+        printf("evict mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_grow(void) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024);
+    hwcost_t cost = { .opnsec = 100, .rnsec = 1, .wnsec = 1, .block = 1, .virtual = 1 };
+    hwmemory_setcost(&hwmemory, &cost);
+
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+    hwstore_setgrow(&hwstore, 1024);
+
+    /* About four devices of data, first cells must stay readable */
+    int fails = 0;
+    for (int i = 0; i < 100; i++) {
+        char key[16];
+        sprintf(key, "key%02d", i);
+        if (hwstore_set(&hwstore, key, 6, "value-value", 12) < 0) fails++;
+    }
+    for (int i = 0; i < 100; i += 9) {
+        char key[16];
+        char* val = NULL;
+        sprintf(key, "key%02d", i);
+        if (hwstore_get(&hwstore, key, 6, &val) < 0 || strcmp(val, "value-value") != 0) fails++;
+        free(val);
+    }
+
+    hwstats_t stats;
+    hwstore_stats(&hwstore, &stats);
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+
+    printf("grow live = %ld, extents = %ld, fails = %d\n", stats.livecells, stats.extents, fails);
+    if (fails != 0 || stats.livecells != 100 || stats.extents < 4) {
+        printf("grow mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_chunks(void) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 4);
+    hwcost_t cost = { .opnsec = 100, .rnsec = 1, .wnsec = 1, .block = 1, .virtual = 1 };
+    hwmemory_setcost(&hwmemory, &cost);
+
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+
+    /* Fill device with small cells, free every other one */
+    char small[HWCHUNK_SIZE];
+    memset(small, 's', sizeof(small));
+    int count = 0;
+    char key[16];
+    for (;;) {
+        sprintf(key, "key%02d", count);
+        if (hwstore_set(&hwstore, key, 6, small, sizeof(small)) < 0) break;
+        count++;
+    }
+    for (int i = 0; i < count; i += 2) {
+        sprintf(key, "key%02d", i);
+        hwstore_del(&hwstore, key, 6);
+    }
+
+    /* No free region holds it whole, chunks fit into freed cells */
+    char big[HWCHUNK_SIZE * 3 + 10];
+    for (int i = 0; i < (int)sizeof(big); i++) big[i] = (char)('a' + i % 26);
+    int addr = hwstore_set(&hwstore, "big", 4, big, sizeof(big));
+    char* val = NULL;
+    int same = hwstore_get(&hwstore, "big", 4, &val) == addr && memcmp(val, big, sizeof(big)) == 0;
+    free(val);
+
+    hwstats_t stats;
+    hwstore_stats(&hwstore, &stats);
+    hwstore_del(&hwstore, "big", 4);
+    hwstats_t after;
+    hwstore_stats(&hwstore, &after);
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+
+    printf("chunks cells = %ld, addr = %d, same = %d\n", stats.chunkcells, addr, same);
+    if (addr < 0 || !same || stats.chunkcells != 4 || after.chunkcells != 0) {
+        printf("chunks mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_txn(void) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 2);
+
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+    hwstore_set(&hwstore, "a", 2, "1", 2);
+    hwstore_set(&hwstore, "b", 2, "2", 2);
+    hwstore_set(&hwstore, "c", 2, "3", 2);
+
+    hwtxn_t hwtxn;
+    hwstore_txn_begin(&hwstore, &hwtxn);
+    hwstore_txn_set(&hwtxn, "a", 2, "10", 3);
+    hwstore_txn_del(&hwtxn, "b", 2);
+    hwstore_txn_set(&hwtxn, "d", 2, "4", 2);
+    hwstore_txn_del(&hwtxn, "e", 2);
+    hwstore_txn_set(&hwtxn, "a", 2, "11", 3);
+    int res = hwstore_txn_commit(&hwtxn);
+
+    int fails = 0;
+    char* val = NULL;
+    if (hwstore_get(&hwstore, "a", 2, &val) < 0 || strcmp(val, "11") != 0) fails++;
+    free(val);
+    val = NULL;
+    if (hwstore_get(&hwstore, "b", 2, &val) > 0) fails++;
+    if (hwstore_get(&hwstore, "c", 2, &val) < 0 || strcmp(val, "3") != 0) fails++;
+    free(val);
+    val = NULL;
+    if (hwstore_get(&hwstore, "d", 2, &val) < 0 || strcmp(val, "4") != 0) fails++;
+    free(val);
+    hwstats_t stats;
+    hwstore_stats(&hwstore, &stats);
+
+    /* Batch over device size fails as a whole */
+    char big[200];
+    memset(big, 'x', sizeof(big));
+    hwstore_txn_begin(&hwstore, &hwtxn);
+    hwstore_txn_set(&hwtxn, "a", 2, "12", 3);
+    for (int i = 0; i < 20; i++) {
+        char key[16];
+        sprintf(key, "big%02d", i);
+        hwstore_txn_set(&hwtxn, key, 6, big, sizeof(big));
+    }
+    int bigres = hwstore_txn_commit(&hwtxn);
+    val = NULL;
+    if (hwstore_get(&hwstore, "a", 2, &val) < 0 || strcmp(val, "11") != 0) fails++;
+    free(val);
+    if (hwstore_get(&hwstore, "big00", 6, &val) > 0) fails++;
+    hwstats_t after;
+    hwstore_stats(&hwstore, &after);
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+
+    printf("txn res = %d, big res = %d, live = %ld, fails = %d\n", res, bigres, stats.livecells, fails);
+    if (res != 0 || bigres != -1 || fails != 0 || stats.livecells != 3 || after.livecells != 3) {
+        printf("txn mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Commit reads only cells down to deepest old version, not whole chain */
+static int test_txn_cleanup(void) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 64);
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+    hwstore_setindex(&hwstore, 1);
+
+    char key[16];
+    for (int i = 0; i < 500; i++) {
+        sprintf(key, "key%04d", i);
+        hwstore_set(&hwstore, key, 8, "val", 4);
+    }
+
+    /* Newest key is near chain head */
+    hwstats_t before, after;
+    hwtxn_t hwtxn;
+    hwstore_stats(&hwstore, &before);
+    hwstore_txn_begin(&hwstore, &hwtxn);
+    hwstore_txn_set(&hwtxn, "key0499", 8, "new", 4);
+    hwstore_txn_set(&hwtxn, "fresh", 6, "new", 4);
+    hwstore_txn_del(&hwtxn, "key0498", 8);
+    hwstore_txn_del(&hwtxn, "missing", 8);
+    int res = hwstore_txn_commit(&hwtxn);
+    hwstore_stats(&hwstore, &after);
+    long nearreads = after.commit.reads - before.commit.reads;
+
+    int fails = 0;
+    char* val = NULL;
+    if (hwstore_get(&hwstore, "key0499", 8, &val) < 0 || strcmp(val, "new") != 0) fails++;
+    free(val);
+    if (hwstore_get(&hwstore, "key0498", 8, &val) > 0) fails++;
+    if (hwstore_get(&hwstore, "missing", 8, &val) > 0) fails++;
+    if (after.livecells != 500 || after.usedchain != 500) fails++;
+
+    /* Oldest key is at chain bottom, walk goes down to it */
+    hwstore_stats(&hwstore, &before);
+    hwstore_txn_begin(&hwstore, &hwtxn);
+    hwstore_txn_set(&hwtxn, "key0000", 8, "new", 4);
+    res |= hwstore_txn_commit(&hwtxn);
+    hwstore_stats(&hwstore, &after);
+    long deepreads = after.commit.reads - before.commit.reads;
+    if (after.livecells != 500) fails++;
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+
+    printf("txn cleanup near reads = %ld, deep reads = %ld, fails = %d\n", nearreads, deepreads, fails);
+    if (res != 0 || fails != 0 || nearreads > 30 || deepreads < 500) {
+        printf("txn cleanup mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_snapshot(void) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 2);
+
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+    hwstore_set(&hwstore, "a", 2, "1", 2);
+    hwstore_set(&hwstore, "b", 2, "2", 2);
+
+    hwsnap_t hwsnap;
+    hwstore_snapshot_open(&hwstore, &hwsnap);
+    hwstore_set(&hwstore, "a", 2, "9", 2);
+    hwstore_del(&hwstore, "b", 2);
+    hwstore_set(&hwstore, "c", 2, "3", 2);
+
+    int fails = 0;
+    char* val = NULL;
+    if (hwstore_snapshot_get(&hwsnap, "a", 2, &val) < 0 || strcmp(val, "1") != 0) fails++;
+    free(val);
+    val = NULL;
+    if (hwstore_snapshot_get(&hwsnap, "b", 2, &val) < 0 || strcmp(val, "2") != 0) fails++;
+    free(val);
+    val = NULL;
+    if (hwstore_snapshot_get(&hwsnap, "c", 2, &val) > 0) fails++;
+    if (hwstore_get(&hwstore, "a", 2, &val) < 0 || strcmp(val, "9") != 0) fails++;
+    free(val);
+    val = NULL;
+    if (hwstore_get(&hwstore, "b", 2, &val) > 0) fails++;
+
+    /* Writes between steps of walk do not change it */
+    int walked = 0;
+    char* key = NULL;
+    int keysize, valsize;
+    while (hwstore_snapshot_next(&hwsnap, &key, &keysize, &val, &valsize) > 0) {
+        hwstore_set(&hwstore, key, keysize, "x", 2);
+        if (strcmp(val, key[0] == 'a' ? "1" : "2") != 0) fails++;
+        free(key);
+        free(val);
+        walked++;
+    }
+
+    hwstats_t stats;
+    hwstore_stats(&hwstore, &stats);
+    hwstore_snapshot_close(&hwsnap);
+    hwstats_t after;
+    hwstore_stats(&hwstore, &after);
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+
+    printf("snapshot walked = %d, retired = %ld/%ld, fails = %d\n", walked, stats.retired, after.retired, fails);
+    if (fails != 0 || walked != 2 || stats.retired != 2 || after.retired != 0 || after.livecells != 3) {
+        printf("snapshot mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+typedef struct {
+    hwstore_t*  hwstore;
+    volatile int*   done;
+    long    gets;
+    long    torn;
+} readerarg_t;
+
+static void* store_reader(void* arg) {
+    readerarg_t* readerarg = (readerarg_t*)arg;
+    while (!*(readerarg->done)) {
+        char key[16];
+        sprintf(key, "key%02ld", readerarg->gets % 16);
+        char* val = NULL;
+        if (hwstore_get(readerarg->hwstore, key, 6, &val) > 0) {
+            /* Value is one repeated letter */
+            for (int i = 1; val[i] != 0; i++) {
+                if (val[i] != val[0]) readerarg->torn++;
+            }
+        }
+        free(val);
+        readerarg->gets++;
+    }
+    return NULL;
+}
+
+static int test_readers(void) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 64);
+    hwcost_t cost = { .opnsec = 0, .rnsec = 0, .wnsec = 0, .block = 1, .virtual = 1 };
+    hwmemory_setcost(&hwmemory, &cost);
+
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+
+    volatile int done = 0;
+    readerarg_t args[4];
+    pthread_t tids[4];
+    for (int i = 0; i < 4; i++) {
+        args[i].hwstore = &hwstore;
+        args[i].done = &done;
+        args[i].gets = 0;
+        args[i].torn = 0;
+        pthread_create(&tids[i], NULL, store_reader, &args[i]);
+    }
+
+    /* Values change size, so cells are freed and reused under readers */
+    int fails = 0;
+    for (int i = 0; i < 20000; i++) {
+        char key[16];
+        char val[64];
+        sprintf(key, "key%02d", i % 16);
+        int size = 1 + i % 40;
+        memset(val, 'a' + i % 26, size);
+        val[size] = 0;
+        if (i % 7 == 0) {
+            hwstore_del(&hwstore, key, 6);
+        } else if (hwstore_set(&hwstore, key, 6, val, size + 1) < 0) {
+            fails++;
+        }
+    }
+    done = 1;
+    long gets = 0;
+    long torn = 0;
+    for (int i = 0; i < 4; i++) {
+        pthread_join(tids[i], NULL);
+        gets += args[i].gets;
+        torn += args[i].torn;
+    }
+
+    hwstats_t stats;
+    hwstore_stats(&hwstore, &stats);
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+
+    printf("readers gets = %ld, torn = %ld, fails = %d\n", gets, torn, fails);
+    if (fails != 0 || torn != 0 || gets == 0) {
+        printf("readers mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_append(void) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 2);
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+
+    /* Short value leaves room in cell of long one */
+    hwstore_set(&hwstore, "log", 4, "0123456789", 10);
+    int first = hwstore_set(&hwstore, "log", 4, "ab", 2);
+    hwiostat_t before, after;
+    hwstore_iostat(&hwstore, &before);
+    int inplace = hwstore_append(&hwstore, "log", 4, "cd", 2);
+    hwstore_iostat(&hwstore, &after);
+    hwstore_set_ttl(&hwstore, "log", 4, 100);
+    int moved = hwstore_append(&hwstore, "log", 4, "efghijklmn", 10);
+
+    int fails = 0;
+    char* val = NULL;
+    int valsize = 0;
+    if (hwstore_getval(&hwstore, "log", 4, &val, &valsize) < 0 || valsize != 14
+        || memcmp(val, "abcdefghijklmn", 14) != 0) fails++;
+    free(val);
+    if (hwstore_ttl(&hwstore, "log", 4) <= 0) fails++;
+
+    long counter = 0;
+    int caddr = hwstore_incr(&hwstore, "hits", 5, 5, &counter);
+    if (counter != 5) fails++;
+    hwiostat_t incrbefore, incrafter;
+    hwstore_iostat(&hwstore, &incrbefore);
+    if (hwstore_incr(&hwstore, "hits", 5, -2, &counter) != caddr || counter != 3) fails++;
+    hwstore_iostat(&hwstore, &incrafter);
+    /* Key stays on device, only value and header are written */
+    if (incrafter.wbytes - incrbefore.wbytes != sizeof(hwcell_t) + sizeof(long)) fails++;
+    if (hwstore_incr(&hwstore, "log", 4, 1, &counter) != -1) fails++;
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+
+    long wcalls = after.wcalls - before.wcalls;
+    printf("append in place = %d, moved = %d, writes = %ld, fails = %d\n", inplace == first,
+                moved != first, wcalls, fails);
+    if (inplace != first || moved == first || wcalls != 2 || fails != 0) {
+        printf("append mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_log(void) {
+    char logpath[] = "/tmp/hwstore_log.XXXXXX";
+    close(mkstemp(logpath));
+
+    hwmemory_t leadmemory, followmemory;
+    hwmemory_init(&leadmemory, 1024 * 2);
+    hwmemory_init(&followmemory, 1024 * 2);
+    hwstore_t leader, follower;
+    hwstore_init(&leader, &leadmemory);
+    hwstore_init(&follower, &followmemory);
+
+    hwlog_t hwlog;
+    if (hwlog_open(&hwlog, logpath) < 0) {
+        printf("cannot open %s\n", logpath);
+        return 1;
+    }
+    hwstore_setlog(&leader, &hwlog);
+    hwstore_set(&leader, "a", 2, "1", 2);
+    hwstore_set(&leader, "b", 2, "2", 2);
+    hwstore_del(&leader, "a", 2);
+    hwtxn_t hwtxn;
+    hwstore_txn_begin(&leader, &hwtxn);
+    hwstore_txn_set(&hwtxn, "c", 2, "3", 2);
+    hwstore_txn_set(&hwtxn, "d", 2, "4", 2);
+    hwstore_txn_del(&hwtxn, "b", 2);
+    hwstore_txn_commit(&hwtxn);
+    hwstore_set_ttl(&leader, "d", 2, 100);
+    long seq = hwlog_seq(&hwlog);
+    hwlog_close(&hwlog);
+
+    /* Torn record at end is dropped on open */
+    FILE* file = fopen(logpath, "ab");
+    fwrite("HWLOG", 5, 1, file);
+    fclose(file);
+    hwlog_open(&hwlog, logpath);
+    long reopened = hwlog_seq(&hwlog);
+    hwlog_close(&hwlog);
+
+    hwfollow_t hwfollow;
+    hwfollow_open(&hwfollow, logpath, 0);
+    int first = hwstore_apply(&follower, &hwfollow, 1);
+    int rest = hwstore_apply(&follower, &hwfollow, 100);
+    long followseq = hwfollow.seq;
+    hwfollow_close(&hwfollow);
+
+    int fails = 0;
+    char* val = NULL;
+    if (hwstore_get(&follower, "a", 2, &val) > 0) fails++;
+    if (hwstore_get(&follower, "b", 2, &val) > 0) fails++;
+    if (hwstore_get(&follower, "c", 2, &val) < 0 || strcmp(val, "3") != 0) fails++;
+    free(val);
+    val = NULL;
+    if (hwstore_get(&follower, "d", 2, &val) < 0 || strcmp(val, "4") != 0) fails++;
+    free(val);
+    if (hwstore_ttl(&follower, "d", 2) <= 0) fails++;
+
+    hwstore_destroy(&leader);
+    hwstore_destroy(&follower);
+    hwmemory_destroy(&leadmemory);
+    hwmemory_destroy(&followmemory);
+    unlink(logpath);
+
+    printf("log seq = %ld/%ld/%ld, applied = %d+%d, fails = %d\n", seq, reopened, followseq, first, rest, fails);
+    if (seq != 7 || reopened != 7 || followseq != 7 || first != 1 || rest != 6 || fails != 0) {
+        printf("log mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_fixed(void) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 4);
+    fix16_t fix16;
+    int nslots = fix16_init(&fix16, &hwmemory);
+
+    int fails = 0;
+    char key[8], val[16], rval[16];
+    for (int i = 0; i < 150; i++) {
+        snprintf(key, sizeof(key), "k%06d", i);
+        snprintf(val, sizeof(val), "value%010d", i);
+        if (fix16_set(&fix16, key, val) < 0) fails++;
+    }
+    for (int i = 0; i < 150; i += 2) {
+        snprintf(key, sizeof(key), "k%06d", i);
+        if (fix16_del(&fix16, key) < 0) fails++;
+    }
+    /* Deleted slots are taken again until table is full */
+    int added = 0;
+    for (int i = 150; i < 1000; i++) {
+        snprintf(key, sizeof(key), "k%06d", i);
+        snprintf(val, sizeof(val), "value%010d", i);
+        if (fix16_set(&fix16, key, val) < 0) break;
+        added++;
+    }
+    for (int i = 1; i < 150; i += 2) {
+        snprintf(key, sizeof(key), "k%06d", i);
+        snprintf(val, sizeof(val), "value%010d", i);
+        if (fix16_get(&fix16, key, rval) < 0 || memcmp(val, rval, sizeof(val)) != 0) fails++;
+    }
+    snprintf(key, sizeof(key), "k%06d", 0);
+    if (fix16_get(&fix16, key, rval) >= 0) fails++;
+
+    fix16_t reopened;
+    fix16_open(&reopened, &hwmemory);
+    int count = reopened.count;
+    fix16_destroy(&reopened);
+    fix16_destroy(&fix16);
+    hwmemory_destroy(&hwmemory);
+
+    printf("fixed slots = %d, count = %d, added = %d, fails = %d\n", nslots, count, added, fails);
+    if (nslots != (4096 - 16) / 25 || count != nslots || added != nslots - 75 || fails != 0) {
+        printf("fixed mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_index(void) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 128);
+    hwcost_t cost = { .opnsec = 100, .rnsec = 1, .wnsec = 1, .block = 1, .virtual = 1 };
+    hwmemory_setcost(&hwmemory, &cost);
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+
+    /* Index is built from existing chain, then grows past first table */
+    char key[16];
+    char val[16];
+    for (int i = 0; i < 100; i++) {
+        sprintf(key, "key%04d", i);
+        sprintf(val, "val%04d", i);
+        hwstore_set(&hwstore, key, 8, val, 8);
+    }
+    hwstore_setindex(&hwstore, 1);
+    long capacity = hwstore.hwindex->table->capacity;
+    for (int i = 100; i < 1000; i++) {
+        sprintf(key, "key%04d", i);
+        sprintf(val, "val%04d", i);
+        hwstore_set(&hwstore, key, 8, val, 8);
+    }
+    for (int i = 0; i < 1000; i += 3) {
+        sprintf(key, "key%04d", i);
+        hwstore_del(&hwstore, key, 8);
+    }
+    hwstore_set(&hwstore, "key0001", 8, "longer value", 13);
+
+    hwsnap_t hwsnap;
+    hwstore_snapshot_open(&hwstore, &hwsnap);
+    hwtxn_t hwtxn;
+    hwstore_txn_begin(&hwstore, &hwtxn);
+    hwstore_txn_set(&hwtxn, "key0002", 8, "txn", 4);
+    hwstore_txn_del(&hwtxn, "key0004", 8);
+    hwstore_txn_set(&hwtxn, "key0003", 8, "back", 5);
+    hwstore_txn_commit(&hwtxn);
+
+    int fails = 0;
+    char* data = NULL;
+    if (hwstore_snapshot_get(&hwsnap, "key0002", 8, &data) < 0 || strcmp(data, "val0002") != 0) fails++;
+    free(data);
+    hwstore_snapshot_close(&hwsnap);
+
+    hwiostat_t before, after;
+    hwstore_iostat(&hwstore, &before);
+    for (int i = 0; i < 1000; i++) {
+        sprintf(key, "key%04d", i);
+        sprintf(val, "val%04d", i);
+        char* want = val;
+        if (i == 1) want = "longer value";
+        if (i == 2) want = "txn";
+        if (i == 3) want = "back";
+        if (i == 4 || (i % 3 == 0 && i != 3)) want = NULL;
+        data = NULL;
+        int addr = hwstore_get(&hwstore, key, 8, &data);
+        if ((want == NULL) != (addr < 0) || (want != NULL && strcmp(data, want) != 0)) fails++;
+        free(data);
+    }
+    hwstore_iostat(&hwstore, &after);
+    long count = hwstore.hwindex->count;
+    hwstats_t stats;
+    hwstore_stats(&hwstore, &stats);
+    hwstore_setindex(&hwstore, 0);
+    if (hwstore.hwindex != NULL) fails++;
+    if (hwstore_get(&hwstore, "key0002", 8, &data) < 0 || strcmp(data, "txn") != 0) fails++;
+    free(data);
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+
+    double reads = (double)(after.rcalls - before.rcalls) / 1000;
+    printf("index count = %ld, live = %ld, grown = %d, get reads/op = %.1f, fails = %d\n", count,
+                stats.livecells, capacity < count, reads, fails);
+    if (count != stats.livecells || capacity >= count || reads > 3.0 || fails != 0) {
+        printf("index mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Returns device writes of workload, fails counts wrong values */
+static long behind_run(long limit, int* fails) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 16);
+    /* Writes sleep, so sets come faster than flusher drains them */
+    hwcost_t cost = { .opnsec = 0, .rnsec = 0, .wnsec = 1000, .block = 1, .virtual = 0 };
+    hwmemory_setcost(&hwmemory, &cost);
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+    hwstore_setbehind(&hwstore, limit);
+
+    char key[16];
+    char val[16];
+    char* data = NULL;
+    for (int i = 0; i < 400; i++) {
+        sprintf(key, "key%02d", i % 20);
+        sprintf(val, "val%04d", i);
+        hwstore_set(&hwstore, key, 6, val, 8);
+        if (hwstore_get(&hwstore, key, 6, &data) < 0 || strcmp(data, val) != 0) (*fails)++;
+        free(data);
+    }
+    hwstore_sync(&hwstore);
+    hwiostat_t iostat;
+    hwstore_iostat(&hwstore, &iostat);
+
+    /* Device alone has every value after sync */
+    hwstore_setbehind(&hwstore, 0);
+    for (int i = 380; i < 400; i++) {
+        sprintf(key, "key%02d", i % 20);
+        sprintf(val, "val%04d", i);
+        if (hwstore_get(&hwstore, key, 6, &data) < 0 || strcmp(data, val) != 0) (*fails)++;
+        free(data);
+    }
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+    return iostat.wcalls;
+}
+
+static int test_behind(void) {
+    int fails = 0;
+    long through = behind_run(0, &fails);
+    long behind = behind_run(1024 * 64, &fails);
+    long pressed = behind_run(64, &fails);
+    printf("behind writes = %ld, through writes = %ld, pressed writes = %ld, fails = %d\n", behind,
+                through, pressed, fails);
+    if (behind >= through || pressed > through || fails != 0) {
+        printf("behind mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_scratch(void) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 16);
+    hwcost_t cost = { .opnsec = 0, .rnsec = 0, .wnsec = 0, .block = 1, .virtual = 1 };
+    hwmemory_setcost(&hwmemory, &cost);
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+
+    /* Same key size everywhere, so a miss compares every key */
+    char key[16];
+    char val[16];
+    for (int i = 0; i < 100; i++) {
+        sprintf(key, "key%04d", i);
+        sprintf(val, "val%04d", i);
+        hwstore_set(&hwstore, key, 8, val, 8);
+    }
+    char buf[16];
+    int valsize = 0;
+    hwstore_getbuf(&hwstore, "nokey00", 8, buf, sizeof(buf), &valsize);
+    hwstore_set(&hwstore, "key0000", 8, "val0000", 8);
+
+    int fails = 0;
+    hwstats_t before, after;
+    hwstore_stats(&hwstore, &before);
+    for (int i = 0; i < 100; i++) {
+        sprintf(key, "key%04d", i);
+        if (hwstore_getbuf(&hwstore, key, 8, buf, sizeof(buf), &valsize) < 0) fails++;
+        if (hwstore_getbuf(&hwstore, "nokey00", 8, buf, sizeof(buf), &valsize) > 0) fails++;
+        if (hwstore_set(&hwstore, key, 8, buf, 8) < 0) fails++;
+        if (hwstore_del(&hwstore, "nokey00", 8) > 0) fails++;
+    }
+    hwstore_stats(&hwstore, &after);
+    long grows = after.scratchgrows - before.scratchgrows;
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+
+    printf("scratch grows = %ld, warm up grows = %ld, fails = %d\n", grows, before.scratchgrows, fails);
+    if (grows != 0 || before.scratchgrows == 0 || fails != 0) {
+        printf("scratch mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_crc(void) {
+    int fails = 0;
+    if (hwcrc32c(0, "123456789", 9) != 0xE3069283) fails++;
+    if (hwcrc32c(hwcrc32c(0, "1234", 4), "56789", 5) != 0xE3069283) fails++;
+
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 4);
+    hwcost_t cost = { .opnsec = 100, .rnsec = 1, .wnsec = 1, .block = 1, .virtual = 1 };
+    hwmemory_setcost(&hwmemory, &cost);
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+    hwstore_setgrow(&hwstore, 1024 * 4);
+
+    char key[16];
+    char val[HWCHUNK_SIZE * 2];
+    memset(val, 'x', sizeof(val));
+    int first = hwstore_set(&hwstore, "key0000", 8, "val0000", 8);
+    for (int i = 1; i < 100; i++) {
+        sprintf(key, "key%04d", i);
+        hwstore_set(&hwstore, key, 8, val, i % 10 == 0 ? sizeof(val) : 8);
+        if (i % 3 == 0) hwstore_del(&hwstore, key, 8);
+    }
+    long counter = 0;
+    hwstore_incr(&hwstore, "key0001", 8, 0, &counter);
+    hwstore_append(&hwstore, "key0002", 8, "yy", 2);
+    hwstore_incr(&hwstore, "count", 6, 5, &counter);
+    hwstore_incr(&hwstore, "count", 6, 5, &counter);
+    hwstore_set(&hwstore, "last", 5, "lastval", 8);
+    hwstore_del(&hwstore, "key0004", 8);
+
+    /* Small budget resumes where previous call stopped */
+    int bad = 0;
+    hwstats_t stats;
+    int calls = 0;
+    do {
+        bad += hwstore_scrub(&hwstore, 512);
+        hwstore_stats(&hwstore, &stats);
+        calls++;
+    } while (stats.scrubpasses == 0);
+    long cells = stats.livecells + stats.freecells;
+    if (bad != 0 || stats.scrubbed != cells || calls < 2) fails++;
+
+    char buf[16];
+    int valsize = 0;
+    if (hwstore_getbuf(&hwstore, "key0002", 8, buf, sizeof(buf), &valsize) < 0 || valsize != 10) fails++;
+    if (hwstore_getbuf(&hwstore, "count", 6, buf, sizeof(buf), &valsize) < 0 || *(long*)buf != 10) fails++;
+
+    /* Flip value byte of first cell and header byte of a free one */
+    char byte;
+    int valpos = first + sizeof(hwcell_t) + 8;
+    hwmemory_read(&hwmemory, valpos, &byte, 1);
+    byte ^= 1;
+    hwmemory_write(&hwmemory, valpos, &byte, 1);
+    hwmemory_t* freememory = hwstore.extents[HWADDR_EXTENT(hwstore.freehead)].hwmemory;
+    int headpos = HWADDR_OFFSET(hwstore.freehead) + offsetof(hwcell_t, expire);
+    hwmemory_read(freememory, headpos, &byte, 1);
+    byte ^= 1;
+    hwmemory_write(freememory, headpos, &byte, 1);
+
+    if (hwstore_getbuf(&hwstore, "key0000", 8, buf, sizeof(buf), &valsize) > 0) fails++;
+    if (hwstore_getbuf(&hwstore, "last", 5, buf, sizeof(buf), &valsize) < 0) fails++;
+    hwstore_stats(&hwstore, &stats);
+    long getbad = stats.corrupt;
+    bad = hwstore_scrub(&hwstore, 1024 * 1024);
+    int extents = hwstore.nextents;
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+
+    printf("crc hardware = %d, extents = %d, scrubbed = %ld, bad on get = %ld, bad on scrub = %d\n",
+                hwcrc_hardware(), extents, cells, getbad, bad);
+    if (fails != 0 || extents < 2 || getbad != 1 || bad != 2) {
+        printf("crc mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Table address rewritten with valid checksums must still not be followed */
+static void crc_chunks_retable(hwmemory_t* hwmemory, int headpos, char* key, int* table, int nchunks) {
+    hwcell_t cell;
+    hwmemory_read(hwmemory, headpos, &cell, sizeof(hwcell_t));
+    hwmemory_write(hwmemory, headpos + sizeof(hwcell_t) + cell.keysize, table, nchunks * sizeof(int));
+    cell.datacrc = hwcrc32c(hwcrc32c(0, key, cell.keysize), table, nchunks * sizeof(int));
+    cell.crc = hwcrc32c(0, &cell, offsetof(hwcell_t, crc));
+    hwmemory_write(hwmemory, headpos, &cell, sizeof(hwcell_t));
+}
+
+static int test_crc_chunks(void) {
+    int fails = 0;
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 64);
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+
+    char val[HWCHUNK_SIZE * 2 + 100];
+    memset(val, 'x', sizeof(val));
+    int wild = hwstore_set(&hwstore, "wild", 5, val, sizeof(val));
+    int flipped = hwstore_set(&hwstore, "flipped", 8, val, sizeof(val));
+    int torn = hwstore_set(&hwstore, "torn", 5, val, sizeof(val));
+    hwstore_set(&hwstore, "plain", 6, "plainval", 9);
+    if (wild < 0 || flipped < 0 || torn < 0) fails++;
+
+    /* Negative and far addresses, table checksum made to match */
+    int table[3];
+    hwmemory_read(&hwmemory, wild + sizeof(hwcell_t) + 5, table, sizeof(table));
+    table[1] = -100;
+    table[2] = 0x7FFFFF00;
+    crc_chunks_retable(&hwmemory, wild, "wild", table, 3);
+
+    /* Data byte of middle chunk */
+    char byte;
+    hwmemory_read(&hwmemory, flipped + sizeof(hwcell_t) + 8, table, sizeof(table));
+    int datapos = table[1] + sizeof(hwcell_t) + 10;
+    hwmemory_read(&hwmemory, datapos, &byte, 1);
+    byte ^= 1;
+    hwmemory_write(&hwmemory, datapos, &byte, 1);
+
+    /* Table byte, checksum left as it was */
+    int tablepos = torn + sizeof(hwcell_t) + 5 + sizeof(int);
+    hwmemory_read(&hwmemory, tablepos, &byte, 1);
+    byte ^= 0x40;
+    hwmemory_write(&hwmemory, tablepos, &byte, 1);
+
+    char* got = NULL;
+    int valsize = 0;
+    char buf[sizeof(val)];
+    if (hwstore_getval(&hwstore, "wild", 5, &got, &valsize) > 0 || got != NULL) fails++;
+    if (hwstore_getbuf(&hwstore, "wild", 5, buf, sizeof(buf), &valsize) > 0) fails++;
+    if (hwstore_getval(&hwstore, "flipped", 8, &got, &valsize) > 0 || got != NULL) fails++;
+    if (hwstore_getval(&hwstore, "torn", 5, &got, &valsize) > 0 || got != NULL) fails++;
+    if (hwstore_append(&hwstore, "flipped", 8, "yy", 2) > 0) fails++;
+    if (hwstore_getval(&hwstore, "plain", 6, &got, &valsize) < 0 || valsize != 9) fails++;
+    free(got);
+
+    /* Snapshot walk skips corrupt values and returns the rest */
+    hwsnap_t hwsnap;
+    hwstore_snapshot_open(&hwstore, &hwsnap);
+    int walked = 0;
+    char* key = NULL;
+    int keysize = 0;
+    while (hwstore_snapshot_next(&hwsnap, &key, &keysize, &got, &valsize) > 0) {
+        walked++;
+        free(key);
+        free(got);
+    }
+    hwstore_snapshot_close(&hwsnap);
+
+    hwstats_t stats;
+    hwstore_stats(&hwstore, &stats);
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+
+    printf("crc chunks bad on read = %ld, walked = %d, fails = %d\n", stats.corrupt, walked, fails);
+    if (fails != 0 || stats.corrupt != 8 || walked != 1) {
+        printf("crc chunks mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Returns device reads of sets which find no fitting free cell */
+static long freemap_run(int enable, int* fails) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 64);
+    hwcost_t cost = { .opnsec = 100, .rnsec = 1, .wnsec = 1, .block = 1, .virtual = 1 };
+    hwmemory_setcost(&hwmemory, &cost);
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+    /* Lookups by index, so reads left are of allocation */
+    hwstore_setindex(&hwstore, 1);
+
+    char key[16];
+    char val[128];
+    memset(val, 'v', sizeof(val));
+    for (int i = 0; i < 400; i++) {
+        sprintf(key, "key%04d", i);
+        hwstore_set(&hwstore, key, 8, val, 8);
+    }
+    for (int i = 0; i < 400; i += 2) {
+        sprintf(key, "key%04d", i);
+        hwstore_del(&hwstore, key, 8);
+    }
+    /* Map is built by sequential read of cells, free chain is not walked */
+    hwstore_setfreemap(&hwstore, enable);
+    hwstats_t stats;
+    hwstore_stats(&hwstore, &stats);
+    if (enable && hwstore.hwfree->count != stats.freecells) (*fails)++;
+
+    hwiostat_t before, after;
+    hwstore_iostat(&hwstore, &before);
+    for (int i = 0; i < 50; i++) {
+        sprintf(key, "big%04d", i);
+        if (hwstore_set(&hwstore, key, 8, val, sizeof(val)) < 0) (*fails)++;
+    }
+    hwstore_iostat(&hwstore, &after);
+
+    /* Small values take freed cells, map keeps chain without reads */
+    hwiostat_t reusebefore, reuseafter;
+    hwstore_iostat(&hwstore, &reusebefore);
+    for (int i = 0; i < 400; i += 4) {
+        sprintf(key, "key%04d", i);
+        if (hwstore_set(&hwstore, key, 8, val, 8) < 0) (*fails)++;
+    }
+    hwstore_iostat(&hwstore, &reuseafter);
+    if (enable && reuseafter.rcalls != reusebefore.rcalls) (*fails)++;
+    hwstats_t reused;
+    hwstore_stats(&hwstore, &reused);
+    if (reused.freecells != stats.freecells - 100 || reused.tailhits != stats.tailhits + 50) (*fails)++;
+
+    /* Free chain on device is whole with map on too */
+    long chain = 0;
+    int prevpos = HWNULL;
+    for (int pos = hwstore.freehead; pos != HWNULL; chain++) {
+        hwcell_t cell;
+        hwmemory_read(&hwmemory, pos, &cell, sizeof(hwcell_t));
+        if ((cell.flags & HWCELL_FREE) == 0) (*fails)++;
+        if (enable && hwfree_get(hwstore.hwfree, pos)->prev != prevpos) (*fails)++;
+        prevpos = pos;
+        pos = cell.next;
+    }
+    if (chain != reused.freecells) (*fails)++;
+    hwstore_setfreemap(&hwstore, 0);
+    for (int i = 0; i < 400; i++) {
+        sprintf(key, "key%04d", i);
+        int valsize = 0;
+        char buf[16];
+        int addr = hwstore_getbuf(&hwstore, key, 8, buf, sizeof(buf), &valsize);
+        if ((addr > 0) != (i % 2 == 1 || i % 4 == 0)) (*fails)++;
+    }
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+    return after.rcalls - before.rcalls;
+}
+
+static int test_freemap(void) {
+    int fails = 0;
+    long chainreads = freemap_run(0, &fails);
+    long mapreads = freemap_run(1, &fails);
+
+    printf("freemap chain reads = %ld, map reads = %ld, fails = %d\n", chainreads, mapreads, fails);
+    if (mapreads * 10 > chainreads || fails != 0) {
+        printf("freemap mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Cell that fits is put before many too small ones of near capacity */
+static int test_freeclass(void) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 4);
+    hwcost_t cost = { .opnsec = 100, .rnsec = 1, .wnsec = 1, .block = 1, .virtual = 1 };
+    hwmemory_setcost(&hwmemory, &cost);
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+    hwstore_setindex(&hwstore, 1);
+    hwstore_setfreemap(&hwstore, 1);
+
+    char key[16];
+    char val[128];
+    memset(val, 'v', sizeof(val));
+    /* Data sizes 34 and 60 are below and above 50, 100 is far above */
+    int fit = hwstore_set(&hwstore, "fit0000", 8, val, 52);
+    for (int i = 0; i < 12; i++) {
+        sprintf(key, "small%02d", i);
+        hwstore_set(&hwstore, key, 8, val, 26);
+    }
+    int large = hwstore_set(&hwstore, "large00", 8, val, 92);
+    hwstore_set(&hwstore, "keep000", 8, val, 8);
+    hwstore_del(&hwstore, "fit0000", 8);
+    for (int i = 0; i < 12; i++) {
+        sprintf(key, "small%02d", i);
+        hwstore_del(&hwstore, key, 8);
+    }
+    hwstore_del(&hwstore, "large00", 8);
+
+    hwstats_t before, after;
+    hwstore_stats(&hwstore, &before);
+    int addr = hwstore_set(&hwstore, "new0000", 8, val, 42);
+    int second = hwstore_set(&hwstore, "new0001", 8, val, 42);
+    hwstore_stats(&hwstore, &after);
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+
+    long tailhits = after.tailhits - before.tailhits;
+    printf("freeclass fit taken = %d, larger taken next = %d, tail hits = %ld\n", addr == fit,
+                second == large, tailhits);
+    if (addr != fit || second != large || tailhits != 0) {
+        printf("freeclass mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Returns device blocks touched by reads of 300 cell headers, one block is 512 */
+static long align_run(int align, long* padbytes, int* fails) {
+    hwmemory_t hwmemory;
+    hwmemory_init(&hwmemory, 1024 * 16);
+    hwcost_t cost = { .opnsec = 0, .rnsec = 1, .wnsec = 1, .block = 512, .virtual = 1 };
+    hwmemory_setcost(&hwmemory, &cost);
+    hwstore_t hwstore;
+    hwstore_init(&hwstore, &hwmemory);
+    hwstore_setgrow(&hwstore, 1024 * 8);
+    hwstore_setindex(&hwstore, 1);
+    if (hwstore_setalign(&hwstore, 48) == 0 || hwstore_setalign(&hwstore, HWALIGN_MAX * 2) == 0) (*fails)++;
+    /* Header of 52 bytes would cross block at offset 504 */
+    if (hwstore_setalign(&hwstore, 8) == 0 || hwstore_setalign(&hwstore, 32) == 0) (*fails)++;
+    if (hwstore_setalign(&hwstore, align) < 0) (*fails)++;
+
+    char key[16];
+    char val[160];
+    int addrs[300];
+    for (int i = 0; i < 300; i++) {
+        sprintf(key, "key%04d", i);
+        memset(val, 'a' + i % 26, sizeof(val));
+        addrs[i] = hwstore_set(&hwstore, key, 8, val, 1 + (i * 37) % 150);
+        if (i % 5 == 0) hwstore_del(&hwstore, key, 8);
+    }
+    /* Freed cells are taken again by other sizes */
+    for (int i = 0; i < 300; i += 5) {
+        sprintf(key, "key%04d", i);
+        memset(val, 'a' + i % 26, sizeof(val));
+        addrs[i] = hwstore_set(&hwstore, key, 8, val, 1 + (i * 37) % 150);
+    }
+    if (hwstore_setalign(&hwstore, align) == 0) (*fails)++;
+
+    for (int i = 0; i < 300; i++) {
+        int offset = HWADDR_OFFSET(addrs[i]);
+        if (addrs[i] <= 0 || offset % align != 0) (*fails)++;
+        if (align > 1 && offset % 512 + (int)sizeof(hwcell_t) > 512) (*fails)++;
+    }
+
+    for (int i = 0; i < 300; i++) {
+        sprintf(key, "key%04d", i);
+        int valsize = 0;
+        char buf[160];
+        hwstore_getbuf(&hwstore, key, 8, buf, sizeof(buf), &valsize);
+        if (valsize != 1 + (i * 37) % 150 || buf[0] != 'a' + i % 26) (*fails)++;
+    }
+
+    /* Read costs rnsec for each byte of whole blocks it touches */
+    long blocks = 0;
+    for (int i = 0; i < 300; i++) {
+        hwmemory_t* extmemory = hwstore.extents[HWADDR_EXTENT(addrs[i])].hwmemory;
+        hwiostat_t before, after;
+        hwmemory_iostat(extmemory, &before);
+        hwcell_t cell;
+        hwmemory_read(extmemory, HWADDR_OFFSET(addrs[i]), &cell, sizeof(hwcell_t));
+        hwmemory_iostat(extmemory, &after);
+        blocks += (after.rnsec - before.rnsec) / 512;
+    }
+
+    /* Walks by cell bounds find every cell */
+    hwstats_t stats;
+    hwstore_stats(&hwstore, &stats);
+    if (stats.extents < 2 || hwstore_scrub(&hwstore, 1024 * 1024) != 0) (*fails)++;
+    hwstore_stats(&hwstore, &stats);
+    if (stats.scrubbed != stats.livecells + stats.freecells) (*fails)++;
+    hwstore_setfreemap(&hwstore, 1);
+    if (hwstore.hwfree->count != stats.freecells) (*fails)++;
+    *padbytes = stats.padbytes;
+
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
+    return blocks;
+}
+
+static int test_align(void) {
+    int fails = 0;
+    long plainpad, alignpad;
+    long plain = align_run(1, &plainpad, &fails);
+    long aligned = align_run(64, &alignpad, &fails);
+
+    /* Blocks smaller than header or not matching align cannot keep it whole */
+    int blocks[] = { 32, 96, 1 };
+    for (int i = 0; i < 3; i++) {
+        hwmemory_t hwmemory;
+        hwmemory_init(&hwmemory, 1024);
+        hwcost_t cost = { .opnsec = 0, .rnsec = 1, .wnsec = 1, .block = blocks[i], .virtual = 1 };
+        hwmemory_setcost(&hwmemory, &cost);
+        hwstore_t hwstore;
+        hwstore_init(&hwstore, &hwmemory);
+        if ((hwstore_setalign(&hwstore, 64) == 0) != (blocks[i] == 1)) fails++;
+        hwstore_destroy(&hwstore);
+        hwmemory_destroy(&hwmemory);
+    }
+
+    printf("align header blocks plain = %ld, aligned = %ld, pad bytes = %ld, fails = %d\n", plain, aligned,
+                alignpad, fails);
+    if (aligned != 300 || plain <= aligned || plainpad != 0 || alignpad == 0 || fails != 0) {
+        printf("align mismatch\n");
+        return 1;
+    }
+    return 0;
+}
 
 int main(int argc, char **argv) {
 
+    if (test_banks() != 0) return 1;
+    if (test_trace() != 0) return 1;
+    if (test_iov() != 0) return 1;
+    if (test_ttl() != 0) return 1;
+    if (test_cache() != 0) return 1;
+    if (test_evict() != 0) return 1;
+    if (test_grow() != 0) return 1;
+    if (test_chunks() != 0) return 1;
+    if (test_txn() != 0) return 1;
+    if (test_txn_cleanup() != 0) return 1;
+    if (test_snapshot() != 0) return 1;
+    if (test_readers() != 0) return 1;
+    if (test_log() != 0) return 1;
+    if (test_append() != 0) return 1;
+    if (test_fixed() != 0) return 1;
+    if (test_index() != 0) return 1;
+    if (test_behind() != 0) return 1;
+    if (test_scratch() != 0) return 1;
+    if (test_crc() != 0) return 1;
+    if (test_crc_chunks() != 0) return 1;
+    if (test_freemap() != 0) return 1;
+    if (test_freeclass() != 0) return 1;
+    if (test_align() != 0) return 1;
+
     hwmemory_t hwmemory;
     hwmemory_init(&hwmemory, 1024 * 16);
 
+    /* Check cost model on virtual clock */
+    hwcost_t cost = { .opnsec = 100, .rnsec = 5, .wnsec = 10, .block = 16, .virtual = 1 };
+    hwmemory_setcost(&hwmemory, &cost);
+    char buffer[20] = { 0 };
+    long start = hwmemory_tclock();
+    hwmemory_write(&hwmemory, 0, buffer, sizeof(buffer));
+    hwmemory_read(&hwmemory, 0, buffer, sizeof(buffer));
+    long spent = hwmemory_tclock() - start;
+    printf("model time = %ld\n", spent);
+    if (spent != (100 + 32 * 10) + (100 + 32 * 5)) {
+        printf("model time mismatch\n");
+        return 1;
+    }
+
     hwstore_t hwstore;
     hwstore_init(&hwstore, &hwmemory);
 
@@ -75,5 +1464,46 @@ int main(int argc, char **argv) {
 
     hwstore_print(&hwstore);
 
+    /* Delete every third key and grow the rest to exercise free chain */
+    for (int i = 0; i < count; i += 3) {
+        char* key = NULL;
+        asprintf(&key, "key%04d", i);
+        hwstore_del(&hwstore, key, strlen(key) + 1);
+        free(key);
+    }
+    for (int i = 1; i < count; i += 3) {
+        char* key = NULL;
+        char* val = NULL;
+        asprintf(&key, "key%04d", i);
+        asprintf(&val, "value%04d", i);
+        hwstore_set(&hwstore, key, strlen(key) + 1, val, strlen(val) + 1);
+        free(key);
+        free(val);
+    }
+
+    hwstats_t stats;
+    hwstore_stats(&hwstore, &stats);
+    printf("stats live = %ld, free = %ld, used chain = %ld, free chain = %ld\n",
+                stats.livecells, stats.freecells, stats.usedchain, stats.freechain);
+    printf("stats live bytes = %ld, free bytes = %ld, wasted bytes = %ld, meta bytes = %ld\n",
+                stats.livebytes, stats.freebytes, stats.wastedbytes, stats.metabytes);
+    printf("stats head hits = %ld, free hits = %ld, tail hits = %ld, fails = %ld\n",
+                stats.headhits, stats.freehits, stats.tailhits, stats.allocfails);
+    printf("stats get reads/op = %.1f, set reads/op = %.1f, del reads/op = %.1f\n",
+                stats.get.avgreads, stats.set.avgreads, stats.del.avgreads);
+
+    hwiostat_t iostat;
+    hwmemory_iostat(&hwmemory, &iostat);
+    printf("iostat reads = %ld/%ld bytes, writes = %ld/%ld bytes, device time = %ld ns\n",
+                iostat.rcalls, iostat.rbytes, iostat.wcalls, iostat.wbytes, hwmemory_vclock(&hwmemory));
+
+    if (stats.livecells != count - (count + 2) / 3 || stats.livecells != stats.usedchain
+        || stats.livecells + stats.freecells != stats.headhits + stats.tailhits) {
+        printf("stats mismatch\n");
+        return 1;
+    }
+
+    hwstore_destroy(&hwstore);
+    hwmemory_destroy(&hwmemory);
     return 0;
 }